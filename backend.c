@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <string.h>
+#include "image.h"
+#include "chain.h"
+#include "backend.h"
+#include "counters.h"
+
+//Every backend the library was built with, in the order --backend lists them
+static const Backend* backends[]={&serialBackend,&openmpBackend,&pthreadsBackend,&offloadBackend};
+#define BACKEND_COUNT (int)(sizeof(backends)/sizeof(backends[0]))
+
+//The backend convolute dispatches to
+static const Backend* current=&serialBackend;
+
+//convoluteSerial: Applies a chain of convolution kernels to an image on the calling thread
+//Parameters: srcImage: The image being convoluted
+//            destImage: A pointer to a  pre-allocated (including space for the pixel array) structure to receive the convoluted image.  It should be the same size as srcImage
+//            chain: The kernels to apply, one after another
+//            border: How to fill in pixels past the edge of the image (BORDER_CLAMP reuses the edge pixel)
+//            borderValue: The pixel value used past the edge for BORDER_CONSTANT
+//Returns: Nothing
+static void convoluteSerial(Image* srcImage,Image* destImage,KernelChain* chain,enum BorderModes border,uint8_t borderValue){
+    int pass;
+    ChainPlan plan;
+    if (makeChainPlan(chain,srcImage,border,borderValue,&plan)){
+        printf("Error: Failed to allocate memory for the convolution.\n");
+        return;
+    }
+    for (pass=0;pass<chainPasses(&plan);pass++){
+        CounterValues start;
+        countersBegin(&start);
+        convoluteChainRows(srcImage,destImage,0,srcImage->height,&plan,pass);
+        countersEnd(&start,0);
+    }
+    freeChainPlan(&plan);
+}
+
+//startSerial, serialThreads, stopSerial: The serial backend has no options and no threads of its own
+static void startSerial(Options* options){
+    (void)options;
+}
+
+static int serialThreads(){
+    return 1;
+}
+
+static void stopSerial(){
+}
+
+const Backend serialBackend={"serial",startSerial,serialThreads,convoluteSerial,NULL,NULL,stopSerial};
+
+//GetBackend: Converts the name of a backend into the Backend itself
+//Parameters: name: serial, openmp, pthreads or offload
+//Returns: The matching backend, or NULL if the name is unknown
+const Backend* GetBackend(char* name){
+    int i;
+    for (i=0;i<BACKEND_COUNT;i++)
+        if (!strcmp(name,backends[i]->name)) return backends[i];
+    return NULL;
+}
+
+//setBackend: Makes every later convolute call run on backend
+void setBackend(const Backend* backend){
+    current=backend;
+}
+
+//switchBackend: Stops the current backend and starts another in its place, for a run that only settles on its
+//backend once it has seen the image
+//Parameters: backend: The backend to start
+//            options: The settings it starts with
+//Returns: backend
+const Backend* switchBackend(const Backend* backend,Options* options){
+    current->stop();
+    setBackend(backend);
+    setPngRunner(backend->pngRunner);
+    backend->start(options);
+    return backend;
+}
+
+//getBackend: Returns the backend convolute runs on
+const Backend* getBackend(){
+    return current;
+}
+
+//convolute:  Applies a chain of convolution kernels to an image with the current backend
+//Parameters: srcImage: The image being convoluted
+//            destImage: A pointer to a  pre-allocated (including space for the pixel array) structure to receive the convoluted image.  It should be the same size as srcImage
+//            chain: The kernels to apply, one after another
+//            border: How to fill in pixels past the edge of the image (BORDER_CLAMP reuses the edge pixel)
+//            borderValue: The pixel value used past the edge for BORDER_CONSTANT
+//Returns: Nothing
+void convolute(Image* srcImage,Image* destImage,KernelChain* chain,enum BorderModes border,uint8_t borderValue){
+    current->convolute(srcImage,destImage,chain,border,borderValue);
+}
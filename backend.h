@@ -0,0 +1,36 @@
+#ifndef ___BACKEND
+#define ___BACKEND
+#include <stdint.h>
+#include "image.h"
+#include "options.h"
+#include "timing.h"
+#include "batch.h"
+#include "png.h"
+
+//One way of running a convolution, picked with --backend.  start applies the options the backend uses (--threads, and
+//--tile and --schedule for OpenMP) before the first image, and stop releases whatever it started.  threads returns
+//how many threads convolute runs on.  pngRunner compresses the blocks of a PNG on the backend's threads, or is NULL to
+//compress them on the calling thread, and report adds the backend's own details to a Timing record, or is NULL.
+typedef struct{
+    const char* name;
+    void (*start)(Options* options);
+    int (*threads)();
+    void (*convolute)(Image* srcImage,Image* destImage,KernelChain* chain,enum BorderModes border,uint8_t borderValue);
+    PngRunner pngRunner;
+    TimingHook report;
+    void (*stop)();
+} Backend;
+
+extern const Backend serialBackend;
+extern const Backend openmpBackend;
+extern const Backend pthreadsBackend;
+extern const Backend offloadBackend;
+
+const Backend* GetBackend(char* name);
+const Backend* startRun(int argc,char** argv,char* defaultBackend,Options* options,KernelChain* chain,Timing* timing);
+int finishRun(KernelChain* chain,const Backend* backend,int result);
+void setBackend(const Backend* backend);
+const Backend* switchBackend(const Backend* backend,Options* options);
+const Backend* getBackend();
+
+#endif
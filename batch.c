@@ -0,0 +1,413 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "image.h"
+#include "timing.h"
+#include "options.h"
+#include "queue.h"
+#include "imageio.h"
+#include "batch.h"
+#include "stb_image.h"
+#include "png.h"
+#include "buffers.h"
+#include "counters.h"
+
+//The file extensions stb_image can decode, used to pick the images out of a directory
+static const char* imageExtensions[]={"jpg","jpeg","png","bmp","tga","gif","psd","pic","pnm","ppm","pgm","hdr"};
+
+//One image on its way through the batch pipeline.  It belongs to one stage at a time, handed on through the queues.
+//busyNs, idleNs and steals are this image's own copy of the backend's worker statistics.
+typedef struct{
+    char* fileName;
+    Image srcImage;
+    ImageFile srcFile;
+    Image destImage;
+    Timing timing;
+    int64_t started;
+    int64_t* busyNs;
+    int64_t* idleNs;
+    int* steals;
+} BatchImage;
+
+//The state shared by the three stages of a batch.  Images flow decode -> decoded -> convolute -> convoluted -> encode.
+typedef struct{
+    Options* options;
+    KernelChain* chain;
+    FileList* list;
+    Timing* base;
+    SpscQueue decoded;
+    SpscQueue convoluted;
+    int failures;
+} Pipeline;
+
+//isBatchInput: Returns 1 if the file name argument names a list file (@list.txt) or a directory instead of one image
+int isBatchInput(char* fileName){
+    struct stat info;
+    if (fileName[0]=='@') return 1;
+    return !stat(fileName,&info) && S_ISDIR(info.st_mode);
+}
+
+//isImageName: Returns 1 if a file name ends in one of imageExtensions
+static int isImageName(const char* name){
+    int i;
+    const char* dot=strrchr(name,'.');
+    if (!dot) return 0;
+    for (i=0;i<(int)(sizeof(imageExtensions)/sizeof(imageExtensions[0]));i++)
+        if (!strcasecmp(dot+1,imageExtensions[i])) return 1;
+    return 0;
+}
+
+//compareNames: qsort comparison for file names and paths
+static int compareNames(const void* a,const void* b){
+    return strcmp(*(char* const*)a,*(char* const*)b);
+}
+
+//addFile: Appends a copy of a path to a FileList
+//Returns: 0 on success, -1 if memory could not be allocated
+static int addFile(FileList* list,const char* directory,const char* name){
+    char** grown=realloc(list->files,(list->count+1)*sizeof(char*));
+    char* path=malloc((directory?strlen(directory)+1:0)+strlen(name)+1);
+    if (!grown || !path){
+        if (grown) list->files=grown;
+        free(path);
+        return -1;
+    }
+    list->files=grown;
+    if (directory) sprintf(path,"%s/%s",directory,name);
+    else strcpy(path,name);
+    list->files[list->count++]=path;
+    return 0;
+}
+
+//GetFileList: Converts the file name argument into the list of images to process
+//Parameters: fileName: An image, @ followed by a text file listing one image per line (blank lines and lines starting
+//                      with # are skipped), or a directory, whose images are processed in name order
+//            list: The FileList to populate.  Release it with freeFileList.
+//Returns: 0 on success, -1 if the list file or directory could not be read
+int GetFileList(char* fileName,FileList* list){
+    list->count=0;
+    list->files=NULL;
+    if (fileName[0]=='@'){
+        char line[4096];
+        FILE* file=fopen(fileName+1,"r");
+        if (!file) return -1;
+        while (fgets(line,sizeof(line),file)){
+            int length=strlen(line);
+            while (length && (line[length-1]=='\n' || line[length-1]=='\r' || line[length-1]==' ')) line[--length]=0;
+            if (!length || line[0]=='#') continue;
+            if (addFile(list,NULL,line)){
+                fclose(file);
+                freeFileList(list);
+                return -1;
+            }
+        }
+        fclose(file);
+    }
+    else if (isBatchInput(fileName)){
+        struct dirent* entry;
+        DIR* directory=opendir(fileName);
+        if (!directory) return -1;
+        while ((entry=readdir(directory))){
+            if (entry->d_name[0]=='.' || !isImageName(entry->d_name)) continue;
+            if (addFile(list,fileName,entry->d_name)){
+                closedir(directory);
+                freeFileList(list);
+                return -1;
+            }
+        }
+        closedir(directory);
+        qsort(list->files,list->count,sizeof(char*),compareNames);
+    }
+    else if (addFile(list,NULL,fileName)) return -1;
+    return 0;
+}
+
+//freeFileList: Releases the paths of a FileList
+void freeFileList(FileList* list){
+    int i;
+    for (i=0;i<list->count;i++) free(list->files[i]);
+    free(list->files);
+    list->files=NULL;
+    list->count=0;
+}
+
+//GetOutputPath: Returns where the result for an input image is written
+//Parameters: fileName: The input image
+//            options: The parsed command line, for outDir and output
+//Returns: outDir/<input name without its extension>.png, otherwise the --output path or output.png.  Release it with free.
+char* GetOutputPath(char* fileName,Options* options){
+    char* path;
+    char* outDir=options->outDir;
+    const char* base=strrchr(fileName,'/');
+    const char* dot;
+    int length;
+    if (!outDir){
+        const char* name=options->output?options->output:"output.png";
+        path=malloc(strlen(name)+1);
+        if (path) strcpy(path,name);
+        return path;
+    }
+    base=base?base+1:fileName;
+    dot=strrchr(base,'.');
+    length=dot&&dot!=base?dot-base:(int)strlen(base);
+    path=malloc(strlen(outDir)+length+6);
+    if (path) sprintf(path,"%s/%.*s.png",outDir,length,base);
+    return path;
+}
+
+//checkOutputPaths: Makes sure no two images of a batch are written to the same file, as a.jpg and a.png would both
+//be written to outDir/a.png
+//Parameters: list: The images of the batch
+//            options: The parsed command line, for GetOutputPath
+//Returns: 0 if every image has its own output, -1 (after printing an error) otherwise
+static int checkOutputPaths(FileList* list,Options* options){
+    char** paths=calloc(list->count,sizeof(char*));
+    int i,result=0;
+    if (!paths){
+        printf("Error allocating memory for the batch.\n");
+        return -1;
+    }
+    for (i=0;i<list->count && !result;i++)
+        if (!(paths[i]=GetOutputPath(list->files[i],options))){
+            printf("Error allocating memory for the batch.\n");
+            result=-1;
+        }
+    if (!result){
+        qsort(paths,list->count,sizeof(char*),compareNames);
+        for (i=1;i<list->count && !result;i++)
+            if (!strcmp(paths[i-1],paths[i])){
+                printf("Error: two images of the batch would both be written to %s.\n",paths[i]);
+                result=-1;
+            }
+    }
+    for (i=0;i<list->count;i++) free(paths[i]);
+    free(paths);
+    return result;
+}
+
+//makeOutputDirectory: Creates the --outdir directory if it does not exist yet
+//Parameters: outDir: The directory, or NULL when results go to output.png
+//Returns: 0 on success, -1 (after printing an error) if it could not be created
+int makeOutputDirectory(char* outDir){
+    if (!outDir || !mkdir(outDir,0777) || errno==EEXIST) return 0;
+    printf("Error creating output directory %s.\n",outDir);
+    return -1;
+}
+
+//decodeStage: Decodes every image of the batch in order and queues it for convolute.  Runs on its own thread.
+//An image that fails to decode is still queued, with no pixels, so encode can report it in order.
+static void* decodeStage(void* argument){
+    Pipeline* pipeline=argument;
+    int i;
+    for (i=0;i<pipeline->list->count;i++){
+        BatchImage* image=calloc(1,sizeof(BatchImage));
+        Image* src;
+        if (!image){
+            printf("Error allocating memory for %s.\n",pipeline->list->files[i]);
+            break;
+        }
+        src=&image->srcImage;
+        image->fileName=pipeline->list->files[i];
+        image->timing=*pipeline->base;
+        image->timing.fileName=image->fileName;
+        image->timing.pipelined=1;
+        image->started=timingNow();
+        openImage(image->fileName,pipeline->options,src,&image->srcFile);
+        if (src->data) reduceImage(src,&image->srcFile,pipeline->options,pipeline->chain);
+        image->timing.decodeNs=timingNow()-image->started;
+        spscPush(&pipeline->decoded,image,&image->timing.decodeBlockedNs,&image->timing.decodeDepth);
+    }
+    spscClose(&pipeline->decoded);
+    return NULL;
+}
+
+//copyWorkers: Gives an image its own copy of the worker statistics a TimingHook pointed its timing at, since the
+//backend keeps updating its arrays for the next image while this one waits to be encoded
+//Returns: 0 on success, -1 if memory could not be allocated
+static int copyWorkers(BatchImage* image){
+    Timing* timing=&image->timing;
+    if (!timing->workers) return 0;
+    image->busyNs=malloc(timing->workers*sizeof(int64_t));
+    image->idleNs=malloc(timing->workers*sizeof(int64_t));
+    image->steals=malloc(timing->workers*sizeof(int));
+    if (!image->busyNs || !image->idleNs || !image->steals){
+        timing->workers=0;
+        return -1;
+    }
+    memcpy(image->busyNs,timing->busyNs,timing->workers*sizeof(int64_t));
+    memcpy(image->idleNs,timing->idleNs,timing->workers*sizeof(int64_t));
+    memcpy(image->steals,timing->steals,timing->workers*sizeof(int));
+    timing->busyNs=image->busyNs;
+    timing->idleNs=image->idleNs;
+    timing->steals=image->steals;
+    return 0;
+}
+
+//freeBatchImage: Releases an image and everything it still holds.  NULL is ignored.
+static void freeBatchImage(BatchImage* image){
+    if (!image) return;
+    closeImage(&image->srcImage,&image->srcFile);
+    freeImage(&image->destImage);
+    free(image->busyNs);
+    free(image->idleNs);
+    free(image->steals);
+    free(image);
+}
+
+//convoluteImage: Runs the chain over one decoded image into a destination from the buffer pool, which after the first
+//few images is a buffer an earlier image released.  The source pixels are released as soon as they have been read.
+//Returns: 0 on success, -1 if the destination could not be allocated
+static int convoluteImage(Pipeline* pipeline,BatchImage* image,KernelChain* chain,TimingHook hook){
+    Image* src=&image->srcImage;
+    Image* dest=&image->destImage;
+    int64_t t2=timingNow();
+    outputSize(src,pipeline->options,dest);
+    image->timing.width=dest->width;
+    image->timing.height=dest->height;
+    image->timing.bpp=dest->bpp;
+    allocImage(dest);
+    image->timing.allocNs=timingNow()-t2;
+    if (!dest->data) return -1;
+    t2=timingNow();
+    convolutePlanes(src,dest,chain,pipeline->options);
+    image->timing.convoluteNs=timingNow()-t2;
+    countersReport(&image->timing);
+    if (hook) hook(&image->timing);
+    closeImage(src,&image->srcFile);
+    return copyWorkers(image);
+}
+
+//encodeStage: Writes every convoluted image and its timing record, then releases it.  Runs on its own thread.
+static void* encodeStage(void* argument){
+    Pipeline* pipeline=argument;
+    Options* options=pipeline->options;
+    BatchImage* image;
+    int64_t starved=0;
+    while ((image=spscPop(&pipeline->convoluted,&starved))){
+        Timing* timing=&image->timing;
+        char* outPath=GetOutputPath(image->fileName,options);
+        int64_t t2=timingNow();
+        timing->encodeStarvedNs=starved;
+        starved=0;
+        if (!image->destImage.data || !outPath){
+            printf(image->timing.width?"Error allocating memory for %s.\n":"Error loading file %s.\n",image->fileName);
+            pipeline->failures++;
+        }
+        else{
+            if (writePng(outPath,&image->destImage)){
+                printf("Error writing file %s.\n",outPath);
+                pipeline->failures++;
+            }
+            timing->encodeNs=timingNow()-t2;
+            timing->totalNs=timingNow()-image->started;
+            timingPrint(timing);
+            if (timingWriteReport(timing,options->reportFormat,options->reportFile)) pipeline->failures++;
+        }
+        free(outPath);
+        freeBatchImage(image);
+    }
+    return NULL;
+}
+
+//printQueue: Prints the depth statistics of one pipeline queue
+static void printQueue(const char* name,SpscQueue* queue){
+    printf("%s queue: average depth %.2f, max %d of %d\n",name,queue->pushes?(double)queue->depthSum/queue->pushes:0.0,
+        queue->maxDepth,queue->capacity);
+}
+
+//runBatch: Applies a kernel chain to every image named by the file name option and writes each result
+//Decode, convolute and encode are separate pipeline stages on their own threads (convolute on the calling thread, so
+//it can use the backend's own threads as usual), joined by bounded single producer, single consumer queues.  Several
+//images are in flight at once and the slowest stage sets the throughput.  Image buffers come from the buffer pool,
+//so once the pipeline is full they are reused instead of allocated and faulted in again.  Every image gets a timing line and report record, whose total is its latency from the
+//start of its decode to the end of its encode, along with the queue depths and waits it saw.
+//Parameters: options: The parsed command line.  fileName is an image, a directory or an @list, results go to outDir,
+//                     which must be given and must not take two images to the same name, as PNGs.  output must
+//                     not be set.  queueDepth bounds how many images wait between two stages.
+//            chain: The kernels to apply
+//            base: The fields every image's Timing starts from (backend, kernel, simd, threads)
+//            hook: Called after each convolution to fill in backend specific Timing fields, or NULL
+//Returns: 0 if every image was processed, -1 otherwise
+int runBatch(Options* options,KernelChain* chain,Timing* base,TimingHook hook){
+    int processed=0,failures=0,depth=options->queueDepth?options->queueDepth:BATCH_QUEUE_DEPTH;
+    int64_t batchStart=timingNow(),starved=0;
+    pthread_t decodeThread,encodeThread;
+    FileList list;
+    Pipeline pipeline;
+    BatchImage* image;
+    if (options->planar){
+        printf("Error: --planar is not supported for batches.\n");
+        return -1;
+    }
+    if (!options->outDir){
+        printf("Error: a directory or @list needs --outdir for its results.\n");
+        return -1;
+    }
+    if (options->output){
+        printf("Error: --output names one image, but a batch writes a PNG per image to --outdir.\n");
+        return -1;
+    }
+    if (GetFileList(options->fileName,&list) || !list.count){
+        printf("Error reading the image list %s.\n",options->fileName);
+        return -1;
+    }
+    if (checkOutputPaths(&list,options) || makeOutputDirectory(options->outDir)){
+        freeFileList(&list);
+        return -1;
+    }
+    memset(&pipeline,0,sizeof(Pipeline));
+    pipeline.options=options;
+    pipeline.list=&list;
+    pipeline.base=base;
+    pipeline.chain=chain;
+    if (makeSpscQueue(&pipeline.decoded,depth)){
+        printf("Error allocating memory for the batch.\n");
+        freeFileList(&list);
+        return -1;
+    }
+    if (makeSpscQueue(&pipeline.convoluted,depth)){
+        printf("Error allocating memory for the batch.\n");
+        freeSpscQueue(&pipeline.decoded);
+        freeFileList(&list);
+        return -1;
+    }
+    if (pthread_create(&decodeThread,NULL,decodeStage,&pipeline)){
+        printf("Error starting the decode thread.\n");
+        failures=list.count;
+    }
+    else if (pthread_create(&encodeThread,NULL,encodeStage,&pipeline)){
+        printf("Error starting the encode thread.\n");
+        pthread_join(decodeThread,NULL);
+        while ((image=spscTryPop(&pipeline.decoded))) freeBatchImage(image);
+        failures=list.count;
+    }
+    else{
+        while ((image=spscPop(&pipeline.decoded,&starved))){
+            image->timing.convoluteStarvedNs=starved;
+            starved=0;
+            processed++;
+            if (image->srcImage.data && convoluteImage(&pipeline,image,chain,hook)) freeImage(&image->destImage);
+            spscPush(&pipeline.convoluted,image,&image->timing.convoluteBlockedNs,&image->timing.encodeDepth);
+        }
+        spscClose(&pipeline.convoluted);
+        pthread_join(decodeThread,NULL);
+        pthread_join(encodeThread,NULL);
+        // images decode could not allocate never reached encode
+        failures=pipeline.failures+list.count-processed;
+    }
+    printf("Processed %d of %d images in %.6f seconds\n",list.count-failures,list.count,(timingNow()-batchStart)/1e9);
+    printQueue("Convolute",&pipeline.decoded);
+    printQueue("Encode",&pipeline.convoluted);
+    printf("Stalls: decode blocked %.6f, convolute starved %.6f, convolute blocked %.6f, encode starved %.6f seconds\n",
+        pipeline.decoded.blockedNs/1e9,pipeline.decoded.starvedNs/1e9,pipeline.convoluted.blockedNs/1e9,
+        pipeline.convoluted.starvedNs/1e9);
+    freeSpscQueue(&pipeline.decoded);
+    freeSpscQueue(&pipeline.convoluted);
+    freeFileList(&list);
+    return failures?-1:0;
+}
@@ -0,0 +1,26 @@
+#ifndef ___BATCH
+#define ___BATCH
+#include "image.h"
+#include "timing.h"
+#include "options.h"
+
+//How many images may wait between two stages of a batch unless --queue-depth says otherwise
+#define BATCH_QUEUE_DEPTH 2
+
+//Called after each image of a batch is convoluted so a build can add its own details (tile size, worker times) to the report
+typedef void (*TimingHook)(Timing* timing);
+
+//The list of input files of a batch
+typedef struct{
+    int count;
+    char** files;
+} FileList;
+
+int isBatchInput(char* fileName);
+int GetFileList(char* fileName,FileList* list);
+void freeFileList(FileList* list);
+char* GetOutputPath(char* fileName,Options* options);
+int makeOutputDirectory(char* outDir);
+int runBatch(Options* options,KernelChain* chain,Timing* base,TimingHook hook);
+
+#endif
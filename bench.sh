@@ -0,0 +1,98 @@
+#!/bin/sh
+# Benchmark suite over every backend, kernel and thread count.
+# Each image (pic1-pic4.jpg and synthetic raw RGB images of the SIZES) is convoluted by every kernel on every backend at
+# every thread count, the serial backend only at one thread.  Every configuration gets WARMUP untimed runs and then
+# TRIALS timed ones, and $OUT gets one line per configuration with the median, 10th and 90th percentile, minimum and
+# maximum convolute time and the median throughput, with any commas in the kernel written as + (gauss+edge).  Output
+# goes to a raw file, so PNG encoding stays out of the runs.
+# Given BASELINE, an $OUT from an earlier release, any configuration whose median got more than TOLERANCE percent slower
+# is listed and the script fails, so two releases can be compared with make bench BASELINE=old.csv.
+# Settings come from the environment: BACKENDS, KERNELS, THREADS, IMAGES, SIZES, WARMUP, TRIALS, SCRATCH, OUT,
+# BASELINE and TOLERANCE.
+BACKENDS=${BACKENDS:-serial openmp pthreads}
+KERNELS=${KERNELS:-edge sharpen blur gauss emboss identity}
+IMAGES=${IMAGES:-pic1.jpg pic2.jpg pic3.jpg pic4.jpg}
+SIZES=${SIZES:-3840x2160 7680x4320 15360x8640}
+WARMUP=${WARMUP:-1}
+TRIALS=${TRIALS:-5}
+SCRATCH=${SCRATCH:-/tmp}
+OUT=${OUT:-bench.csv}
+TOLERANCE=${TOLERANCE:-5}
+
+# 1, 2, 4, ... threads up to the number of cores, and the number of cores itself
+if [ -z "$THREADS" ]; then
+    cores=$(getconf _NPROCESSORS_ONLN 2>/dev/null || echo 1)
+    THREADS=1
+    count=2
+    while [ $count -lt $cores ]; do
+        THREADS="$THREADS $count"
+        count=$((count*2))
+    done
+    [ $cores -gt 1 ] && THREADS="$THREADS $cores"
+fi
+
+# makeImage <width>x<height> <file>: writes a raw RGB image of random pixels, kept between runs
+makeImage(){
+    [ -f "$2" ] || head -c $((${1%x*}*${1#*x}*3)) /dev/urandom > "$2"
+}
+
+# column <name> <report>: prints one column of the last line of a --report csv file.  The kernel field may be quoted
+# and hold commas, so the column is counted from the end of the line.
+column(){
+    awk -F, -v name=$1 'NR==1 {for (i=1;i<=NF;i++) if ($i==name) back=NF-i} END {print $(NF-back)}' "$2"
+}
+
+# run <image> <label> <backend> <kernel> <threads> [options...]: times one configuration and adds its line to $OUT
+run(){
+    image=$1 label=$2 backend=$3 kernel=$4 threads=$5
+    shift 5
+    rm -f "$SCRATCH/bench_times"
+    trial=0
+    while [ $trial -lt $((WARMUP+TRIALS)) ]; do
+        rm -f "$SCRATCH/bench_report.csv"
+        ./image "$image" $kernel --backend $backend --threads $threads --output "$SCRATCH/bench_out.raw" "$@" \
+            --report csv --report-file "$SCRATCH/bench_report.csv" > /dev/null || exit 1
+        [ $trial -ge $WARMUP ] && column convolute_ns "$SCRATCH/bench_report.csv" >> "$SCRATCH/bench_times"
+        trial=$((trial+1))
+    done
+    width=$(column width "$SCRATCH/bench_report.csv")
+    height=$(column height "$SCRATCH/bench_report.csv")
+    # chains (gauss,edge) and weight lists hold commas, which would shift the columns the BASELINE check reads
+    name=$(printf '%s' "$kernel" | tr , +)
+    # nearest rank percentiles of the sorted times
+    sort -n "$SCRATCH/bench_times" | awk -v key="$label,$width,$height,$backend,$name,$threads" -v pixels=$((width*height)) '
+        {t[NR]=$1}
+        function rank(p,  i) {i=int((p*NR+99)/100); return t[i<1?1:i]}
+        END {printf "%s,%d,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n",key,NR,rank(50)/1e6,rank(10)/1e6,rank(90)/1e6,t[1]/1e6,t[NR]/1e6,
+            pixels/(rank(50)/1e3)}' | tee -a "$OUT"
+}
+
+echo "image,width,height,backend,kernel,threads,trials,median_ms,p10_ms,p90_ms,min_ms,max_ms,median_mpix_per_s" | tee "$OUT"
+for size in $SIZES; do
+    makeImage $size "$SCRATCH/bench_$size.raw"
+done
+for backend in $BACKENDS; do
+    for threads in $THREADS; do
+        [ $backend = serial ] && [ $threads -ne 1 ] && continue
+        for kernel in $KERNELS; do
+            for image in $IMAGES; do
+                run "$image" "$image" $backend $kernel $threads
+            done
+            for size in $SIZES; do
+                run "$SCRATCH/bench_$size.raw" "synthetic_$size" $backend $kernel $threads --raw ${size}x3
+            done
+        done
+    done
+done
+rm -f "$SCRATCH/bench_out.raw" "$SCRATCH/bench_report.csv" "$SCRATCH/bench_times"
+
+# configurations whose median is more than TOLERANCE percent above the baseline's
+if [ -n "$BASELINE" ]; then
+    awk -F, -v tolerance=$TOLERANCE 'FNR==1 {next}
+        NR==FNR {base[$1","$4","$5","$6]=$8; next}
+        ($1","$4","$5","$6) in base {
+            old=base[$1","$4","$5","$6]
+            if ($8>old*(1+tolerance/100)) {printf "Regression: %s %s %s %s threads %.3f -> %.3f ms\n",$1,$4,$5,$6,old,$8; slower++}
+        }
+        END {exit slower>0}' "$BASELINE" "$OUT" || exit 1
+fi
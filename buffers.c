@@ -0,0 +1,113 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "image.h"
+#include "buffers.h"
+
+//The buffers released for reuse, shared by every thread.  Each buffer is preceded by one cache line holding its
+//capacity, so giveBuffer only needs the pointer.
+static void* idle[BUFFER_POOL_SLOTS];
+static int idleCount=0;
+static pthread_mutex_t poolLock=PTHREAD_MUTEX_INITIALIZER;
+
+//capacityOf: Returns the usable size of a buffer from takeBuffer
+static size_t capacityOf(void* buffer){
+    return *(size_t*)((uint8_t*)buffer-BUFFER_ALIGNMENT);
+}
+
+//takeBuffer: Returns an aligned buffer of at least size bytes, reusing a released one when one fits
+//The smallest idle buffer that fits is taken, as long as it is no more than twice the size asked for, so a full image
+//buffer is not tied up holding a small strip.  A reused buffer has already been faulted in, and keeps whatever it held.
+//Parameters: size: The number of bytes needed
+//Returns: A buffer starting on a BUFFER_ALIGNMENT boundary, to be released with giveBuffer, or NULL if memory could not
+//         be allocated
+void* takeBuffer(size_t size){
+    int i,best=-1;
+    uint8_t* block;
+    pthread_mutex_lock(&poolLock);
+    for (i=0;i<idleCount;i++){
+        size_t capacity=capacityOf(idle[i]);
+        if (capacity>=size && capacity/2<=size && (best<0 || capacity<capacityOf(idle[best]))) best=i;
+    }
+    if (best>=0){
+        void* buffer=idle[best];
+        idle[best]=idle[--idleCount];
+        pthread_mutex_unlock(&poolLock);
+        return buffer;
+    }
+    pthread_mutex_unlock(&poolLock);
+    size=(size+BUFFER_ALIGNMENT-1)/BUFFER_ALIGNMENT*BUFFER_ALIGNMENT;
+    block=aligned_alloc(BUFFER_ALIGNMENT,size+BUFFER_ALIGNMENT);
+    if (!block) return NULL;
+    *(size_t*)block=size;
+    return block+BUFFER_ALIGNMENT;
+}
+
+//giveBuffer: Releases a buffer from takeBuffer so a later takeBuffer can reuse it.  NULL is ignored.
+//Parameters: buffer: The buffer.  When every slot is in use the smallest of the idle buffers and this one is freed.
+//Returns: Nothing
+void giveBuffer(void* buffer){
+    int i,smallest=0;
+    if (!buffer) return;
+    pthread_mutex_lock(&poolLock);
+    if (idleCount<BUFFER_POOL_SLOTS){
+        idle[idleCount++]=buffer;
+        buffer=NULL;
+    }
+    else{
+        for (i=1;i<idleCount;i++)
+            if (capacityOf(idle[i])<capacityOf(idle[smallest])) smallest=i;
+        if (capacityOf(idle[smallest])<capacityOf(buffer)){
+            void* evicted=idle[smallest];
+            idle[smallest]=buffer;
+            buffer=evicted;
+        }
+    }
+    pthread_mutex_unlock(&poolLock);
+    if (buffer) free((uint8_t*)buffer-BUFFER_ALIGNMENT);
+}
+
+//resizeBuffer: Grows a buffer from takeBuffer, keeping its contents, for code written against realloc
+//Parameters: buffer: The buffer, or NULL to take a new one
+//            size: The number of bytes needed
+//Returns: buffer itself if it already holds size bytes, otherwise a new buffer holding a copy of it (buffer is then
+//         released), or NULL if memory could not be allocated, in which case buffer is left alone
+void* resizeBuffer(void* buffer,size_t size){
+    void* grown;
+    if (!buffer) return takeBuffer(size);
+    if (capacityOf(buffer)>=size) return buffer;
+    grown=takeBuffer(size);
+    if (!grown) return NULL;
+    memcpy(grown,buffer,capacityOf(buffer));
+    giveBuffer(buffer);
+    return grown;
+}
+
+//freeBuffers: Frees every idle buffer, at the end of a run
+void freeBuffers(){
+    pthread_mutex_lock(&poolLock);
+    while (idleCount) free((uint8_t*)idle[--idleCount]-BUFFER_ALIGNMENT);
+    pthread_mutex_unlock(&poolLock);
+}
+
+//rowStride: Returns the stride allocImage gives rows of width pixels of bpp bytes: their bytes rounded up to a whole
+//number of cache lines, so every row starts aligned and vector loads of one row touch as few lines as possible
+int rowStride(int width,int bpp){
+    return ((width*bpp+BUFFER_ALIGNMENT-1)/BUFFER_ALIGNMENT)*BUFFER_ALIGNMENT;
+}
+
+//allocImage: Allocates the pixels of an image from the buffer pool, with cache line aligned rows
+//Parameters: image: An image whose width, height and bpp are set.  Receives data and stride.  Release it with
+//                   freeImage.
+//Returns: 0 on success, -1 if memory could not be allocated
+int allocImage(Image* image){
+    image->stride=rowStride(image->width,image->bpp);
+    image->data=takeBuffer((size_t)image->stride*image->height);
+    return image->data?0:-1;
+}
+
+//freeImage: Returns the pixels of an image from allocImage to the buffer pool.  An image with no pixels is ignored.
+void freeImage(Image* image){
+    giveBuffer(image->data);
+    image->data=NULL;
+}
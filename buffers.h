@@ -0,0 +1,22 @@
+#ifndef ___BUFFERS
+#define ___BUFFERS
+#include <stddef.h>
+#include "image.h"
+
+//Every buffer from takeBuffer starts on a cache line, and allocImage rounds rows up to whole cache lines so every row
+//does too
+#define BUFFER_ALIGNMENT 64
+
+//How many released buffers are kept for reuse.  When more are released the smallest are freed, since the large ones
+//cost the most page faults to get back.
+#define BUFFER_POOL_SLOTS 16
+
+void* takeBuffer(size_t size);
+void giveBuffer(void* buffer);
+void* resizeBuffer(void* buffer,size_t size);
+void freeBuffers();
+int rowStride(int width,int bpp);
+int allocImage(Image* image);
+void freeImage(Image* image);
+
+#endif
@@ -0,0 +1,149 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "image.h"
+#include "convolve.h"
+#include "chain.h"
+#include "buffers.h"
+
+static int fusionEnabled=1;
+
+//setChainFusion: Turns line fusion of chained kernels on or off, mostly useful for benchmarking
+//Parameters: enabled: 0 to always run a chain one whole image stage at a time
+//Returns: Nothing
+void setChainFusion(int enabled){
+    fusionEnabled=enabled;
+}
+
+//getChainFusion: Returns 0 if --no-fuse turned line fusion off, 1 otherwise
+int getChainFusion(){
+    return fusionEnabled;
+}
+
+//makeChainPlan: Plans every stage of a kernel chain and decides whether the stages can be fused
+//Stages are fused unless a stage uses the FFT method, which wants whole tiles, or the border mode is wrap, where the top
+//rows of a stage read the bottom rows of the stage before and no strip holds both.
+//Parameters: chain: The kernels to apply, in order
+//            srcImage: The image the chain will be applied to, used to size the intermediate images
+//            border: How pixels past the edge of the image are filled in, for every stage
+//            borderValue: The pixel value used past the edge in BORDER_CONSTANT mode
+//            plan: The ChainPlan to populate.  Release it with freeChainPlan.
+//Returns: 0 on success, -1 if memory could not be allocated
+int makeChainPlan(KernelChain* chain,Image* srcImage,enum BorderModes border,uint8_t borderValue,ChainPlan* plan){
+    int i,temps;
+    long span=(long)srcImage->width*srcImage->bpp;
+    memset(plan,0,sizeof(ChainPlan));
+    plan->plans=calloc(chain->count,sizeof(ConvolutionPlan));
+    if (!plan->plans) return -1;
+    plan->fused=chain->count>1 && fusionEnabled && border!=BORDER_WRAP;
+    for (i=0;i<chain->count;i++){
+        if (makeConvolutionPlan(&chain->kernels[i],border,borderValue,&plan->plans[i])){
+            freeChainPlan(plan);
+            return -1;
+        }
+        plan->count++;
+        plan->radius+=chain->kernels[i].size/2;
+        if (plan->plans[i].method==METHOD_FFT) plan->fused=0;
+    }
+    plan->stripRows=CHAIN_STRIP_BYTES/span-2*plan->radius;
+    if (plan->stripRows<2*plan->radius) plan->stripRows=2*plan->radius;
+    if (plan->stripRows<8) plan->stripRows=8;
+    temps=plan->fused?0:chain->count>2?2:chain->count-1;
+    for (i=0;i<temps;i++){
+        plan->temp[i]=*srcImage;
+        if (allocImage(&plan->temp[i])){
+            freeChainPlan(plan);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+//freeChainPlan: Releases the stage plans and intermediate images of a ChainPlan
+void freeChainPlan(ChainPlan* plan){
+    int i;
+    for (i=0;i<plan->count;i++) freeConvolutionPlan(&plan->plans[i]);
+    free(plan->plans);
+    freeImage(&plan->temp[0]);
+    freeImage(&plan->temp[1]);
+    memset(plan,0,sizeof(ChainPlan));
+}
+
+//chainPasses: Returns how many passes over the image a chain needs.  Every row of a pass must be finished before the
+//next pass starts.
+int chainPasses(ChainPlan* plan){
+    return plan->fused?1:plan->count;
+}
+
+//chainRowBlock: Returns a good number of rows to hand to each call of convoluteChainRows in a pass
+//Parameters: plan: The plan being run
+//            pass: The pass, from 0 to chainPasses(plan)-1
+//            defaultRows: The block size the caller would use for a direct kernel
+//Returns: One strip for a fused chain, otherwise the block size of the stage the pass runs
+int chainRowBlock(ChainPlan* plan,int pass,int defaultRows){
+    if (plan->fused) return plan->stripRows;
+    return planRowBlock(&plan->plans[pass],defaultRows);
+}
+
+//fusedStrip: Runs every stage of a fused chain for output rows startRow to endRow
+//Stage j is computed for the output rows plus the rows the later stages read around them.  Each stage reads a sub-image
+//of the previous stage's rows, and because that sub-image only stops short of the real image edge where the extra rows
+//are, convoluteRows applies the border exactly as it would on the whole image.  The buffers hold rows of stride bytes.
+static void fusedStrip(Image* srcImage,Image* destImage,int startRow,int endRow,ChainPlan* plan,uint8_t** buffers,int stride){
+    int stage,height=srcImage->height,after=plan->radius;
+    int inputStart=startRow-after<0?0:startRow-after;
+    int inputEnd=endRow+after>height?height:endRow+after;
+    Image input=*srcImage,output=*srcImage;
+    input.data=srcImage->data+(long)inputStart*srcImage->stride;
+    input.height=inputEnd-inputStart;
+    for (stage=0;stage<plan->count;stage++){
+        int start,end;
+        after-=plan->plans[stage].kernel.size/2;
+        start=startRow-after<0?0:startRow-after;
+        end=endRow+after>height?height:endRow+after;
+        // the output sub-image starts at the same row as the input so convoluteRows can use one row index for both
+        output.stride=stage==plan->count-1?destImage->stride:stride;
+        output.data=stage==plan->count-1?destImage->data+(long)inputStart*destImage->stride:buffers[stage%2];
+        output.height=input.height;
+        convoluteRows(&input,&output,start-inputStart,end-inputStart,&plan->plans[stage]);
+        input.data=output.data+(long)(start-inputStart)*output.stride;
+        input.stride=output.stride;
+        input.height=end-start;
+        inputStart=start;
+    }
+}
+
+//convoluteChainBlock: Runs one pass of a chain over a rectangle of the image
+//Parameters: srcImage: The image being convoluted
+//            destImage: The pre-allocated destination image, the same size as srcImage
+//            startRow: The first row to compute
+//            endRow: One past the last row to compute
+//            startColumn: The first column to compute
+//            endColumn: One past the last column to compute.  A fused pass always computes whole rows, since its strips
+//                       have no room for the columns of overlap a narrower block would need.
+//            plan: The plan from makeChainPlan
+//            pass: The pass to run.  A fused chain runs all of its stages in pass 0, otherwise pass i runs stage i from
+//                  the previous stage's ping-pong image into the next.
+//Returns: Nothing
+void convoluteChainBlock(Image* srcImage,Image* destImage,int startRow,int endRow,int startColumn,int endColumn,ChainPlan* plan,int pass){
+    int row,stripRows=plan->stripRows,stride=rowStride(srcImage->width,srcImage->bpp);
+    long bufferBytes=(long)(stripRows+2*plan->radius)*stride;
+    uint8_t* buffers[2];
+    if (!plan->fused){
+        Image* input=pass==0?srcImage:&plan->temp[(pass-1)%2];
+        Image* output=pass==plan->count-1?destImage:&plan->temp[pass%2];
+        convoluteBlock(input,output,startRow,endRow,startColumn,endColumn,&plan->plans[pass]);
+        return;
+    }
+    buffers[0]=takeBuffer(2*bufferBytes);
+    if (!buffers[0]) return;
+    buffers[1]=buffers[0]+bufferBytes;
+    for (row=startRow;row<endRow;row+=stripRows)
+        fusedStrip(srcImage,destImage,row,row+stripRows<endRow?row+stripRows:endRow,plan,buffers,stride);
+    giveBuffer(buffers[0]);
+}
+
+//convoluteChainRows: Runs one pass of a chain over a range of whole rows, see convoluteChainBlock
+void convoluteChainRows(Image* srcImage,Image* destImage,int startRow,int endRow,ChainPlan* plan,int pass){
+    convoluteChainBlock(srcImage,destImage,startRow,endRow,0,srcImage->width,plan,pass);
+}
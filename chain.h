@@ -0,0 +1,30 @@
+#ifndef ___CHAIN
+#define ___CHAIN
+#include "image.h"
+#include "convolve.h"
+
+//Roughly how many bytes of intermediate rows one strip of a fused chain keeps live, sized to stay in a per-core L2 cache
+#define CHAIN_STRIP_BYTES (512*1024)
+
+//Everything needed to run a KernelChain.  A fused chain runs every stage over one strip of rows at a time, recomputing
+//the few rows of overlap each stage needs, so intermediate rows are still in cache when the next stage reads them.
+//Chains that cannot be fused run one stage at a time over the whole image through the temp ping-pong images.
+typedef struct{
+    int count;
+    ConvolutionPlan* plans;
+    int fused;
+    int radius;
+    int stripRows;
+    Image temp[2];
+} ChainPlan;
+
+void setChainFusion(int enabled);
+int getChainFusion();
+int makeChainPlan(KernelChain* chain,Image* srcImage,enum BorderModes border,uint8_t borderValue,ChainPlan* plan);
+void freeChainPlan(ChainPlan* plan);
+int chainPasses(ChainPlan* plan);
+int chainRowBlock(ChainPlan* plan,int pass,int defaultRows);
+void convoluteChainBlock(Image* srcImage,Image* destImage,int startRow,int endRow,int startColumn,int endColumn,ChainPlan* plan,int pass);
+void convoluteChainRows(Image* srcImage,Image* destImage,int startRow,int endRow,ChainPlan* plan,int pass);
+
+#endif
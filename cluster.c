@@ -0,0 +1,285 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+
+#include "image.h"
+#include "timing.h"
+#include "options.h"
+#include "batch.h"
+#include "imageio.h"
+#include "buffers.h"
+#include "backend.h"
+#include "counters.h"
+
+//The backend each rank convolutes its band on unless --backend says otherwise
+#ifndef DEFAULT_BACKEND
+#define DEFAULT_BACKEND "openmp"
+#endif
+
+//One rank's share of an image: it computes rows start to end-1, held in a window with above rows of the band before
+//it and below rows of the band after it.  Those halo rows come from the neighboring ranks, and are the chain's
+//radius deep except at the top and bottom of the image, where there is no neighbor unless borders wrap.
+typedef struct{
+    int start;
+    int end;
+    int above;
+    int below;
+} Band;
+
+//bandOf: Splits the rows of an image as evenly as possible between the ranks
+//Parameters: rank,ranks: Which band, of how many
+//            height: The number of rows in the image
+//            radius: The number of rows each stage of the chain reads above and below a row, summed over the chain
+//            wrap: Whether the first and last bands are neighbors
+//Returns: The band
+static Band bandOf(int rank,int ranks,int height,int radius,int wrap){
+    Band band;
+    band.start=(int)((int64_t)height*rank/ranks);
+    band.end=(int)((int64_t)height*(rank+1)/ranks);
+    band.above=rank>0 || (wrap && ranks>1)?radius:0;
+    band.below=rank<ranks-1 || (wrap && ranks>1)?radius:0;
+    return band;
+}
+
+//rowType: Makes an MPI datatype for one row of span bytes whose rows start stride bytes apart, so a count of rows can
+//be sent straight out of (or into) a padded image.  Release it with MPI_Type_free.
+static MPI_Datatype rowType(int span,int stride){
+    MPI_Datatype row,spaced;
+    MPI_Type_contiguous(span,MPI_BYTE,&row);
+    MPI_Type_create_resized(row,0,stride,&spaced);
+    MPI_Type_free(&row);
+    MPI_Type_commit(&spaced);
+    return spaced;
+}
+
+//agree: Returns 1 if ok is set on every rank, so all of them take the same path after a step that can fail on one
+static int agree(int ok){
+    int all;
+    MPI_Allreduce(&ok,&all,1,MPI_INT,MPI_MIN,MPI_COMM_WORLD);
+    return all;
+}
+
+//writeBands: Writes every rank's band of the result straight into a PPM/PGM or raw file with collective MPI-IO
+//Parameters: fileName: The output file
+//            format: FORMAT_PNM or FORMAT_RAW
+//            rows: The first row of this rank's band, packed rows of span bytes
+//            band: This rank's band
+//            width,height,bpp: The size of the whole image
+//            row: The MPI datatype of one packed row
+//Returns: 0 on every rank if the file was written, -1 on every rank otherwise
+static int writeBands(char* fileName,enum ImageFormats format,uint8_t* rows,Band* band,int width,int height,int bpp,MPI_Datatype row){
+    char header[PNM_HEADER_MAX];
+    int headerLength=0,rank,ok;
+    MPI_Offset span=(MPI_Offset)width*bpp;
+    MPI_File file;
+    MPI_Comm_rank(MPI_COMM_WORLD,&rank);
+    if (format==FORMAT_PNM){
+        headerLength=formatPnmHeader(header,width,height,bpp);
+        if (headerLength<0){
+            if (!rank) printf("Error: PPM/PGM output needs 1 or 3 channels, not %d.\n",bpp);
+            return -1;
+        }
+    }
+    if (MPI_File_open(MPI_COMM_WORLD,fileName,MPI_MODE_CREATE|MPI_MODE_WRONLY,MPI_INFO_NULL,&file)!=MPI_SUCCESS) return -1;
+    ok=MPI_File_set_size(file,headerLength+span*height)==MPI_SUCCESS;
+    if (!rank && headerLength)
+        ok=ok && MPI_File_write_at(file,0,header,headerLength,MPI_BYTE,MPI_STATUS_IGNORE)==MPI_SUCCESS;
+    ok=MPI_File_write_at_all(file,headerLength+span*band->start,rows,band->end-band->start,row,MPI_STATUS_IGNORE)==MPI_SUCCESS && ok;
+    ok=MPI_File_close(&file)==MPI_SUCCESS && ok;
+    return agree(ok)?0:-1;
+}
+
+//runCluster: Convolutes one image split into row bands across the ranks of MPI_COMM_WORLD
+//Rank 0 loads the image and scatters one band to each rank.  Each rank then swaps halo rows with the ranks above and
+//below it and convolutes its window on its own threads with the local backend.  As in runStream, the rows a window
+//edge spoils are exactly the halo rows, so they are dropped and only the band is kept.  PPM/PGM and raw results are
+//written by every rank at once with MPI-IO, and anything else is gathered to rank 0 and written as a PNG.
+//Every rank reads the same command line.  --threads is per rank, so set it when several ranks share a node.
+//Parameters: argc,argv: The arguments passed to main
+//Returns: 0 on success, -1 on failure
+static int runCluster(int argc,char** argv){
+    Options options;
+    KernelChain chain;
+    Timing timing;
+    const Backend* backend;
+    Image srcImage,destImage,window,destWindow;
+    ImageFile srcFile,destFile;
+    Band band;
+    MPI_Datatype row,spacedRow;
+    int rank,ranks,i,radius=0,span,bandRows,result=0;
+    int size[4]={0,0,0,0};
+    int* counts=NULL;
+    int* starts=NULL;
+    int64_t t1,t2,local[5],slowest[5];
+    char* outPath;
+    enum ImageFormats format;
+    t1=timingNow();
+    MPI_Comm_rank(MPI_COMM_WORLD,&rank);
+    MPI_Comm_size(MPI_COMM_WORLD,&ranks);
+    backend=startRun(argc,argv,DEFAULT_BACKEND,&options,&chain,&timing);
+    if (!backend) return -1;
+    if (options.stream || options.outDir || isBatchInput(options.fileName) || options.scale>1 || options.roiWidth || options.planar){
+        if (!rank) printf("Error: image-mpi convolutes one interleaved image, without --stream, batches, --scale or --roi.\n");
+        return finishRun(&chain,backend,-1);
+    }
+    for (i=0;i<chain.count;i++) radius+=chain.kernels[i].size/2;
+    outPath=options.output?options.output:"output.png";
+    format=GetImageFormat(outPath);
+
+    // rank 0 loads the image and tells the others its size, or that it could not
+    t2=timingNow();
+    if (!rank){
+        openImage(options.fileName,&options,&srcImage,&srcFile);
+        // with scale and roi ruled out this only converts a mapped image for --luma
+        if (srcImage.data) reduceImage(&srcImage,&srcFile,&options,&chain);
+        if (srcImage.data){
+            size[0]=srcImage.width;
+            size[1]=srcImage.height;
+            size[2]=srcImage.bpp;
+            size[3]=srcImage.stride;
+        }
+        else printf("Error loading file %s.\n",options.fileName);
+    }
+    MPI_Bcast(size,4,MPI_INT,0,MPI_COMM_WORLD);
+    timing.decodeNs=timingNow()-t2;
+    if (!size[0]) return finishRun(&chain,backend,-1);
+    if (ranks>1 && size[1]/ranks<radius){
+        if (!rank){
+            printf("Error: %d ranks give bands of fewer than the %d rows the kernels reach.\n",ranks,radius);
+            closeImage(&srcImage,&srcFile);
+        }
+        return finishRun(&chain,backend,-1);
+    }
+    timing.width=size[0];
+    timing.height=size[1];
+    timing.bpp=size[2];
+    timing.ranks=ranks;
+    span=size[0]*size[2];
+    band=bandOf(rank,ranks,size[1],radius,options.border==BORDER_WRAP);
+    bandRows=band.end-band.start;
+
+    // the windows stay packed so halo rows can be received straight into them
+    t2=timingNow();
+    window.width=destWindow.width=size[0];
+    window.height=destWindow.height=band.above+bandRows+band.below;
+    window.bpp=destWindow.bpp=size[2];
+    window.stride=destWindow.stride=span;
+    window.data=takeBuffer((size_t)window.height*span);
+    destWindow.data=takeBuffer((size_t)window.height*span);
+    if (!rank){
+        counts=malloc(2*ranks*sizeof(int));
+        starts=counts?counts+ranks:NULL;
+        for (i=0;counts && i<ranks;i++){
+            Band other=bandOf(i,ranks,size[1],radius,0);
+            counts[i]=other.end-other.start;
+            starts[i]=other.start;
+        }
+    }
+    timing.allocNs=timingNow()-t2;
+    if (!agree(window.data && destWindow.data && (rank || counts))){
+        if (!rank){
+            printf("Error allocating memory for the bands.\n");
+            closeImage(&srcImage,&srcFile);
+        }
+        giveBuffer(window.data);
+        giveBuffer(destWindow.data);
+        free(counts);
+        return finishRun(&chain,backend,-1);
+    }
+    row=rowType(span,span);
+    spacedRow=rowType(span,size[3]);
+
+    // scatter the bands, then send the first radius rows of each band up and the last radius rows down
+    t2=timingNow();
+    MPI_Scatterv(rank?NULL:srcImage.data,counts,starts,spacedRow,window.data+(size_t)band.above*span,bandRows,row,0,MPI_COMM_WORLD);
+    if (!rank) closeImage(&srcImage,&srcFile);
+    if (radius && ranks>1){
+        int wrap=options.border==BORDER_WRAP;
+        int up=rank>0?rank-1:wrap?ranks-1:MPI_PROC_NULL,down=rank<ranks-1?rank+1:wrap?0:MPI_PROC_NULL;
+        uint8_t* first=window.data+(size_t)band.above*span;
+        MPI_Sendrecv(first,radius,row,up,0,first+(size_t)bandRows*span,radius,row,down,0,MPI_COMM_WORLD,MPI_STATUS_IGNORE);
+        MPI_Sendrecv(first+(size_t)(bandRows-radius)*span,radius,row,down,1,window.data,radius,row,up,1,MPI_COMM_WORLD,MPI_STATUS_IGNORE);
+    }
+    timing.exchangeNs=timingNow()-t2;
+
+    t2=timingNow();
+    convolutePlanes(&window,&destWindow,&chain,&options);
+    timing.convoluteNs=timingNow()-t2;
+    countersReport(&timing);
+    giveBuffer(window.data);
+
+    if (format==FORMAT_STB){
+        int ok=1;
+        if (!rank){
+            destImage.width=size[0];
+            destImage.height=size[1];
+            destImage.bpp=size[2];
+            ok=!createImage(outPath,&options,&destImage,&destFile);
+            if (!ok) printf("Error creating output image %s.\n",outPath);
+        }
+        if (agree(ok)){
+            MPI_Datatype destRow=rowType(span,rank?span:destImage.stride);
+            t2=timingNow();
+            MPI_Gatherv(destWindow.data+(size_t)band.above*span,bandRows,row,rank?NULL:destImage.data,counts,starts,destRow,0,MPI_COMM_WORLD);
+            timing.exchangeNs+=timingNow()-t2;
+            MPI_Type_free(&destRow);
+            t2=timingNow();
+            if (!rank && closeImage(&destImage,&destFile)){
+                printf("Error writing file %s.\n",outPath);
+                result=-1;
+            }
+            timing.encodeNs=timingNow()-t2;
+        }
+        else result=-1;
+    }
+    else{
+        t2=timingNow();
+        result=writeBands(outPath,format,destWindow.data+(size_t)band.above*span,&band,size[0],size[1],size[2],row);
+        timing.encodeNs=timingNow()-t2;
+        if (result && !rank) printf("Error writing file %s.\n",outPath);
+    }
+    giveBuffer(destWindow.data);
+    MPI_Type_free(&row);
+    MPI_Type_free(&spacedRow);
+    free(counts);
+
+    // each stage is reported as its slowest rank, since that is what every rank waits for
+    local[0]=timing.allocNs;
+    local[1]=timing.exchangeNs;
+    local[2]=timing.convoluteNs;
+    local[3]=timing.encodeNs;
+    local[4]=timingNow()-t1;
+    MPI_Reduce(local,slowest,5,MPI_INT64_T,MPI_MAX,0,MPI_COMM_WORLD);
+    // the counters are summed, and so is each rank's STREAM bandwidth, as the bandwidth of the whole job
+    {
+        uint64_t events[4]={timing.cycles,timing.instructions,timing.l1Misses,timing.llcMisses},sums[4];
+        double bandwidth;
+        MPI_Reduce(events,sums,4,MPI_UINT64_T,MPI_SUM,0,MPI_COMM_WORLD);
+        MPI_Reduce(&timing.streamBandwidth,&bandwidth,1,MPI_DOUBLE,MPI_SUM,0,MPI_COMM_WORLD);
+        timing.cycles=sums[0];
+        timing.instructions=sums[1];
+        timing.l1Misses=sums[2];
+        timing.llcMisses=sums[3];
+        timing.streamBandwidth=bandwidth;
+    }
+    if (rank || result) return finishRun(&chain,backend,result);
+    timing.allocNs=slowest[0];
+    timing.exchangeNs=slowest[1];
+    timing.convoluteNs=slowest[2];
+    timing.encodeNs=slowest[3];
+    timing.totalNs=slowest[4];
+    if (backend->report) backend->report(&timing);
+    timingPrint(&timing);
+    return finishRun(&chain,backend,timingWriteReport(&timing,options.reportFormat,options.reportFile)?-1:0);
+}
+
+//main: Runs one image across every rank the program was started on, for example with srun or mpirun
+int main(int argc,char** argv){
+    int provided,result;
+    // only the main thread of each rank makes MPI calls, while the backend's threads convolute
+    MPI_Init_thread(&argc,&argv,MPI_THREAD_FUNNELED,&provided);
+    result=runCluster(argc,argv);
+    MPI_Finalize();
+    return result;
+}
@@ -0,0 +1,459 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "image.h"
+#include "convolve.h"
+#include "fft.h"
+
+static int separableEnabled=1;
+static enum ConvolutionMethods forcedMethod=METHOD_AUTO;
+
+//makeFixedKernel: Converts a Kernel into integer weights over a common divisor, with a multiply and shift that replace the division
+//Parameters: source: The kernel to convert
+//            kernel: The FixedKernel to populate.  On success release it with freeFixedKernel.
+//Returns: 0 on success, -1 if the kernel has no exact small integer representation (the caller should use the double precision path)
+int makeFixedKernel(Kernel* source,FixedKernel* kernel){
+    int i,divisor,shift,size=source->size,count=source->size*source->size;
+    kernel->size=size;
+    kernel->weights=malloc((count+2*size)*sizeof(int16_t));
+    if (!kernel->weights) return -1;
+    kernel->vertical=kernel->weights+count;
+    kernel->horizontal=kernel->vertical+size;
+    for (divisor=1;divisor<=FIXED_MAX_DIVISOR;divisor++){
+        int exact=1;
+        int64_t positive=0,magnitude=0;
+        for (i=0;i<count && exact;i++){
+            double scaled=source->weights[i]*divisor;
+            double rounded=floor(scaled+0.5);
+            if (fabs(scaled-rounded)>1e-9 || fabs(rounded)>INT16_MAX) exact=0;
+            else{
+                kernel->weights[i]=(int16_t)rounded;
+                if (rounded>0) positive+=(int)rounded;
+                magnitude+=fabs(rounded);
+            }
+        }
+        if (!exact) continue;
+        // the scalar loops accumulate in 32 bits
+        if (magnitude*255>INT32_MAX) break;
+        kernel->divisor=divisor;
+        kernel->maxSum=(int)(positive*255);
+        //find the smallest shift whose rounded up reciprocal divides every reachable sum exactly.
+        //With multiplier=ceil(2^shift/divisor) and error=multiplier*divisor-2^shift, (n*multiplier)>>shift
+        //equals n/divisor for all n<=maxSum as long as maxSum*error<2^shift
+        for (shift=0;shift<=40;shift++){
+            uint64_t multiplier=(((uint64_t)1<<shift)+divisor-1)/divisor;
+            uint64_t error=multiplier*divisor-((uint64_t)1<<shift);
+            if (multiplier>UINT32_MAX) break;
+            if ((uint64_t)kernel->maxSum*error<((uint64_t)1<<shift)){
+                kernel->multiplier=(uint32_t)multiplier;
+                kernel->shift=shift;
+                kernel->rowFunction=NULL;
+                kernel->separable=0;
+                if (!makeSimdKernel(kernel->weights,size,divisor,kernel->maxSum,&kernel->simd)){
+                    kernel->rowFunction=getSpecializedRowFunction(kernel->weights,size);
+                    if (!kernel->rowFunction) kernel->rowFunction=getSimdRowFunction();
+                    kernel->separable=!splitSeparable(kernel->weights,size,kernel->vertical,kernel->horizontal);
+                    kernel->horizontalFunction=getSpecializedHorizontalFunction(kernel->horizontal,size);
+                    if (!kernel->horizontalFunction) kernel->horizontalFunction=getSimdHorizontalFunction();
+                    kernel->verticalFunction=getSpecializedVerticalFunction(kernel->vertical,size);
+                    if (!kernel->verticalFunction) kernel->verticalFunction=getSimdVerticalFunction();
+                }
+                return 0;
+            }
+        }
+        break;
+    }
+    freeFixedKernel(kernel);
+    return -1;
+}
+
+//freeFixedKernel: Releases the integer weights of a FixedKernel
+void freeFixedKernel(FixedKernel* kernel){
+    free(kernel->weights);
+    kernel->weights=NULL;
+}
+
+//splitSeparable: Checks whether an integer kernel is rank one and factors it into a column and a row of taps
+//Parameters: weights: The size*size integer kernel
+//            size: The width and height of the kernel
+//            vertical: Receives the size entry column factor
+//            horizontal: Receives the size entry row factor, reduced by the gcd of its entries and with a positive leading entry
+//Returns: 0 if weights[r*size+c]==vertical[r]*horizontal[c] for every entry, -1 otherwise
+int splitSeparable(int16_t* weights,int size,int16_t* vertical,int16_t* horizontal){
+    int r,c,pivot=-1,divisor=0,first=0;
+    for (r=0;r<size && pivot<0;r++)
+        for (c=0;c<size;c++)
+            if (weights[r*size+c]) pivot=r;
+    if (pivot<0) return -1;
+    for (c=0;c<size;c++){
+        int a=abs(weights[pivot*size+c]),b=divisor;
+        while (b){ int t=a%b; a=b; b=t; }
+        divisor=a;
+        if (!first) first=weights[pivot*size+c];
+    }
+    if (first<0) divisor=-divisor;
+    for (c=0;c<size;c++) horizontal[c]=weights[pivot*size+c]/divisor;
+    for (r=0;r<size;r++){
+        vertical[r]=0;
+        for (c=0;c<size;c++){
+            if (horizontal[c]){
+                vertical[r]=weights[r*size+c]/horizontal[c];
+                break;
+            }
+        }
+        for (c=0;c<size;c++)
+            if (vertical[r]*horizontal[c]!=weights[r*size+c]) return -1;
+    }
+    return 0;
+}
+
+//setSeparable: Turns the two pass path for rank one kernels on or off, mostly useful for benchmarking
+//Parameters: enabled: 0 to always use the single pass kernel
+//Returns: Nothing
+void setSeparable(int enabled){
+    separableEnabled=enabled;
+}
+
+//setConvolutionMethod: Forces every later plan to use one method instead of choosing by kernel size
+//Parameters: method: METHOD_AUTO to choose automatically, otherwise the method to use when the kernel allows it
+//Returns: Nothing
+void setConvolutionMethod(enum ConvolutionMethods method){
+    forcedMethod=method;
+}
+
+//getSeparable: Returns 0 if --no-separable turned the two pass path off, 1 otherwise
+int getSeparable(){
+    return separableEnabled;
+}
+
+//getForcedMethodName: Returns the name of the method --method forces, or auto when plans choose for themselves
+const char* getForcedMethodName(){
+    static const char* names[]={"direct","separable","fft","copy"};
+    return forcedMethod==METHOD_AUTO?"auto":names[forcedMethod];
+}
+
+//GetConvolutionMethod: Converts the string name of a method into a value from the ConvolutionMethods enumeration
+//Parameters: name: One of auto, direct, separable or fft
+//Returns: The matching ConvolutionMethods entry, or -2 if the name is unknown
+int GetConvolutionMethod(char* name){
+    if (!strcmp(name,"auto")) return METHOD_AUTO;
+    else if (!strcmp(name,"direct")) return METHOD_DIRECT;
+    else if (!strcmp(name,"separable")) return METHOD_SEPARABLE;
+    else if (!strcmp(name,"fft")) return METHOD_FFT;
+    else return -2;
+}
+
+//fixedDivide: Scales an integer kernel sum back down and saturates it, matching the clamped double precision result
+//Parameters: sum: The sum of weights times pixel values
+//            kernel: The FixedKernel the sum was computed with
+//Returns: floor(sum/divisor) clamped to 0-255
+uint8_t fixedDivide(int32_t sum,FixedKernel* kernel){
+    uint32_t result;
+    if (sum<=0) return 0;
+    result=(uint32_t)(((uint64_t)sum*kernel->multiplier)>>kernel->shift);
+    return result>255?255:(uint8_t)result;
+}
+
+//isIdentity: Checks whether an integer kernel passes every pixel through unchanged
+static int isIdentity(FixedKernel* kernel){
+    int i,count=kernel->size*kernel->size;
+    for (i=0;i<count;i++)
+        if (kernel->weights[i]!=(i==count/2?kernel->divisor:0)) return 0;
+    return 1;
+}
+
+//makeConvolutionPlan: Prepares everything convoluteRows needs to apply a kernel, and picks how to compute it
+//The identity kernel just copies rows.  Rank one integer kernels run separably.  Other kernels run directly until they reach the measured FFT crossover size.
+//Parameters: kernel: The kernel to use for the convolution.  The plan keeps its own copy of the weights.
+//            border: How pixels past the edge of the image are filled in
+//            borderValue: The pixel value used past the edge in BORDER_CONSTANT mode
+//            plan: The ConvolutionPlan to populate.  Release it with freeConvolutionPlan.
+//Returns: 0 on success, -1 if memory could not be allocated
+int makeConvolutionPlan(Kernel* kernel,enum BorderModes border,uint8_t borderValue,ConvolutionPlan* plan){
+    int count=kernel->size*kernel->size;
+    memset(plan,0,sizeof(ConvolutionPlan));
+    plan->kernel.size=kernel->size;
+    plan->kernel.weights=malloc(count*sizeof(double));
+    if (!plan->kernel.weights) return -1;
+    memcpy(plan->kernel.weights,kernel->weights,count*sizeof(double));
+    plan->isFixed=!makeFixedKernel(kernel,&plan->fixed);
+    plan->border=border;
+    plan->borderValue=borderValue;
+    if (forcedMethod!=METHOD_AUTO) plan->method=forcedMethod;
+    else if (plan->isFixed && isIdentity(&plan->fixed)) plan->method=METHOD_COPY;
+    else if (plan->isFixed && plan->fixed.separable && separableEnabled) plan->method=METHOD_SEPARABLE;
+    else if (kernel->size>=(plan->isFixed && plan->fixed.rowFunction?FFT_CROSSOVER:FFT_CROSSOVER_SCALAR)) plan->method=METHOD_FFT;
+    else plan->method=METHOD_DIRECT;
+    if (plan->method==METHOD_SEPARABLE && !(plan->isFixed && plan->fixed.separable)) plan->method=METHOD_DIRECT;
+    if (plan->method==METHOD_FFT){
+        plan->fft=makeFftPlan(kernel);
+        if (!plan->fft) plan->method=METHOD_DIRECT;
+    }
+    return 0;
+}
+
+//freeConvolutionPlan: Releases the memory held by a ConvolutionPlan
+void freeConvolutionPlan(ConvolutionPlan* plan){
+    if (plan->isFixed) freeFixedKernel(&plan->fixed);
+    freeFftPlan(plan->fft);
+    free(plan->kernel.weights);
+    plan->fft=NULL;
+    plan->kernel.weights=NULL;
+}
+
+//planRowBlock: Returns a good number of rows to hand to each call of convoluteRows
+//Parameters: plan: The plan being run
+//            defaultRows: The block size the caller would use for a direct kernel
+//Returns: defaultRows, or for the FFT path the number of output rows in one FFT tile
+int planRowBlock(ConvolutionPlan* plan,int defaultRows){
+    if (plan->method==METHOD_FFT) return plan->fft->valid;
+    return defaultRows;
+}
+
+//getMethodName: Returns the name of the method a plan uses, for reports
+const char* getMethodName(ConvolutionPlan* plan){
+    static const char* names[]={"direct","separable","fft","copy"};
+    return names[plan->method];
+}
+
+//borderIndex: Maps a row or column index that may fall outside the image back inside it
+//Parameters: i: The index, which may be negative or past the end
+//            n: The number of rows or columns
+//            border: The border mode
+//Returns: An index in 0..n-1, or -1 when the border is BORDER_CONSTANT and i is outside the image
+//It is also compiled for offload devices, so image_offload.c handles borders exactly like the host.
+#pragma omp declare target
+int borderIndex(int i,int n,enum BorderModes border){
+    int period;
+    if (i>=0 && i<n) return i;
+    switch (border){
+        case BORDER_MIRROR:
+            // reflect around the edge pixel without repeating it: -1 maps to 1, n maps to n-2
+            if (n==1) return 0;
+            period=2*n-2;
+            i%=period;
+            if (i<0) i+=period;
+            return i<n?i:period-i;
+        case BORDER_WRAP:
+            i%=n;
+            return i<0?i+n:i;
+        case BORDER_CONSTANT:
+            return -1;
+        default:
+            return i<0?0:n-1;
+    }
+}
+#pragma omp end declare target
+
+//getBorderName: Returns the name of a border mode, the one GetBorderMode takes
+const char* getBorderName(enum BorderModes border){
+    static const char* names[]={"clamp","mirror","wrap","constant"};
+    return names[border];
+}
+
+//GetBorderMode: Converts the string name of a border mode into a value from the BorderModes enumeration
+//Parameters: name: One of clamp, mirror, wrap or constant
+//Returns: The matching BorderModes entry, or -1 if the name is unknown
+int GetBorderMode(char* name){
+    if (!strcmp(name,"clamp")) return BORDER_CLAMP;
+    else if (!strcmp(name,"mirror")) return BORDER_MIRROR;
+    else if (!strcmp(name,"wrap")) return BORDER_WRAP;
+    else if (!strcmp(name,"constant")) return BORDER_CONSTANT;
+    else return -1;
+}
+
+//interiorFixed: Scalar fixed point loop for kernels too large for the 16 bit row functions
+static void interiorFixed(const uint8_t** rows,uint8_t* out,int count,int bpp,FixedKernel* kernel){
+    int i,r,c,size=kernel->size,radius=kernel->size/2;
+    for (i=0;i<count;i++){
+        int32_t sum=0;
+        for (r=0;r<size;r++)
+            for (c=0;c<size;c++)
+                sum+=kernel->weights[r*size+c]*rows[r][i+(c-radius)*bpp];
+        out[i]=fixedDivide(sum,kernel);
+    }
+}
+
+//interiorDouble: Double precision loop for kernels with no exact integer form
+static void interiorDouble(const uint8_t** rows,uint8_t* out,int count,int bpp,Kernel* kernel){
+    int i,r,c,size=kernel->size,radius=kernel->size/2;
+    for (i=0;i<count;i++){
+        double result=0;
+        for (r=0;r<size;r++)
+            for (c=0;c<size;c++)
+                result+=kernel->weights[r*size+c]*rows[r][i+(c-radius)*bpp];
+        if (result>255) result=255;
+        if (result<0) result=0;
+        out[i]=(uint8_t)result;
+    }
+}
+
+//interiorRow: Computes count bytes whose horizontal neighbors are all inside the row, with no bounds checks
+static void interiorRow(ConvolutionPlan* plan,const uint8_t** rows,uint8_t* out,int count,int bpp){
+    if (count<=0) return;
+    if (plan->isFixed && plan->fixed.rowFunction) plan->fixed.rowFunction(rows,out,count,bpp,&plan->fixed.simd);
+    else if (plan->isFixed) interiorFixed(rows,out,count,bpp,&plan->fixed);
+    else interiorDouble(rows,out,count,bpp,&plan->kernel);
+}
+
+//edgePixel: Computes every channel of a pixel near the first or last column, remapping the columns past the edge
+static void edgePixel(ConvolutionPlan* plan,const uint8_t** rows,uint8_t* out,int pix,int width,int bpp,int* columns){
+    int r,c,bit,size=plan->kernel.size,radius=plan->kernel.size/2;
+    for (c=0;c<size;c++) columns[c]=borderIndex(pix+c-radius,width,plan->border);
+    for (bit=0;bit<bpp;bit++){
+        int32_t sum=0;
+        double result=0;
+        for (r=0;r<size;r++){
+            for (c=0;c<size;c++){
+                int value=columns[c]<0?plan->borderValue:rows[r][columns[c]*bpp+bit];
+                if (plan->isFixed) sum+=plan->fixed.weights[r*size+c]*value;
+                else result+=plan->kernel.weights[r*size+c]*value;
+            }
+        }
+        if (plan->isFixed) out[pix*bpp+bit]=fixedDivide(sum,&plan->fixed);
+        else out[pix*bpp+bit]=result>255?255:result<0?0:(uint8_t)result;
+    }
+}
+
+//sourceRow: Returns the source row for y, remapped by the border mode when it falls outside the image
+static const uint8_t* sourceRow(Image* srcImage,int y,ConvolutionPlan* plan,const uint8_t* constantRow){
+    y=borderIndex(y,srcImage->height,plan->border);
+    return y<0?constantRow:srcImage->data+(long)y*srcImage->stride;
+}
+
+//horizontalPass: Computes the horizontal sums of a separable kernel for the columns startColumn to endColumn of one source row
+//The halo columns are read straight from the source row, so out only holds the block's own columns, starting at startColumn.
+static void horizontalPass(ConvolutionPlan* plan,const uint8_t* row,int16_t* out,int width,int bpp,int startColumn,int endColumn){
+    int pix,c,bit;
+    FixedKernel* kernel=&plan->fixed;
+    int size=kernel->size,radius=kernel->size/2;
+    int first=startColumn>radius?startColumn:radius,last=endColumn<width-radius?endColumn:width-radius;
+    if (last>first) kernel->horizontalFunction(row+first*bpp,out+(first-startColumn)*bpp,(last-first)*bpp,bpp,kernel->horizontal,size);
+    else first=last=endColumn;
+    for (pix=startColumn;pix<endColumn;pix++){
+        if (pix==first) pix=last;
+        if (pix>=endColumn) break;
+        for (bit=0;bit<bpp;bit++){
+            int sum=0;
+            for (c=0;c<size;c++){
+                int x=borderIndex(pix+c-radius,width,plan->border);
+                sum+=kernel->horizontal[c]*(x<0?plan->borderValue:row[x*bpp+bit]);
+            }
+            out[(pix-startColumn)*bpp+bit]=(int16_t)sum;
+        }
+    }
+}
+
+//convoluteBlockSeparable: Two pass version of convoluteBlock for rank one kernels
+//Each source row is run through the horizontal taps once into a rolling buffer of size rows, and each output row
+//combines the buffered rows with the vertical taps.  The integer sums are the same as the single pass kernel's.
+//The buffer is only as wide as the block, so narrow tiles do not each allocate rows the width of the image.
+//Returns: 0 on success, -1 if the buffer could not be allocated
+static int convoluteBlockSeparable(Image* srcImage,Image* destImage,int startRow,int endRow,int startColumn,int endColumn,ConvolutionPlan* plan,const uint8_t* constantRow){
+    int row,r,width=srcImage->width,bpp=srcImage->bpp;
+    int size=plan->fixed.size,radius=plan->fixed.size/2;
+    long span=(long)(endColumn-startColumn)*bpp;
+    int16_t* buffer=malloc(size*span*sizeof(int16_t));
+    const int16_t** rows=malloc(size*sizeof(int16_t*));
+    if (!buffer || !rows){
+        free(rows);
+        free(buffer);
+        return -1;
+    }
+    // buffer row (y-startRow+radius)%size holds the horizontal pass of logical source row y
+    for (row=startRow-radius;row<startRow+radius;row++)
+        horizontalPass(plan,sourceRow(srcImage,row,plan,constantRow),buffer+(row-startRow+radius)*span,width,bpp,startColumn,endColumn);
+    for (row=startRow;row<endRow;row++){
+        horizontalPass(plan,sourceRow(srcImage,row+radius,plan,constantRow),buffer+((row-startRow+2*radius)%size)*span,width,bpp,startColumn,endColumn);
+        for (r=0;r<size;r++) rows[r]=buffer+((row-startRow+r)%size)*span;
+        plan->fixed.verticalFunction(rows,destImage->data+(long)row*destImage->stride+startColumn*bpp,(endColumn-startColumn)*bpp,plan->fixed.vertical,size,&plan->fixed.simd);
+    }
+    free(rows);
+    free(buffer);
+    return 0;
+}
+
+//convoluteBlock: Applies a planned kernel to a rectangle of an image
+//Rows and columns in the middle of the image read their neighbors directly.  Only the rows within size/2 of the top and
+//bottom get remapped row pointers, and only the columns within size/2 of the sides go through the per-pixel edge pass,
+//so the interior loop has no border checks.
+//Parameters: srcImage: The image being convoluted
+//            destImage: The pre-allocated destination image, the same size as srcImage
+//            startRow: The first row to compute
+//            endRow: One past the last row to compute
+//            startColumn: The first column to compute
+//            endColumn: One past the last column to compute
+//            plan: The plan from makeConvolutionPlan
+//Returns: Nothing
+void convoluteBlock(Image* srcImage,Image* destImage,int startRow,int endRow,int startColumn,int endColumn,ConvolutionPlan* plan){
+    int row,r,pix,width=srcImage->width,height=srcImage->height,bpp=srcImage->bpp;
+    int size=plan->kernel.size,radius=plan->kernel.size/2;
+    int first=startColumn>radius?startColumn:radius,last=endColumn<width-radius?endColumn:width-radius;
+    long span=(long)width*bpp;
+    uint8_t* constantRow=NULL;
+    const uint8_t** rows;
+    const uint8_t** inner;
+    int* columns;
+    if (plan->method==METHOD_FFT){
+        fftConvoluteBlock(srcImage,destImage,startRow,endRow,startColumn,endColumn,plan);
+        return;
+    }
+    if (plan->method==METHOD_COPY){
+        for (row=startRow;row<endRow;row++)
+            memcpy(destImage->data+(long)row*destImage->stride+startColumn*bpp,srcImage->data+(long)row*srcImage->stride+startColumn*bpp,(endColumn-startColumn)*bpp);
+        return;
+    }
+    if (plan->border==BORDER_CONSTANT && (startRow<radius || endRow>height-radius)){
+        constantRow=malloc(span);
+        if (!constantRow){
+            printf("Error: Failed to allocate memory for the convolution.\n");
+            return;
+        }
+        memset(constantRow,plan->borderValue,span);
+    }
+    if (plan->method==METHOD_SEPARABLE){
+        if (convoluteBlockSeparable(srcImage,destImage,startRow,endRow,startColumn,endColumn,plan,constantRow))
+            printf("Error: Failed to allocate memory for the convolution.\n");
+        free(constantRow);
+        return;
+    }
+    rows=malloc(2*size*sizeof(uint8_t*)+size*sizeof(int));
+    if (!rows){
+        printf("Error: Failed to allocate memory for the convolution.\n");
+        free(constantRow);
+        return;
+    }
+    inner=rows+size;
+    columns=(int*)(inner+size);
+    for (row=startRow;row<endRow;row++){
+        uint8_t* out=destImage->data+(long)row*destImage->stride;
+        for (r=0;r<size;r++){
+            int y=row+r-radius;
+            if (row>=radius && row<height-radius) rows[r]=srcImage->data+(long)y*srcImage->stride;
+            else rows[r]=sourceRow(srcImage,y,plan,constantRow);
+        }
+        if (last>first){
+            for (r=0;r<size;r++) inner[r]=rows[r]+first*bpp;
+            interiorRow(plan,inner,out+first*bpp,(last-first)*bpp,bpp);
+        }
+        // the columns left of the interior, then the ones right of it (or of column radius when there is no interior)
+        for (pix=startColumn;pix<endColumn && pix<radius;pix++) edgePixel(plan,rows,out,pix,width,bpp,columns);
+        pix=width-radius>radius?width-radius:radius;
+        for (pix=pix>startColumn?pix:startColumn;pix<endColumn;pix++) edgePixel(plan,rows,out,pix,width,bpp,columns);
+    }
+    free(rows);
+    free(constantRow);
+}
+
+//convoluteRows: Applies a planned kernel to a range of whole rows of an image, see convoluteBlock
+//Parameters: srcImage: The image being convoluted
+//            destImage: The pre-allocated destination image, the same size as srcImage
+//            startRow: The first row to compute
+//            endRow: One past the last row to compute
+//            plan: The plan from makeConvolutionPlan
+//Returns: Nothing
+void convoluteRows(Image* srcImage,Image* destImage,int startRow,int endRow,ConvolutionPlan* plan){
+    convoluteBlock(srcImage,destImage,startRow,endRow,0,srcImage->width,plan);
+}
@@ -0,0 +1,72 @@
+#ifndef ___CONVOLVE
+#define ___CONVOLVE
+#include <stdint.h>
+#include "image.h"
+#include "simd.h"
+
+//The largest common denominator searched for when converting a Kernel to fixed point
+#define FIXED_MAX_DIVISOR 1024
+
+//The kernel size at which the FFT path takes over from direct convolution, measured on one core of an AVX2 Xeon with a
+//4032x3024 image.  Kernels that fit the 16 bit row functions stay direct longer than ones that need the scalar 32 bit loop.
+#define FFT_CROSSOVER 41
+#define FFT_CROSSOVER_SCALAR 7
+
+//How convoluteRows computes a plan: one pass over size*size taps, two passes of size taps for rank one kernels,
+//tiled FFT convolution for large kernels, or a plain copy of the rows for the identity kernel
+enum ConvolutionMethods{METHOD_AUTO=-1,METHOD_DIRECT=0,METHOD_SEPARABLE=1,METHOD_FFT=2,METHOD_COPY=3};
+
+//An integer version of a Kernel.  Every weight of the Kernel equals weights[r*size+c]/divisor exactly, and
+//floor(sum/divisor) is computed as (sum*multiplier)>>shift, which is exact for every non-negative sum up to maxSum.
+//rowFunction is the vectorized interior loop picked for this CPU, or NULL when the kernel does not fit in 16 bit lanes.
+//When the weights are those of a built-in 3x3 kernel it is a version with the weights compiled in, as are the passes.
+//Rank one kernels are also split into weights[r*size+c]=vertical[r]*horizontal[c] so they can run as two passes of size taps.
+typedef struct{
+    int size;
+    int16_t* weights;
+    int divisor;
+    uint32_t multiplier;
+    int shift;
+    int maxSum;
+    SimdKernel simd;
+    SimdRowFunction rowFunction;
+    int separable;
+    int16_t* vertical;
+    int16_t* horizontal;
+    SimdHorizontalFunction horizontalFunction;
+    SimdVerticalFunction verticalFunction;
+} FixedKernel;
+
+//Everything convoluteRows needs to apply one kernel: the integer form when there is one, otherwise the double weights
+typedef struct{
+    Kernel kernel;
+    FixedKernel fixed;
+    int isFixed;
+    enum ConvolutionMethods method;
+    struct FftPlan* fft;
+    enum BorderModes border;
+    uint8_t borderValue;
+} ConvolutionPlan;
+
+int makeFixedKernel(Kernel* source,FixedKernel* kernel);
+void freeFixedKernel(FixedKernel* kernel);
+int splitSeparable(int16_t* weights,int size,int16_t* vertical,int16_t* horizontal);
+void setSeparable(int enabled);
+void setConvolutionMethod(enum ConvolutionMethods method);
+int GetConvolutionMethod(char* name);
+int getSeparable();
+const char* getForcedMethodName();
+uint8_t fixedDivide(int32_t sum,FixedKernel* kernel);
+int makeConvolutionPlan(Kernel* kernel,enum BorderModes border,uint8_t borderValue,ConvolutionPlan* plan);
+void freeConvolutionPlan(ConvolutionPlan* plan);
+int planRowBlock(ConvolutionPlan* plan,int defaultRows);
+const char* getMethodName(ConvolutionPlan* plan);
+#pragma omp declare target
+int borderIndex(int i,int n,enum BorderModes border);
+#pragma omp end declare target
+int GetBorderMode(char* name);
+const char* getBorderName(enum BorderModes border);
+void convoluteBlock(Image* srcImage,Image* destImage,int startRow,int endRow,int startColumn,int endColumn,ConvolutionPlan* plan);
+void convoluteRows(Image* srcImage,Image* destImage,int startRow,int endRow,ConvolutionPlan* plan);
+
+#endif
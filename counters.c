@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <omp.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
+#endif
+#include "timing.h"
+#include "counters.h"
+
+//The number of events in each thread's group, in the order of the fields of CounterValues
+#define COUNTER_EVENTS 4
+
+static int enabled=0;
+
+//What each worker has counted since the last countersReport
+static CounterValues totals[COUNTER_MAX_THREADS];
+
+//The event group of each thread, opened the first time it calls countersBegin and closed when it exits
+static pthread_key_t groupKey;
+static pthread_once_t groupOnce=PTHREAD_ONCE_INIT;
+
+//The bandwidth of the STREAM triad in bytes per second and the thread count it was measured with, 0 until measured
+static double streamBandwidth=0;
+static int streamThreads=0;
+
+//setCounters: Turns on hardware counters around the convolution, from --counters
+void setCounters(int value){
+    enabled=value;
+}
+
+int countersEnabled(){
+    return enabled;
+}
+
+//disableCounters: Turns the counters off for the rest of the run when a thread cannot open them, saying why once
+static void disableCounters(const char* reason){
+    if (__atomic_exchange_n(&enabled,0,__ATOMIC_RELAXED))
+        printf("Warning: hardware counters are not available (%s), ignoring --counters.\n",reason);
+}
+
+#ifdef __linux__
+//closeGroup: Closes the events of a thread's group when the thread exits
+static void closeGroup(void* value){
+    int* fds=value;
+    int i;
+    for (i=0;i<COUNTER_EVENTS;i++)
+        if (fds[i]>=0) close(fds[i]);
+    free(fds);
+}
+
+static void makeGroupKey(){
+    pthread_key_create(&groupKey,closeGroup);
+}
+
+//openGroup: Opens the calling thread's event group: cycles leads instructions, L1 data read misses and last level
+//cache misses, so all four are read at once and run over the same intervals
+//Returns: The events, or NULL if the kernel would not open them (no PMU in a VM, or perf_event_paranoid too high)
+static int* openGroup(){
+    static const uint32_t types[COUNTER_EVENTS]={PERF_TYPE_HARDWARE,PERF_TYPE_HARDWARE,PERF_TYPE_HW_CACHE,PERF_TYPE_HARDWARE};
+    static const uint64_t configs[COUNTER_EVENTS]={PERF_COUNT_HW_CPU_CYCLES,PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_L1D|(PERF_COUNT_HW_CACHE_OP_READ<<8)|(PERF_COUNT_HW_CACHE_RESULT_MISS<<16),PERF_COUNT_HW_CACHE_MISSES};
+    int i;
+    int* fds;
+    pthread_once(&groupOnce,makeGroupKey);
+    fds=pthread_getspecific(groupKey);
+    if (fds) return fds;
+    fds=malloc(COUNTER_EVENTS*sizeof(int));
+    if (!fds) return NULL;
+    for (i=0;i<COUNTER_EVENTS;i++){
+        struct perf_event_attr attr;
+        memset(&attr,0,sizeof(attr));
+        attr.size=sizeof(attr);
+        attr.type=types[i];
+        attr.config=configs[i];
+        attr.read_format=PERF_FORMAT_GROUP;
+        attr.exclude_kernel=1;
+        attr.exclude_hv=1;
+        fds[i]=(int)syscall(SYS_perf_event_open,&attr,0,-1,i?fds[0]:-1,0);
+        if (fds[i]<0){
+            disableCounters(strerror(errno));
+            closeGroup(fds);
+            return NULL;
+        }
+    }
+    pthread_setspecific(groupKey,fds);
+    return fds;
+}
+#endif
+
+//countersBegin: Reads the calling thread's counters at the start of a piece of work, opening them the first time
+//Parameters: start: Receives the counts, all 0 when counters are off
+//Returns: Nothing
+void countersBegin(CounterValues* start){
+    memset(start,0,sizeof(CounterValues));
+    if (!enabled) return;
+#ifdef __linux__
+    {
+        uint64_t values[1+COUNTER_EVENTS];
+        int* fds=openGroup();
+        if (!fds) return;
+        if (read(fds[0],values,sizeof(values))!=(ssize_t)sizeof(values)) return;
+        start->cycles=values[1];
+        start->instructions=values[2];
+        start->l1Misses=values[3];
+        start->llcMisses=values[4];
+    }
+#else
+    disableCounters("not Linux");
+#endif
+}
+
+//countersEnd: Adds what the calling thread counted since countersBegin to a worker's totals
+//Parameters: start: From countersBegin
+//            worker: The index of the thread within its pool or team, or 0 for the calling thread of the serial backend
+//Returns: Nothing
+void countersEnd(CounterValues* start,int worker){
+    if (!enabled) return;
+#ifdef __linux__
+    {
+        uint64_t values[1+COUNTER_EVENTS];
+        int* fds=pthread_getspecific(groupKey);
+        CounterValues* total=&totals[worker<COUNTER_MAX_THREADS?worker:COUNTER_MAX_THREADS-1];
+        if (!fds || read(fds[0],values,sizeof(values))!=(ssize_t)sizeof(values)) return;
+        __atomic_fetch_add(&total->cycles,values[1]-start->cycles,__ATOMIC_RELAXED);
+        __atomic_fetch_add(&total->instructions,values[2]-start->instructions,__ATOMIC_RELAXED);
+        __atomic_fetch_add(&total->l1Misses,values[3]-start->l1Misses,__ATOMIC_RELAXED);
+        __atomic_fetch_add(&total->llcMisses,values[4]-start->llcMisses,__ATOMIC_RELAXED);
+    }
+#endif
+}
+
+//measureStream: Times the STREAM triad a[i]=b[i]+s*c[i] on threads threads, as the bandwidth the convolution is
+//compared with.  Like STREAM it counts 24 bytes per element and keeps the fastest of several runs.
+//Returns: The bandwidth in bytes per second, or 0 if the arrays could not be allocated
+static double measureStream(int threads){
+    long i,n=COUNTER_STREAM_SIZE;
+    int run;
+    int64_t best=-1;
+    double* a=malloc(n*sizeof(double));
+    double* b=malloc(n*sizeof(double));
+    double* c=malloc(n*sizeof(double));
+    if (a && b && c){
+        // first touch on the same threads that run the triad
+        #pragma omp parallel for num_threads(threads) schedule(static)
+        for (i=0;i<n;i++){
+            a[i]=0;
+            b[i]=1;
+            c[i]=2;
+        }
+        for (run=0;run<5;run++){
+            int64_t start=timingNow(),elapsed;
+            #pragma omp parallel for num_threads(threads) schedule(static)
+            for (i=0;i<n;i++) a[i]=b[i]+3.0*c[i];
+            elapsed=timingNow()-start;
+            if (best<0 || elapsed<best) best=elapsed;
+        }
+    }
+    free(a);
+    free(b);
+    free(c);
+    return best>0?3.0*sizeof(double)*n/(best/1e9):0;
+}
+
+//countersReport: Adds the counts since the last report to a timing record and starts counting afresh
+//The STREAM triad is run on timing->threads threads the first time, and again only if the thread count changes.
+//Parameters: timing: The record to fill in, after its image has been convoluted
+//Returns: Nothing
+void countersReport(Timing* timing){
+    int i;
+    if (!enabled) return;
+    timing->counted=1;
+    timing->cycles=timing->instructions=timing->l1Misses=timing->llcMisses=0;
+    for (i=0;i<COUNTER_MAX_THREADS;i++){
+        timing->cycles+=totals[i].cycles;
+        timing->instructions+=totals[i].instructions;
+        timing->l1Misses+=totals[i].l1Misses;
+        timing->llcMisses+=totals[i].llcMisses;
+    }
+    memset(totals,0,sizeof(totals));
+    if (streamThreads!=timing->threads){
+        streamThreads=timing->threads;
+        streamBandwidth=measureStream(timing->threads>0?timing->threads:1);
+    }
+    timing->streamBandwidth=streamBandwidth;
+}
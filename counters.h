@@ -0,0 +1,30 @@
+#ifndef ___COUNTERS
+#define ___COUNTERS
+#include <stdint.h>
+#include "timing.h"
+
+//The most threads whose counters are kept apart.  Workers past this share the last slot.
+#define COUNTER_MAX_THREADS 1024
+
+//The bytes each last level cache miss is taken to move, one cache line
+#define COUNTER_LINE_BYTES 64
+
+//The doubles in each of the three arrays of the STREAM triad, 32MB apiece so they are well past any last level cache
+#define COUNTER_STREAM_SIZE (4*1024*1024)
+
+//The hardware counters of one thread: cycles and instructions retired, L1 data cache read misses and last level cache
+//misses, all counted in user space only
+typedef struct{
+    uint64_t cycles;
+    uint64_t instructions;
+    uint64_t l1Misses;
+    uint64_t llcMisses;
+} CounterValues;
+
+void setCounters(int enabled);
+int countersEnabled();
+void countersBegin(CounterValues* start);
+void countersEnd(CounterValues* start,int worker);
+void countersReport(Timing* timing);
+
+#endif
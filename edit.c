@@ -0,0 +1,202 @@
+#include <stdint.h>
+#include <string.h>
+#include "image.h"
+#include "png.h"
+#include "buffers.h"
+#include "backend.h"
+#include "edit.h"
+
+//One output rectangle for the backend's threads to recompute
+typedef struct{
+    Image* srcImage;
+    Image* destImage;
+    KernelChain* chain;
+    enum BorderModes border;
+    uint8_t borderValue;
+    EditRect* rects;
+    int radius;
+    int failed;
+} EditJob;
+
+//chainRadius: Returns how far from a pixel the kernels of a chain reach, all stages together
+static int chainRadius(KernelChain* chain){
+    int i,radius=0;
+    for (i=0;i<chain->count;i++) radius+=chain->kernels[i].size/2;
+    return radius;
+}
+
+//spanOf: Splits the columns (or rows) start to end-1 that a dirty span reaches into the spans of the image they land
+//on.  Outside wrap borders they are just clipped to the image, and with wrap the part past an edge comes back in at
+//the other one.
+//Parameters: start,end: The span, which may reach past 0 and size
+//            size: The width (or height) of the image
+//            border: The border mode
+//            starts,ends: Receive up to two spans
+//Returns: The number of spans
+static int spanOf(int start,int end,int size,enum BorderModes border,int* starts,int* ends){
+    if (border!=BORDER_WRAP || end-start>=size || (start>=0 && end<=size)){
+        starts[0]=start<0?0:start;
+        ends[0]=end>size?size:end;
+        return 1;
+    }
+    starts[0]=start<0?0:start;
+    ends[0]=start<0?end:size;
+    starts[1]=start<0?size+start:0;
+    ends[1]=start<0?size:end-size;
+    return 2;
+}
+
+//overlaps: Returns 1 if two rectangles overlap or touch, so their union is worth computing as one
+static int overlaps(const EditRect* a,const EditRect* b){
+    return a->x<=b->x+b->width && b->x<=a->x+a->width && a->y<=b->y+b->height && b->y<=a->y+a->height;
+}
+
+//mergeRects: Replaces every group of overlapping or touching rectangles with their bounding box, until none overlap
+//Returns: The number of rectangles left
+static int mergeRects(EditRect* rects,int count){
+    int i,j,merged=1;
+    while (merged){
+        merged=0;
+        for (i=0;i<count;i++)
+            for (j=i+1;j<count;j++){
+                EditRect* a=&rects[i];
+                EditRect* b=&rects[j];
+                int right=a->x+a->width>b->x+b->width?a->x+a->width:b->x+b->width;
+                int bottom=a->y+a->height>b->y+b->height?a->y+a->height:b->y+b->height;
+                if (!overlaps(a,b)) continue;
+                a->x=a->x<b->x?a->x:b->x;
+                a->y=a->y<b->y?a->y:b->y;
+                a->width=right-a->x;
+                a->height=bottom-a->y;
+                rects[j--]=rects[--count];
+                merged=1;
+            }
+    }
+    return count;
+}
+
+//reconvoluteRect: Recomputes one rectangle of the output
+//The source under the rectangle plus the chain's radius around it is convoluted as an image of its own, and only the
+//rectangle is copied out.  Pixels within the radius of a window edge that is not an image edge come out wrong, and
+//those are exactly the ones that are not copied, while at image edges the border applies just as on the whole image.
+//A wrap border reads the far edge, so a window that reaches past an edge takes in the whole width or height.
+//Parameters: job: The images and chain
+//            rect: The output rectangle
+//            serial: 1 to convolute on the calling thread, 0 to use the current backend
+//Returns: 0 on success, -1 if memory could not be allocated
+static int reconvoluteRect(EditJob* job,EditRect* rect,int serial){
+    Image* src=job->srcImage;
+    int left=rect->x-job->radius,top=rect->y-job->radius;
+    int right=rect->x+rect->width+job->radius,bottom=rect->y+rect->height+job->radius,row;
+    Image window,result;
+    if (job->border==BORDER_WRAP && (left<0 || right>src->width)){
+        left=0;
+        right=src->width;
+    }
+    if (job->border==BORDER_WRAP && (top<0 || bottom>src->height)){
+        top=0;
+        bottom=src->height;
+    }
+    left=left<0?0:left;
+    top=top<0?0:top;
+    right=right>src->width?src->width:right;
+    bottom=bottom>src->height?src->height:bottom;
+    window=*src;
+    window.data=src->data+(size_t)top*src->stride+(size_t)left*src->bpp;
+    window.width=right-left;
+    window.height=bottom-top;
+    result=window;
+    if (allocImage(&result)) return -1;
+    if (serial) serialBackend.convolute(&window,&result,job->chain,job->border,job->borderValue);
+    else convolute(&window,&result,job->chain,job->border,job->borderValue);
+    for (row=rect->y;row<rect->y+rect->height;row++)
+        memcpy(job->destImage->data+(size_t)row*job->destImage->stride+(size_t)rect->x*src->bpp,
+            result.data+(size_t)(row-top)*result.stride+(size_t)(rect->x-left)*src->bpp,(size_t)rect->width*src->bpp);
+    freeImage(&result);
+    return 0;
+}
+
+//reconvoluteBlock: Recomputes one rectangle of a job on a backend thread, as a PngBlockFunction
+static void reconvoluteBlock(void* argument,int block){
+    EditJob* job=argument;
+    if (reconvoluteRect(job,&job->rects[block],1)) job->failed=1;
+}
+
+//reconvoluteRegions: Brings a convoluted image up to date after parts of its source have changed
+//Each dirty rectangle can change the output within the chain's radius of it, so the rectangles are clipped to the image,
+//grown by that much (wrapping around the edges for wrap borders), clipped again, and merged wherever they overlap or
+//touch.  A single rectangle is convoluted by the current backend, and several are shared out one per thread of the
+//backend's block runner, the one the PNG encoder uses, with each convoluted on its thread.
+//Parameters: srcImage: The changed source image
+//            destImage: Its convolution before the change, the same size, updated in place
+//            chain,border,borderValue: As for convolute, and the same as produced destImage
+//            dirty: The rectangles of srcImage that changed.  They may overlap and reach past the image.
+//            count: The number of rectangles, at most EDIT_MAX_RECTS
+//Returns: The number of output rectangles recomputed, or -1 if there were too many or memory ran out
+int reconvoluteRegions(Image* srcImage,Image* destImage,KernelChain* chain,enum BorderModes border,uint8_t borderValue,const EditRect* dirty,int count){
+    EditRect rects[4*EDIT_MAX_RECTS];
+    EditJob job={srcImage,destImage,chain,border,borderValue,rects,chainRadius(chain),0};
+    PngRunner runner=getBackend()->pngRunner;
+    int i,x,y,columns,rows,total=0;
+    if (count<0 || count>EDIT_MAX_RECTS) return -1;
+    for (i=0;i<count;i++){
+        int xStarts[2],xEnds[2],yStarts[2],yEnds[2];
+        int left=dirty[i].x<0?0:dirty[i].x,top=dirty[i].y<0?0:dirty[i].y;
+        int right=dirty[i].x+dirty[i].width>srcImage->width?srcImage->width:dirty[i].x+dirty[i].width;
+        int bottom=dirty[i].y+dirty[i].height>srcImage->height?srcImage->height:dirty[i].y+dirty[i].height;
+        if (right<=left || bottom<=top) continue;
+        columns=spanOf(left-job.radius,right+job.radius,srcImage->width,border,xStarts,xEnds);
+        rows=spanOf(top-job.radius,bottom+job.radius,srcImage->height,border,yStarts,yEnds);
+        for (y=0;y<rows;y++)
+            for (x=0;x<columns;x++){
+                if (xEnds[x]<=xStarts[x] || yEnds[y]<=yStarts[y]) continue;
+                rects[total].x=xStarts[x];
+                rects[total].y=yStarts[y];
+                rects[total].width=xEnds[x]-xStarts[x];
+                rects[total].height=yEnds[y]-yStarts[y];
+                total++;
+            }
+    }
+    total=mergeRects(rects,total);
+    if (total==1) job.failed=reconvoluteRect(&job,&rects[0],0);
+    else if (runner) runner(reconvoluteBlock,&job,total);
+    else for (i=0;i<total;i++) reconvoluteBlock(&job,i);
+    return job.failed?-1:total;
+}
+
+//openEditSession: Starts an editing session on a copy of an image and convolutes the whole of it once
+//Parameters: session: The session to start.  Release it with closeEditSession.
+//            image: The image to edit, copied into session->source
+//            chain,border,borderValue: As for convolute, used for every update
+//Returns: 0 on success, -1 if memory could not be allocated
+int openEditSession(EditSession* session,Image* image,KernelChain* chain,enum BorderModes border,uint8_t borderValue){
+    int row;
+    memset(session,0,sizeof(EditSession));
+    session->source=*image;
+    session->result=*image;
+    if (allocImage(&session->source) || allocImage(&session->result)){
+        closeEditSession(session);
+        return -1;
+    }
+    for (row=0;row<image->height;row++)
+        memcpy(session->source.data+(size_t)row*session->source.stride,image->data+(size_t)row*image->stride,(size_t)image->width*image->bpp);
+    session->chain=chain;
+    session->border=border;
+    session->borderValue=borderValue;
+    convolute(&session->source,&session->result,chain,border,borderValue);
+    return 0;
+}
+
+//updateEditSession: Brings session->result up to date after the caller has changed rectangles of session->source
+//Parameters: session: The session
+//            dirty,count: The changed rectangles, see reconvoluteRegions
+//Returns: The number of output rectangles recomputed, or -1 on failure
+int updateEditSession(EditSession* session,const EditRect* dirty,int count){
+    return reconvoluteRegions(&session->source,&session->result,session->chain,session->border,session->borderValue,dirty,count);
+}
+
+//closeEditSession: Releases the images of a session
+void closeEditSession(EditSession* session){
+    freeImage(&session->source);
+    freeImage(&session->result);
+}
@@ -0,0 +1,33 @@
+#ifndef ___EDIT
+#define ___EDIT
+#include <stdint.h>
+#include "image.h"
+
+//The most dirty rectangles one call takes.  Wrap borders can turn each into four output rectangles.
+#define EDIT_MAX_RECTS 256
+
+//A rectangle of pixels, columns x to x+width-1 of rows y to y+height-1
+typedef struct{
+    int x;
+    int y;
+    int width;
+    int height;
+} EditRect;
+
+//A source image and its convolution, kept resident between edits.  The caller edits source in place and then passes
+//the rectangles it changed to updateEditSession, which brings result up to date.  chain belongs to the caller and must
+//outlive the session.
+typedef struct{
+    Image source;
+    Image result;
+    KernelChain* chain;
+    enum BorderModes border;
+    uint8_t borderValue;
+} EditSession;
+
+int reconvoluteRegions(Image* srcImage,Image* destImage,KernelChain* chain,enum BorderModes border,uint8_t borderValue,const EditRect* dirty,int count);
+int openEditSession(EditSession* session,Image* image,KernelChain* chain,enum BorderModes border,uint8_t borderValue);
+int updateEditSession(EditSession* session,const EditRect* dirty,int count);
+void closeEditSession(EditSession* session);
+
+#endif
@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "image.h"
+#include "buffers.h"
+#include "options.h"
+#include "kernel.h"
+#include "png.h"
+#include "backend.h"
+#include "edit.h"
+
+//The backends, kernels and border modes every edit is checked under
+static char* backends[]={"serial","openmp","pthreads"};
+static char* kernels[]={"blur","gauss,edge","1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1/25"};
+static const enum BorderModes borders[]={BORDER_CLAMP,BORDER_MIRROR,BORDER_WRAP,BORDER_CONSTANT};
+static const char* borderNames[]={"clamp","mirror","wrap","constant"};
+
+//The number of rounds of edits on each image, and the most rectangles one round changes
+#define EDIT_ROUNDS 24
+#define EDIT_ROUND_RECTS 4
+
+//randomRect: Picks a rectangle of up to a quarter of the image in each direction that may reach up to 3 pixels past
+//any edge, so the wrap and clipping paths of reconvoluteRegions are taken as well as the middle of the image
+static EditRect randomRect(Image* image){
+    EditRect rect;
+    rect.width=1+rand()%(image->width/4);
+    rect.height=1+rand()%(image->height/4);
+    rect.x=rand()%(image->width+6)-3-(rand()%2?rect.width/2:0);
+    rect.y=rand()%(image->height+6)-3-(rand()%2?rect.height/2:0);
+    return rect;
+}
+
+//scribble: Fills the part of a rectangle inside the image with random pixels
+static void scribble(Image* image,EditRect* rect){
+    int x,y;
+    for (y=rect->y<0?0:rect->y;y<rect->y+rect->height && y<image->height;y++)
+        for (x=(rect->x<0?0:rect->x)*image->bpp;x<(rect->x+rect->width)*image->bpp && x<image->width*image->bpp;x++)
+            image->data[(size_t)y*image->stride+x]=(uint8_t)rand();
+}
+
+//sameImage: Returns 1 if two images of the same size hold the same pixels, whatever their strides
+static int sameImage(Image* a,Image* b){
+    int row;
+    for (row=0;row<a->height;row++)
+        if (memcmp(a->data+(size_t)row*a->stride,b->data+(size_t)row*b->stride,(size_t)a->width*a->bpp)) return 0;
+    return 1;
+}
+
+//checkEdits: Edits random rectangles of an image in an edit session and compares the result after every update with
+//the whole image convoluted again
+//Parameters: image: The starting image
+//            chain,border: As for convolute
+//Returns: The number of rounds whose result differed, or -1 if memory ran out
+static int checkEdits(Image* image,KernelChain* chain,enum BorderModes border){
+    EditSession session;
+    EditRect dirty[EDIT_ROUND_RECTS];
+    Image full=*image;
+    int round,i,count,bad=0;
+    if (allocImage(&full)) return -1;
+    if (openEditSession(&session,image,chain,border,77)){
+        freeImage(&full);
+        return -1;
+    }
+    for (round=0;round<EDIT_ROUNDS;round++){
+        count=1+rand()%EDIT_ROUND_RECTS;
+        for (i=0;i<count;i++){
+            dirty[i]=randomRect(image);
+            scribble(&session.source,&dirty[i]);
+        }
+        if (updateEditSession(&session,dirty,count)<0){
+            bad=-1;
+            break;
+        }
+        convolute(&session.source,&full,chain,border,77);
+        if (!sameImage(&session.result,&full)) bad++;
+    }
+    closeEditSession(&session);
+    freeImage(&full);
+    return bad;
+}
+
+//main: Checks that edit sessions stay equal to convoluting the whole image again, under every backend, a few kernel
+//chains and every border mode, on one and three channel images
+//Returns: 0 if every update matched, 1 otherwise
+int main(){
+    Options options;
+    KernelChain chain;
+    Image image;
+    int b,k,m,bpp,bad,failed=0;
+    size_t i;
+    memset(&options,0,sizeof(Options));
+    options.scale=1;
+    options.threads=4;
+    srand(1);
+    for (b=0;b<3;b++){
+        switchBackend(GetBackend(backends[b]),&options);
+        for (k=0;k<3;k++){
+            if (GetKernelChain(kernels[k],&chain)){
+                printf("Error reading kernel %s.\n",kernels[k]);
+                failed=1;
+                continue;
+            }
+            for (m=0;m<4;m++)
+                for (bpp=1;bpp<=3;bpp+=2){
+                    image.width=97;
+                    image.height=61;
+                    image.bpp=bpp;
+                    if (allocImage(&image)){
+                        printf("Error allocating memory.\n");
+                        return 1;
+                    }
+                    for (i=0;i<(size_t)image.stride*image.height;i++) image.data[i]=(uint8_t)rand();
+                    bad=checkEdits(&image,&chain,borders[m]);
+                    freeImage(&image);
+                    printf("%s %s %s bpp %d: %s\n",backends[b],kernels[k],borderNames[m],bpp,
+                        bad<0?"out of memory":bad?"MISMATCH":"ok");
+                    if (bad) failed=1;
+                }
+            freeKernelChain(&chain);
+        }
+    }
+    getBackend()->stop();
+    setBackend(&serialBackend);
+    setPngRunner(NULL);
+    freeBuffers();
+    printf(failed?"Edit check failed.\n":"Edit check passed.\n");
+    return failed;
+}
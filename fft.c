@@ -0,0 +1,202 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "image.h"
+#include "convolve.h"
+#include "fft.h"
+
+//fft: In place iterative radix 2 FFT of one row of plan->size complex values
+//Parameters: re,im: The real and imaginary parts
+//            plan: The plan holding the twiddle and bit reversal tables
+//            inverse: 1 for the unnormalized inverse transform, 0 for the forward transform
+//Returns: Nothing
+static void fft(double* re,double* im,struct FftPlan* plan,int inverse){
+    int i,j,k,len,n=plan->size;
+    double sign=inverse?1:-1;
+    for (i=0;i<n;i++){
+        j=plan->reverse[i];
+        if (j>i){
+            double t=re[i]; re[i]=re[j]; re[j]=t;
+            t=im[i]; im[i]=im[j]; im[j]=t;
+        }
+    }
+    for (len=2;len<=n;len<<=1){
+        int half=len/2,step=n/len;
+        for (i=0;i<n;i+=len){
+            for (k=0;k<half;k++){
+                double wr=plan->cosTable[k*step],wi=sign*plan->sinTable[k*step];
+                int a=i+k,b=i+k+half;
+                double xr=re[b]*wr-im[b]*wi;
+                double xi=re[b]*wi+im[b]*wr;
+                re[b]=re[a]-xr; im[b]=im[a]-xi;
+                re[a]+=xr; im[a]+=xi;
+            }
+        }
+    }
+}
+
+//transpose: Transposes a square size*size array in place
+static void transpose(double* data,int size){
+    int r,c;
+    for (r=0;r<size;r++)
+        for (c=r+1;c<size;c++){
+            double t=data[r*size+c];
+            data[r*size+c]=data[c*size+r];
+            data[c*size+r]=t;
+        }
+}
+
+//fft2d: 2D FFT of a size*size array.  The forward transform takes a normal array to a transposed spectrum and the
+//inverse takes a transposed spectrum back to a normal array, which saves transposing twice per tile.
+static void fft2d(double* re,double* im,struct FftPlan* plan,int inverse){
+    int r,n=plan->size;
+    for (r=0;r<n;r++) fft(re+r*n,im+r*n,plan,inverse);
+    transpose(re,n);
+    transpose(im,n);
+    for (r=0;r<n;r++) fft(re+r*n,im+r*n,plan,inverse);
+}
+
+//makeFftPlan: Picks a tile size for a kernel and precomputes the kernel spectrum
+//The tile size is the power of two that minimizes the transform work per valid output pixel, size^2*log(size)/valid^2.
+//Parameters: kernel: The kernel to plan for
+//Returns: The new plan, or NULL if the kernel is too large or memory could not be allocated.  Release it with freeFftPlan.
+struct FftPlan* makeFftPlan(Kernel* kernel){
+    int i,r,c,size,logSize,best=0,bestLog=0,n=kernel->size;
+    double bestCost=0;
+    struct FftPlan* plan;
+    for (size=2,logSize=1;size<=FFT_MAX_SIZE;size<<=1,logSize++){
+        double valid=size-n+1,cost;
+        if (valid<1) continue;
+        // the gather, spectrum multiply and scatter cost about as much as two more butterfly stages
+        cost=(double)size*size*(logSize+2)/(valid*valid);
+        if (!best || cost<bestCost){
+            best=size;
+            bestLog=logSize;
+            bestCost=cost;
+        }
+    }
+    if (!best) return NULL;
+    plan=calloc(1,sizeof(struct FftPlan));
+    if (!plan) return NULL;
+    plan->size=best;
+    plan->logSize=bestLog;
+    plan->valid=best-n+1;
+    plan->kernelSize=n;
+    plan->cosTable=malloc(best/2*sizeof(double));
+    plan->sinTable=malloc(best/2*sizeof(double));
+    plan->reverse=malloc(best*sizeof(int));
+    plan->kernelRe=calloc((size_t)best*best,sizeof(double));
+    plan->kernelIm=calloc((size_t)best*best,sizeof(double));
+    if (!plan->cosTable || !plan->sinTable || !plan->reverse || !plan->kernelRe || !plan->kernelIm){
+        freeFftPlan(plan);
+        return NULL;
+    }
+    for (i=0;i<best/2;i++){
+        plan->cosTable[i]=cos(2*M_PI*i/best);
+        plan->sinTable[i]=sin(2*M_PI*i/best);
+    }
+    for (i=0;i<best;i++){
+        int b,reversed=0;
+        for (b=0;b<bestLog;b++) if (i&(1<<b)) reversed|=1<<(bestLog-1-b);
+        plan->reverse[i]=reversed;
+    }
+    //flip the kernel so the circular convolution computes the correlation convoluteRows does: output pixel (y,x) of a
+    //tile whose input starts at (y0-n/2,x0-n/2) lands at (y-y0+n-1,x-x0+n-1)
+    for (r=0;r<n;r++)
+        for (c=0;c<n;c++)
+            plan->kernelRe[r*best+c]=kernel->weights[(n-1-r)*n+(n-1-c)];
+    fft2d(plan->kernelRe,plan->kernelIm,plan,0);
+    return plan;
+}
+
+//freeFftPlan: Releases an FFT plan.  NULL is ignored.
+void freeFftPlan(struct FftPlan* plan){
+    if (!plan) return;
+    free(plan->cosTable);
+    free(plan->sinTable);
+    free(plan->reverse);
+    free(plan->kernelRe);
+    free(plan->kernelIm);
+    free(plan);
+}
+
+//fftConvoluteBlock: convoluteBlock for the FFT method, using overlap-save tiles
+//Two channels are convoluted per transform, one in the real part and one in the imaginary part, which works because the
+//kernel is real.  Results are rounded down like the fixed point path, with a small bias so that sums which are exact
+//integers are not pushed below them by rounding error.
+//Parameters: srcImage: The image being convoluted
+//            destImage: The pre-allocated destination image
+//            startRow: The first row to compute
+//            endRow: One past the last row to compute
+//            startColumn: The first column to compute
+//            endColumn: One past the last column to compute
+//            plan: A plan whose method is METHOD_FFT
+//Returns: Nothing
+void fftConvoluteBlock(Image* srcImage,Image* destImage,int startRow,int endRow,int startColumn,int endColumn,ConvolutionPlan* plan){
+    struct FftPlan* fftPlan=plan->fft;
+    int width=srcImage->width,height=srcImage->height,bpp=srcImage->bpp;
+    int size=fftPlan->size,valid=fftPlan->valid,n=fftPlan->kernelSize,radius=fftPlan->kernelSize/2;
+    int tileX,tileY,i,j,channel,columnCount=width+size;
+    double scale=1.0/((double)size*size);
+    double* re=malloc((size_t)size*size*sizeof(double));
+    double* im=malloc((size_t)size*size*sizeof(double));
+    int* rowMap=malloc(size*sizeof(int));
+    int* columnMap=malloc(columnCount*sizeof(int));
+    if (!re || !im || !rowMap || !columnMap){
+        free(re); free(im); free(rowMap); free(columnMap);
+        return;
+    }
+    // columnMap[i] is the source column of tile input column i-radius, or -1 past a constant border
+    for (i=0;i<columnCount;i++) columnMap[i]=borderIndex(i-radius,width,plan->border);
+    for (tileY=startRow;tileY<endRow;tileY+=valid){
+        int rows=endRow-tileY<valid?endRow-tileY:valid;
+        for (j=0;j<size;j++) rowMap[j]=borderIndex(tileY+j-radius,height,plan->border);
+        for (tileX=startColumn;tileX<endColumn;tileX+=valid){
+            int columns=endColumn-tileX<valid?endColumn-tileX:valid;
+            for (channel=0;channel<bpp;channel+=2){
+                int second=channel+1<bpp;
+                for (j=0;j<size;j++){
+                    const uint8_t* source=rowMap[j]<0?NULL:srcImage->data+(long)rowMap[j]*srcImage->stride;
+                    double* outRe=re+j*size;
+                    double* outIm=im+j*size;
+                    for (i=0;i<size;i++){
+                        int x=columnMap[tileX+i];
+                        if (!source || x<0){
+                            outRe[i]=plan->borderValue;
+                            outIm[i]=second?plan->borderValue:0;
+                        }
+                        else{
+                            outRe[i]=source[x*bpp+channel];
+                            outIm[i]=second?source[x*bpp+channel+1]:0;
+                        }
+                    }
+                }
+                fft2d(re,im,fftPlan,0);
+                for (i=0;i<size*size;i++){
+                    double a=re[i],b=im[i],kr=fftPlan->kernelRe[i],ki=fftPlan->kernelIm[i];
+                    re[i]=a*kr-b*ki;
+                    im[i]=a*ki+b*kr;
+                }
+                fft2d(re,im,fftPlan,1);
+                for (j=0;j<rows;j++){
+                    uint8_t* out=destImage->data+(long)(tileY+j)*destImage->stride+tileX*bpp+channel;
+                    double* inRe=re+(j+n-1)*size+n-1;
+                    double* inIm=im+(j+n-1)*size+n-1;
+                    for (i=0;i<columns;i++){
+                        double value=inRe[i]*scale+1e-6;
+                        out[i*bpp]=value>=255?255:value<=0?0:(uint8_t)value;
+                        if (second){
+                            value=inIm[i]*scale+1e-6;
+                            out[i*bpp+1]=value>=255?255:value<=0?0:(uint8_t)value;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    free(re);
+    free(im);
+    free(rowMap);
+    free(columnMap);
+}
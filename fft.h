@@ -0,0 +1,28 @@
+#ifndef ___FFT
+#define ___FFT
+#include "image.h"
+#include "convolve.h"
+
+//The largest FFT tile, which bounds the memory used by one tile to a few tens of megabytes
+#define FFT_MAX_SIZE 2048
+
+//A precomputed overlap-save plan for one kernel.  The image is cut into tiles of size*size pixels that overlap by
+//kernelSize-1 pixels, so each tile produces valid*valid output pixels with no wrap around from the circular convolution.
+//The kernel spectrum is stored transposed, the layout the tile spectra are produced in.
+struct FftPlan{
+    int size;
+    int logSize;
+    int valid;
+    int kernelSize;
+    double* cosTable;
+    double* sinTable;
+    int* reverse;
+    double* kernelRe;
+    double* kernelIm;
+};
+
+struct FftPlan* makeFftPlan(Kernel* kernel);
+void freeFftPlan(struct FftPlan* plan);
+void fftConvoluteBlock(Image* srcImage,Image* destImage,int startRow,int endRow,int startColumn,int endColumn,ConvolutionPlan* plan);
+
+#endif
@@ -1,9 +1,28 @@
 #include <stdio.h>
 #include <stdint.h>
-#include <time.h>
 #include <string.h>
 #include "image.h"
+#include "timing.h"
+#include "options.h"
+#include "convolve.h"
+#include "kernel.h"
+#include "chain.h"
+#include "batch.h"
+#include "stream.h"
+#include "service.h"
+#include "pyramid.h"
+#include "imageio.h"
+#include "png.h"
+#include "buffers.h"
+#include "backend.h"
+#include "numa.h"
+#include "tune.h"
+#include "counters.h"
 
+// stb_image allocates from the buffer pool too, so decoding the next image of a batch reuses the last one's memory
+#define STBI_MALLOC(size) takeBuffer(size)
+#define STBI_REALLOC(buffer,size) resizeBuffer(buffer,size)
+#define STBI_FREE(buffer) giveBuffer(buffer)
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
@@ -22,59 +41,6 @@ Matrix algorithms[]={
 };
 
 
-//getPixelValue - Computes the value of a specific pixel on a specific channel using the selected convolution kernel
-//Paramters: srcImage:  An Image struct populated with the image being convoluted
-//           x: The x coordinate of the pixel
-//          y: The y coordinate of the pixel
-//          bit: The color channel being manipulated
-//          algorithm: The 3x3 kernel matrix to use for the convolution
-//Returns: The new value for this x,y pixel and bit channel
-uint8_t getPixelValue(Image* srcImage,int x,int y,int bit,Matrix algorithm){
-    int px,mx,py,my,i,span;
-    span=srcImage->width*srcImage->bpp;
-    // for the edge pixes, just reuse the edge pixel
-    px=x+1; py=y+1; mx=x-1; my=y-1;
-    if (mx<0) mx=0;
-    if (my<0) my=0;
-    if (px>=srcImage->width) px=srcImage->width-1;
-    if (py>=srcImage->height) py=srcImage->height-1;
-    uint8_t result=
-        algorithm[0][0]*srcImage->data[Index(mx,my,srcImage->width,bit,srcImage->bpp)]+
-        algorithm[0][1]*srcImage->data[Index(x,my,srcImage->width,bit,srcImage->bpp)]+
-        algorithm[0][2]*srcImage->data[Index(px,my,srcImage->width,bit,srcImage->bpp)]+
-        algorithm[1][0]*srcImage->data[Index(mx,y,srcImage->width,bit,srcImage->bpp)]+
-        algorithm[1][1]*srcImage->data[Index(x,y,srcImage->width,bit,srcImage->bpp)]+
-        algorithm[1][2]*srcImage->data[Index(px,y,srcImage->width,bit,srcImage->bpp)]+
-        algorithm[2][0]*srcImage->data[Index(mx,py,srcImage->width,bit,srcImage->bpp)]+
-        algorithm[2][1]*srcImage->data[Index(x,py,srcImage->width,bit,srcImage->bpp)]+
-        algorithm[2][2]*srcImage->data[Index(px,py,srcImage->width,bit,srcImage->bpp)];
-    return result;
-}
-
-//convolute:  Applies a kernel matrix to an image
-//Parameters: srcImage: The image being convoluted
-//            destImage: A pointer to a  pre-allocated (including space for the pixel array) structure to receive the convoluted image.  It should be the same size as srcImage
-//            algorithm: The kernel matrix to use for the convolution
-//Returns: Nothing
-void convolute(Image* srcImage,Image* destImage,Matrix algorithm){
-    int row,pix,bit,span;
-    span=srcImage->bpp*srcImage->bpp;
-    for (row=0;row<srcImage->height;row++){
-        for (pix=0;pix<srcImage->width;pix++){
-            for (bit=0;bit<srcImage->bpp;bit++){
-                destImage->data[Index(pix,row,srcImage->width,bit,srcImage->bpp)]=getPixelValue(srcImage,pix,row,bit,algorithm);
-            }
-        }
-    }
-}
-
-//Usage: Prints usage information for the program
-//Returns: -1
-int Usage(){
-    printf("Usage: image <filename> <type>\n\twhere type is one of (edge,sharpen,blur,gauss,emboss,identity)\n");
-    return -1;
-}
-
 //GetKernelType: Converts the string name of a convolution into a value from the KernelTypes enumeration
 //Parameters: type: A string representation of the type
 //Returns: an appropriate entry from the KernelTypes enumeration, defaults to IDENTITY, which does nothing but copy the image.
@@ -87,36 +53,142 @@ enum KernelTypes GetKernelType(char* type){
     else return IDENTITY;
 }
 
-//main:
-//argv is expected to take 2 arguments.  First is the source file name (can be jpg, png, bmp, tga).  Second is the lower case name of the algorithm.
-int main(int argc,char** argv){
-    long t1,t2;
-    t1=time(NULL);
-
+//startRun: Reads the command line, the kernels and the backend, and starts the backend, for runImage and image-mpi
+//Parameters: argc,argv: The arguments passed to main
+//            defaultBackend: The name of the backend used without --backend
+//            options: Receives the parsed command line
+//            chain: Receives the kernels.  Release them and stop the backend with finishRun.
+//            timing: Receives the fields every run reports: backend, file, kernel, simd and threads
+//Returns: The started backend, or NULL if the arguments or kernels are bad (nothing is left to release)
+const Backend* startRun(int argc,char** argv,char* defaultBackend,Options* options,KernelChain* chain,Timing* timing){
+    const Backend* backend;
     stbi_set_flip_vertically_on_load(0); 
-    if (argc!=3) return Usage();
-    char* fileName=argv[1];
-    if (!strcmp(argv[1],"pic4.jpg")&&!strcmp(argv[2],"gauss")){
+    if (ParseOptions(argc,argv,options)) return NULL;
+    backend=GetBackend(options->backend?options->backend:defaultBackend);
+    if (!backend){
+        Usage();
+        return NULL;
+    }
+    setBackend(backend);
+    setPngRunner(backend->pngRunner);
+    if (!strcmp(options->fileName,"pic4.jpg")&&!strcmp(options->type,"gauss")){
         printf("You have applied a gaussian filter to Gauss which has caused a tear in the time-space continum.\n");
     }
-    enum KernelTypes type=GetKernelType(argv[2]);
+    if (GetKernelChain(options->type,chain)){
+        printf("Error reading kernel %s.\n",options->type);
+        return NULL;
+    }
+    backend->start(options);
+    memset(timing,0,sizeof(Timing));
+    timing->backend=backend->name;
+    timing->fileName=options->fileName;
+    timing->kernel=options->type;
+    timing->simd=getSimdName();
+    timing->threads=backend->threads();
+    timing->affinity=getAffinityName();
+    timing->ranks=1;
+    return backend;
+}
+
+//finishRun: Releases what startRun set up once the run is done with every image
+//Parameters: chain: The kernels
+//            backend: The backend to stop
+//            result: What the run returns
+//Returns: result
+int finishRun(KernelChain* chain,const Backend* backend,int result){
+    freeKernelChain(chain);
+    freeBuffers();
+    backend->stop();
+    return result;
+}
+
+//runImage: Everything the program does, behind main so every build and embedding shares one copy
+//argv is expected to take 2 arguments.  First is the source file name (can be jpg, png, bmp, tga).  Second is the lower case name of the algorithm,
+//or a comma separated chain of them such as gauss,edge which are applied in order.
+//Optional --report json|csv and --report-file <path> arguments write a machine readable timing line.
+//A directory, an @list file of image paths or --outdir <directory> processes a batch of images in one run.
+//--stream convolutes a binary PPM/PGM (or a raw file given --raw) a strip at a time without holding the whole image.
+//PPM/PGM and raw inputs, and --output files ending in .ppm, .pgm or .raw, are memory mapped instead of decoded or encoded.
+//--scale shrinks the image before convoluting it and --roi convolutes and writes only one rectangle of it.
+//--layout planar convolutes each channel as its own plane, and --skip-alpha passes the alpha channel through untouched.
+//--luma convolutes and writes only the luma of a color image.
+//--backend picks serial, OpenMP, pthreads or accelerator (offload) convolution at run time, and --threads how many
+//host threads the parallel ones use.  --tune times the choices on this image and saves the fastest for its shape and
+//kernel, and later runs that leave them unset use the saved one.
+//--pyramid <levels> writes that many levels, each blurred and halved from the one before, next to the output file.
+//image --serve <socket path|-> keeps the backend running and convolutes images sent over a Unix socket or stdin.
+//Parameters: argc,argv: The arguments passed to main
+//            defaultBackend: The name of the backend used without --backend
+//Returns: 0 on success, -1 on failure, including an output that could not be written
+int runImage(int argc,char** argv,char* defaultBackend){
+    Options options;
+    Timing timing;
+    KernelChain chain;
+    const Backend* backend;
+    int64_t t1,t2;
+    int written;
+    t1=timingNow();
 
-    Image srcImage,destImage,bwImage;   
-    srcImage.data=stbi_load(fileName,&srcImage.width,&srcImage.height,&srcImage.bpp,0);
+    backend=startRun(argc,argv,defaultBackend,&options,&chain,&timing);
+    if (!backend) return -1;
+    char* fileName=options.fileName;
+    if (options.serve) return finishRun(&chain,backend,runService(&options));
+    if (options.pyramid && (chain.count!=1 || options.stream || options.outDir || isBatchInput(fileName))){
+        printf("Error: --pyramid writes the levels of a single image with a single kernel such as gauss, without --stream or a batch.\n");
+        return finishRun(&chain,backend,-1);
+    }
+    if (options.pyramid && (options.planar || options.planarLayout || options.roiWidth || options.scale>1)){
+        printf("Error: --pyramid reduces whole interleaved images, without --planar, --layout planar, --roi or --scale.\n");
+        return finishRun(&chain,backend,-1);
+    }
+    if (options.stream) return finishRun(&chain,backend,runStream(&options,&chain,&timing,backend->report));
+    if (options.outDir || isBatchInput(fileName)) return finishRun(&chain,backend,runBatch(&options,&chain,&timing,backend->report));
+
+    Image srcImage,destImage;
+    ImageFile srcFile,destFile;
+    char* outPath=options.output?options.output:"output.png";
+    t2=timingNow();
+    openImage(fileName,&options,&srcImage,&srcFile);
+    if (srcImage.data) reduceImage(&srcImage,&srcFile,&options,&chain);
+    timing.decodeNs=timingNow()-t2;
     if (!srcImage.data){
         printf("Error loading file %s.\n",fileName);
-        return -1;
+        return finishRun(&chain,backend,-1);
+    }
+    if (options.pyramid){
+        int result=runPyramid(&srcImage,&srcFile,&options,&chain,&timing);
+        timing.totalNs=timingNow()-t1;
+        if (backend->report) backend->report(&timing);
+        timingPrint(&timing);
+        return finishRun(&chain,backend,result || timingWriteReport(&timing,options.reportFormat,options.reportFile)?-1:0);
     }
-    destImage.bpp=srcImage.bpp;
-    destImage.height=srcImage.height;
-    destImage.width=srcImage.width;
-    destImage.data=malloc(sizeof(uint8_t)*destImage.width*destImage.bpp*destImage.height);
-    convolute(&srcImage,&destImage,algorithms[type]);
-    stbi_write_png("output.png",destImage.width,destImage.height,destImage.bpp,destImage.data,destImage.bpp*destImage.width);
-    stbi_image_free(srcImage.data);
+    outputSize(&srcImage,&options,&destImage);
+    timing.width=destImage.width;
+    timing.height=destImage.height;
+    timing.bpp=destImage.bpp;
+    t2=timingNow();
+    createImage(outPath,&options,&destImage,&destFile);
+    timing.allocNs=timingNow()-t2;
+    if (!destImage.data){
+        printf("Error creating output image %s.\n",outPath);
+        closeImage(&srcImage,&srcFile);
+        return finishRun(&chain,backend,-1);
+    }
+    backend=chooseTuning(&srcImage,&destImage,&chain,&options,backend);
+    timing.backend=backend->name;
+    timing.threads=backend->threads();
+    t2=timingNow();
+    convolutePlanes(&srcImage,&destImage,&chain,&options);
+    timing.convoluteNs=timingNow()-t2;
+    countersReport(&timing);
+    t2=timingNow();
+    written=!closeImage(&destImage,&destFile);
+    if (!written) printf("Error writing file %s.\n",outPath);
+    timing.encodeNs=timingNow()-t2;
+    closeImage(&srcImage,&srcFile);
     
-    free(destImage.data);
-    t2=time(NULL);
-    printf("Took %ld seconds\n",t2-t1);
-   return 0;
-}
\ No newline at end of file
+    timing.totalNs=timingNow()-t1;
+    if (backend->report) backend->report(&timing);
+    timingPrint(&timing);
+    return finishRun(&chain,backend,timingWriteReport(&timing,options.reportFormat,options.reportFile) || !written?-1:0);
+}
@@ -4,19 +4,41 @@
 
 #define Index(x,y,width,bit,bpp) y*width*bpp+bpp*x+bit
 
+//stride is the number of bytes from the start of one row to the next, at least width*bpp.  Decoded and mapped images
+//are packed, while images from allocImage pad each row out to a whole number of cache lines.
 typedef struct{
     uint8_t* data;
     int width;
     int height;
     int bpp;
+    int stride;
 } Image;
 
 enum KernelTypes{EDGE=0,SHARPEN=1,BLUR=2,GAUSE_BLUR=3,EMBOSS=4,IDENTITY=5};
 
+//How pixels past the edge of the image are filled in: clamp repeats the edge pixel, mirror reflects around it,
+//wrap reads from the opposite edge and constant uses a fixed value
+enum BorderModes{BORDER_CLAMP=0,BORDER_MIRROR=1,BORDER_WRAP=2,BORDER_CONSTANT=3};
+
 typedef double Matrix[3][3];
 
-uint8_t getPixelValue(Image* srcImage,int x,int y,int bit,Matrix algorithm);
-void convolute(Image* srcImage,Image* destImage,Matrix algorithm);
+//A square convolution kernel of any odd size.  weights holds size*size entries in row major order, and entry [r][c]
+//multiplies the source pixel r-size/2 rows and c-size/2 columns away, the same orientation as a Matrix.
+typedef struct{
+    int size;
+    double* weights;
+} Kernel;
+
+//A sequence of kernels applied one after another, as given on the command line (for example gauss,edge)
+typedef struct{
+    int count;
+    Kernel* kernels;
+} KernelChain;
+
+extern Matrix algorithms[];
+
+int runImage(int argc,char** argv,char* defaultBackend);
+void convolute(Image* srcImage,Image* destImage,KernelChain* chain,enum BorderModes border,uint8_t borderValue);
 int Usage();
 enum KernelTypes GetKernelType(char* type);
 
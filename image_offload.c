@@ -0,0 +1,261 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+
+#include "image.h"
+#include "timing.h"
+#include "options.h"
+#include "convolve.h"
+#include "png.h"
+#include "backend.h"
+
+//The number of rows in each band of the image the offload backend moves to the device and convolutes as one unit.
+//Each band is uploaded, run through every stage of the chain and downloaded by one task, and OFFLOAD_SLOTS bands are in
+//flight at once, so one band's transfers overlap another's kernels.
+#define OFFLOAD_BAND_ROWS 256
+#define OFFLOAD_SLOTS 2
+
+//Each team of device threads computes one OFFLOAD_TILE by OFFLOAD_TILE tile of output pixels, staging the tile and
+//the kernel's radius of pixels around it in team memory first.  Kernels of up to OFFLOAD_MAX_RADIUS (17x17) are
+//staged, larger ones read every tap from device memory.
+#define OFFLOAD_TILE 32
+#define OFFLOAD_MAX_RADIUS 8
+#define OFFLOAD_STAGED (OFFLOAD_TILE+2*OFFLOAD_MAX_RADIUS)
+
+//One stage of a chain as the device runs it: the integer weights, multiplier and shift of the FixedKernel when the
+//kernel has one, otherwise its double weights, both in device memory
+typedef struct{
+    int size;
+    int isFixed;
+    uint32_t multiplier;
+    int shift;
+    int16_t* weights;
+    double* doubles;
+} OffloadStage;
+
+//The device buffers of one band in flight: the source window and the two images its stages alternate between
+typedef struct{
+    uint8_t* buffers[2];
+} OffloadSlot;
+
+//Transfer and kernel time of the last convoluteOffload call, summed over its bands
+static int64_t transferNs=0,kernelNs=0;
+
+//The number of host threads startOffload settled on, named by runPngBlocks since a batch calls it from its encode
+//thread, which omp_set_num_threads on the main thread does not reach
+static int hostThreads=1;
+
+#pragma omp declare target
+//offloadPixel: Reads one channel of a pixel of a packed image, remapping coordinates past the edge by the border mode
+static inline uint8_t offloadPixel(const uint8_t* in,int width,int height,int bpp,int x,int y,int bit,enum BorderModes border,uint8_t borderValue){
+    x=borderIndex(x,width,border);
+    y=borderIndex(y,height,border);
+    return x<0 || y<0?borderValue:in[((size_t)y*width+x)*bpp+bit];
+}
+
+//offloadDivide, offloadClamp: The host's fixedDivide and double precision clamp, so results are identical
+static inline uint8_t offloadDivide(int32_t sum,uint32_t multiplier,int shift){
+    uint32_t result;
+    if (sum<=0) return 0;
+    result=(uint32_t)(((uint64_t)sum*multiplier)>>shift);
+    return result>255?255:(uint8_t)result;
+}
+
+static inline uint8_t offloadClamp(double result){
+    return result>255?255:result<0?0:(uint8_t)result;
+}
+
+//offloadTaps: Applies a stage's weights to the size by size taps whose top left one is at pixel, rowBytes apart
+static inline uint8_t offloadTaps(const uint8_t* pixel,int rowBytes,int bpp,int size,int isFixed,const int16_t* weights,const double* doubles,uint32_t multiplier,int shift){
+    int r,c;
+    int32_t sum=0;
+    double result=0;
+    for (r=0;r<size;r++)
+        for (c=0;c<size;c++){
+            if (isFixed) sum+=weights[r*size+c]*pixel[r*rowBytes+c*bpp];
+            else result+=doubles[r*size+c]*pixel[r*rowBytes+c*bpp];
+        }
+    return isFixed?offloadDivide(sum,multiplier,shift):offloadClamp(result);
+}
+#pragma omp end declare target
+
+//runStage: Convolutes a packed image already on the device with one stage
+//Parameters: stage: The stage
+//            in,out: Device pointers to the source and destination, width by height pixels of bpp bytes
+//            border,borderValue: How pixels past the edge of the image are filled in
+//            device: The device holding the images
+//Returns: Nothing
+static void runStage(OffloadStage* stage,const uint8_t* in,uint8_t* out,int width,int height,int bpp,enum BorderModes border,uint8_t borderValue,int device){
+    int size=stage->size,radius=stage->size/2,isFixed=stage->isFixed,shift=stage->shift;
+    int tilesX=(width+OFFLOAD_TILE-1)/OFFLOAD_TILE,tilesY=(height+OFFLOAD_TILE-1)/OFFLOAD_TILE,tile;
+    uint32_t multiplier=stage->multiplier;
+    const int16_t* weights=stage->weights;
+    const double* doubles=stage->doubles;
+    long i,count=(long)width*height*bpp;
+    if (radius>OFFLOAD_MAX_RADIUS){
+        #pragma omp target teams distribute parallel for device(device) is_device_ptr(in,out,weights,doubles)
+        for (i=0;i<count;i++){
+            int r,c,bit=i%bpp,x=i/bpp%width,y=i/bpp/width;
+            int32_t sum=0;
+            double result=0;
+            for (r=0;r<size;r++){
+                for (c=0;c<size;c++){
+                    int pixel=offloadPixel(in,width,height,bpp,x+c-radius,y+r-radius,bit,border,borderValue);
+                    if (isFixed) sum+=weights[r*size+c]*pixel;
+                    else result+=doubles[r*size+c]*pixel;
+                }
+            }
+            out[i]=isFixed?offloadDivide(sum,multiplier,shift):offloadClamp(result);
+        }
+        return;
+    }
+    #pragma omp target teams distribute device(device) is_device_ptr(in,out,weights,doubles)
+    for (tile=0;tile<tilesX*tilesY;tile++){
+        // declared at team scope so the team stages its tile once and every one of its threads reads it, which
+        // offloading compilers keep in the device's on-chip shared memory
+        uint8_t staged[OFFLOAD_STAGED*OFFLOAD_STAGED*4];
+        int left=tile%tilesX*OFFLOAD_TILE,top=tile/tilesX*OFFLOAD_TILE,span=OFFLOAD_TILE+2*radius,j;
+        #pragma omp parallel for
+        for (j=0;j<span*span*bpp;j++)
+            staged[j]=offloadPixel(in,width,height,bpp,left-radius+j/bpp%span,top-radius+j/bpp/span,j%bpp,border,borderValue);
+        #pragma omp parallel for
+        for (j=0;j<OFFLOAD_TILE*OFFLOAD_TILE*bpp;j++){
+            int bit=j%bpp,x=j/bpp%OFFLOAD_TILE,y=j/bpp/OFFLOAD_TILE;
+            if (left+x<width && top+y<height)
+                out[((size_t)(top+y)*width+left+x)*bpp+bit]=offloadTaps(staged+((size_t)y*span+x)*bpp+bit,span*bpp,bpp,size,isFixed,weights,doubles,multiplier,shift);
+        }
+    }
+}
+
+//copyRows: Copies rows between host and device memory, either of which may have padded rows
+//Parameters: dest,destStride,destDevice: Where the rows go
+//            src,srcStride,srcDevice: Where they come from
+//            rows,span: The number of rows and the bytes of each that are copied
+//Returns: 0 on success, nonzero if the copy failed
+static int copyRows(void* dest,size_t destStride,int destDevice,const void* src,size_t srcStride,int srcDevice,int rows,size_t span){
+    size_t volume[2]={(size_t)rows,span},offsets[2]={0,0};
+    size_t destDimensions[2]={(size_t)rows,destStride},srcDimensions[2]={(size_t)rows,srcStride};
+    return omp_target_memcpy_rect(dest,src,1,2,volume,offsets,offsets,destDimensions,srcDimensions,destDevice,srcDevice);
+}
+
+//convoluteOffload:  Applies a chain of convolution kernels to an image on an accelerator through OpenMP target offload
+//The image is cut into bands of OFFLOAD_BAND_ROWS rows.  Each band is uploaded together with the chain's radius of
+//rows above and below it, run through every stage on the device and downloaded, so a chain costs one round trip.  As
+//in runStream, the extra rows come out wrong near the edges of a band's window and are not downloaded.  Wrap borders
+//need the far edge of the image, so they run as a single band.  Without a device the same code runs on the host.
+//Every chain runs directly: --method, --no-separable and --simd only apply to the host backends.
+//Parameters: srcImage: The image being convoluted
+//            destImage: A pointer to a  pre-allocated (including space for the pixel array) structure to receive the convoluted image.  It should be the same size as srcImage
+//            chain: The kernels to apply, one after another
+//            border: How to fill in pixels past the edge of the image (BORDER_CLAMP reuses the edge pixel)
+//            borderValue: The pixel value used past the edge for BORDER_CONSTANT
+//Returns: Nothing
+static void convoluteOffload(Image* srcImage,Image* destImage,KernelChain* chain,enum BorderModes border,uint8_t borderValue){
+    int i,band,bands,bandRows,radius=0,ok=1,width=srcImage->width,height=srcImage->height,bpp=srcImage->bpp;
+    int device=omp_get_num_devices()>0?omp_get_default_device():omp_get_initial_device(),host=omp_get_initial_device();
+    size_t span=(size_t)width*bpp,windowBytes;
+    OffloadStage* stages=calloc(chain->count,sizeof(OffloadStage));
+    OffloadSlot slots[OFFLOAD_SLOTS];
+    transferNs=kernelNs=0;
+    memset(slots,0,sizeof(slots));
+    if (!stages){
+        printf("Error: Failed to allocate memory for the convolution.\n");
+        return;
+    }
+    for (i=0;i<chain->count;i++){
+        Kernel* kernel=&chain->kernels[i];
+        FixedKernel fixed;
+        size_t count=(size_t)kernel->size*kernel->size;
+        radius+=kernel->size/2;
+        stages[i].size=kernel->size;
+        stages[i].isFixed=!makeFixedKernel(kernel,&fixed);
+        if (stages[i].isFixed){
+            stages[i].multiplier=fixed.multiplier;
+            stages[i].shift=fixed.shift;
+            stages[i].weights=omp_target_alloc(count*sizeof(int16_t),device);
+            ok=ok && stages[i].weights && !omp_target_memcpy(stages[i].weights,fixed.weights,count*sizeof(int16_t),0,0,device,host);
+            freeFixedKernel(&fixed);
+        }
+        else{
+            stages[i].doubles=omp_target_alloc(count*sizeof(double),device);
+            ok=ok && stages[i].doubles && !omp_target_memcpy(stages[i].doubles,kernel->weights,count*sizeof(double),0,0,device,host);
+        }
+    }
+    bandRows=border==BORDER_WRAP?height:OFFLOAD_BAND_ROWS>2*radius?OFFLOAD_BAND_ROWS:2*radius;
+    if (bandRows>height) bandRows=height;
+    bands=(height+bandRows-1)/bandRows;
+    windowBytes=span*(bandRows+2*radius<height?bandRows+2*radius:height);
+    for (i=0;ok && i<OFFLOAD_SLOTS;i++){
+        slots[i].buffers[0]=omp_target_alloc(windowBytes,device);
+        slots[i].buffers[1]=omp_target_alloc(windowBytes,device);
+        ok=slots[i].buffers[0] && slots[i].buffers[1];
+    }
+    // the source window of a band goes in the slot's first buffer, and each stage reads one buffer and writes the other
+    if (!ok) printf("Error: Failed to allocate device memory for the convolution.\n");
+    else{
+        #pragma omp parallel num_threads(OFFLOAD_SLOTS)
+        #pragma omp single
+        for (band=0;band<bands;band++){
+            OffloadSlot* slot=&slots[band%OFFLOAD_SLOTS];
+            #pragma omp task firstprivate(band,slot) depend(inout:slot[0])
+            {
+                int start=band*bandRows,end=start+bandRows<height?start+bandRows:height,stage;
+                int windowStart=start-radius>0?start-radius:0,windowEnd=end+radius<height?end+radius:height;
+                int64_t t=timingNow(),uploaded,computed;
+                copyRows(slot->buffers[0],span,device,srcImage->data+(size_t)windowStart*srcImage->stride,srcImage->stride,host,windowEnd-windowStart,span);
+                uploaded=timingNow();
+                for (stage=0;stage<chain->count;stage++)
+                    runStage(&stages[stage],slot->buffers[stage%2],slot->buffers[(stage+1)%2],width,windowEnd-windowStart,bpp,border,borderValue,device);
+                computed=timingNow();
+                copyRows(destImage->data+(size_t)start*destImage->stride,destImage->stride,host,slot->buffers[chain->count%2]+(start-windowStart)*span,span,device,end-start,span);
+                #pragma omp atomic
+                transferNs+=uploaded-t+timingNow()-computed;
+                #pragma omp atomic
+                kernelNs+=computed-uploaded;
+            }
+        }
+    }
+    for (i=0;i<OFFLOAD_SLOTS;i++){
+        omp_target_free(slots[i].buffers[0],device);
+        omp_target_free(slots[i].buffers[1],device);
+    }
+    for (i=0;i<chain->count;i++){
+        omp_target_free(stages[i].weights,device);
+        omp_target_free(stages[i].doubles,device);
+    }
+    free(stages);
+}
+
+//startOffload: Applies --threads, the number of host threads a device-less run uses
+static void startOffload(Options* options){
+    if (options->threads) omp_set_num_threads(options->threads);
+    hostThreads=omp_get_max_threads();
+}
+
+//offloadThreads: Returns the number of host threads the offload backend runs on when there is no device
+static int offloadThreads(){
+    return hostThreads;
+}
+
+//runPngBlocks: Compresses the blocks of a PNG on the host's OpenMP threads
+//Parameters: function,argument,blocks: As for a PngRunner
+//Returns: Nothing
+static void runPngBlocks(PngBlockFunction function,void* argument,int blocks){
+    int block;
+    #pragma omp parallel for schedule(dynamic,1) num_threads(hostThreads)
+    for (block=0;block<blocks;block++) function(argument,block);
+}
+
+//reportOffload: Adds the transfer and kernel time of the last convoluteOffload call to its timing record
+static void reportOffload(Timing* timing){
+    timing->transferNs=transferNs;
+    timing->kernelNs=kernelNs;
+}
+
+//stopOffload: Device memory is released by every convoluteOffload call, so there is nothing left to release
+static void stopOffload(){
+}
+
+const Backend offloadBackend={"offload",startOffload,offloadThreads,convoluteOffload,runPngBlocks,reportOffload,stopOffload};
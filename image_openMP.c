@@ -1,161 +1,251 @@
 #include <stdio.h>
 #include <stdint.h>
-#include <time.h>
 #include <string.h>
-#include <stdlib.h> // Added for malloc
+#include <stdlib.h>
 #include <omp.h>    // Added for OpenMP
 
 #include "image.h"
+#include "timing.h"
+#include "options.h"
+#include "convolve.h"
+#include "chain.h"
+#include "png.h"
+#include "backend.h"
+#include "numa.h"
+#include "counters.h"
+
+//The number of rows each OpenMP iteration computes when the tile size is not tuned
+#define ROW_BLOCK 32
+
+//The number of rows the autotuner spends timing each candidate tile size.  Those rows are real output, so only the
+//candidates that lose cost extra time.
+#define TUNE_ROWS 64
+
+//Tile sizes tried by the autotuner as width,height pairs.  A width of 0 means a tile spans whole rows.
+static const int tileCandidates[][2]={{0,16},{0,64},{1024,32},{512,32},{256,64},{128,64}};
+#define TILE_CANDIDATES (int)(sizeof(tileCandidates)/sizeof(tileCandidates[0]))
+
+//The tile size given with --tile or by --tune, and the schedule, for every convoluteOpenMP call.  A tileWidth of 0 asks
+//each call to autotune for its own image.
+static int tileWidth=0,tileHeight=0;
+static omp_sched_t schedule=omp_sched_dynamic;
+
+//The number of threads startOpenMP settled on.  omp_set_num_threads only sets it for the thread that called it, so
+//every parallel region names it, as a batch encodes its PNGs on a thread of its own and an embedding program may
+//convolute on any of its threads.
+static int teamSize=1;
+
+//The tile size the last convoluteOpenMP call used, resolved for its image, so the report can include it
+static int usedWidth=0,usedHeight=0;
+
+//The NUMA node of each OpenMP thread, filled in by startOpenMP once the threads are pinned, and their number
+static int* threadNodes=NULL;
+static int nodeThreads=0;
+
+//The copy of the source image on each node while --replicate is on, read by runTiles in pass 0 instead of srcImage
+static Image replicas[NUMA_MAX_NODES];
+static int replicated=0;
+
+//runTiles: Runs one pass of a chain over rows startRow to endRow, split into tiles that the threads share
+//Parameters: srcImage,destImage,plan,pass: As for convoluteChainBlock
+//            startRow: The first row to compute
+//            endRow: One past the last row to compute
+//            width: The tile width in pixels
+//            height: The tile height in rows
+//Returns: Nothing
+static void runTiles(Image* srcImage,Image* destImage,ChainPlan* plan,int pass,int startRow,int endRow,int width,int height){
+    int tile,columns=(srcImage->width+width-1)/width;
+    int tiles=columns*((endRow-startRow+height-1)/height);
+
+    // Parallelize the loop over tiles, scheduled by omp_set_schedule
+    // tile is the loop variable
+    // srcImage, destImage, and plan are shared
+    // Reads from srcImage
+    // Writes to destImage and each tile is a different rectangle, so no two threads will ever write to the same memory location
+    // A tile row of several tiles keeps the kernel's source rows in L1/L2 while a thread works across it.
+    // With --counters each thread reads its counters around its share of the tiles.
+    #pragma omp parallel num_threads(teamSize)
+    {
+        CounterValues start;
+        int thread=omp_get_thread_num();
+        Image* source=replicated && pass==0 && thread<nodeThreads?&replicas[threadNodes[thread]]:srcImage;
+        countersBegin(&start);
+        #pragma omp for schedule(runtime)
+        for (tile=0;tile<tiles;tile++){
+            int top=startRow+(tile/columns)*height,left=(tile%columns)*width;
+            int bottom=top+height<endRow?top+height:endRow,right=left+width<srcImage->width?left+width:srcImage->width;
+            convoluteChainBlock(source,destImage,top,bottom,left,right,plan,pass);
+        }
+        countersEnd(&start,thread);
+    }
+}
+
+//tuneTiles: Picks the fastest tile size in tileCandidates by timing each one on its own band of TUNE_ROWS rows of pass 0
+//Parameters: srcImage,destImage,plan: As for convoluteChainBlock
+//            bestWidth,bestHeight: Receive the fastest tile size
+//Returns: The number of rows at the top of the image that pass 0 has already computed
+static int tuneTiles(Image* srcImage,Image* destImage,ChainPlan* plan,int* bestWidth,int* bestHeight){
+    int i,row=0;
+    int64_t best=-1;
+    for (i=0;i<TILE_CANDIDATES;i++){
+        int width=tileCandidates[i][0]?tileCandidates[i][0]:srcImage->width;
+        int64_t start=timingNow(),elapsed;
+        runTiles(srcImage,destImage,plan,0,row,row+TUNE_ROWS,width,tileCandidates[i][1]);
+        elapsed=timingNow()-start;
+        if (best<0 || elapsed<best){
+            best=elapsed;
+            *bestWidth=width;
+            *bestHeight=tileCandidates[i][1];
+        }
+        row+=TUNE_ROWS;
+    }
+    return row;
+}
 
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
-
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "stb_image_write.h"
-
-//An array of kernel matrices to be used for image convolution.  
-//The indexes of these match the enumeration from the header file. ie. algorithms[BLUR] returns the kernel corresponding to a box blur.
-Matrix algorithms[]={
-    {{0,-1,0},{-1,4,-1},{0,-1,0}},
-    {{0,-1,0},{-1,5,-1},{0,-1,0}},
-    {{1/9.0,1/9.0,1/9.0},{1/9.0,1/9.0,1/9.0},{1/9.0,1/9.0,1/9.0}},
-    {{1.0/16,1.0/8,1.0/16},{1.0/8,1.0/4,1.0/8},{1.0/16,1.0/8,1.0/16}},
-    {{-2,-1,0},{-1,1,1},{0,1,2}},
-    {{0,0,0},{0,1,0},{0,0,0}}
-};
-
-
-//getPixelValue - Computes the value of a specific pixel on a specific channel using the selected convolution kernel
-//Paramters: srcImage:  An Image struct populated with the image being convoluted
-//          x: The x coordinate of the pixel
-//          y: The y coordinate of the pixel
-//          bit: The color channel being manipulated
-//          algorithm: The 3x3 kernel matrix to use for the convolution
-//Returns: The new value for this x,y pixel and bit channel
-uint8_t getPixelValue(Image* srcImage,int x,int y,int bit,Matrix algorithm){
-    int px,mx,py,my; // Removed unused 'i' and 'span' variables
-    
-    // for the edge pixes, just reuse the edge pixel
-    px=x+1; py=y+1; mx=x-1; my=y-1;
-    if (mx<0) mx=0;
-    if (my<0) my=0;
-    if (px>=srcImage->width) px=srcImage->width-1;
-    if (py>=srcImage->height) py=srcImage->height-1;
-    
-    // Applying the kernel
-    double result_double =
-        algorithm[0][0]*srcImage->data[Index(mx,my,srcImage->width,bit,srcImage->bpp)]+
-        algorithm[0][1]*srcImage->data[Index(x,my,srcImage->width,bit,srcImage->bpp)]+
-        algorithm[0][2]*srcImage->data[Index(px,my,srcImage->width,bit,srcImage->bpp)]+
-        algorithm[1][0]*srcImage->data[Index(mx,y,srcImage->width,bit,srcImage->bpp)]+
-        algorithm[1][1]*srcImage->data[Index(x,y,srcImage->width,bit,srcImage->bpp)]+
-        algorithm[1][2]*srcImage->data[Index(px,y,srcImage->width,bit,srcImage->bpp)]+
-        algorithm[2][0]*srcImage->data[Index(mx,py,srcImage->width,bit,srcImage->bpp)]+
-        algorithm[2][1]*srcImage->data[Index(x,py,srcImage->width,bit,srcImage->bpp)]+
-        algorithm[2][2]*srcImage->data[Index(px,py,srcImage->width,bit,srcImage->bpp)];
-
-    // Clamping the result to the 0-255 range for uint8_t
-    if (result_double > 255) result_double = 255;
-    if (result_double < 0) result_double = 0;
-    
-    return (uint8_t)result_double;
+//touchImage: Has each OpenMP thread zero a contiguous band of the output rows, split the same way as a static schedule,
+//so the pages of a new output buffer are spread over the nodes of the threads.  With --schedule static each thread
+//then computes the same band, and under the other schedules most tiles are still computed on the node that holds them.
+//Parameters: destImage: The image to touch
+//Returns: Nothing
+static void touchImage(Image* destImage){
+    #pragma omp parallel num_threads(teamSize)
+    {
+        int thread=omp_get_thread_num(),threads=omp_get_num_threads();
+        touchRows(destImage,(int)((long)destImage->height*thread/threads),(int)((long)destImage->height*(thread+1)/threads));
+    }
+}
+
+//replicateImage: Copies srcImage to every NUMA node the OpenMP threads are on, each thread copying its share of its own
+//node's copy
+//Parameters: srcImage: The image to copy
+//Returns: Nothing.  replicated is set if the copies were made.
+static void replicateImage(Image* srcImage){
+    if (numaNodes()<2 || nodeThreads!=teamSize) return;
+    if (makeReplicas(srcImage,replicas)){
+        printf("Warning: Not enough memory to replicate the image, reading the original.\n");
+        return;
+    }
+    #pragma omp parallel num_threads(nodeThreads)
+    {
+        int startRow,endRow,thread=omp_get_thread_num();
+        replicaRows(threadNodes,nodeThreads,thread,srcImage->height,&startRow,&endRow);
+        copyImageRows(srcImage,&replicas[threadNodes[thread]],startRow,endRow);
+    }
+    replicated=1;
 }
 
-//convolute:  Applies a kernel matrix to an image
+//convoluteOpenMP:  Applies a chain of convolution kernels to an image on the OpenMP threads
+//The image is split into tiles of tileWidth by tileHeight, no wider than the image, and autotuned for this image when
+//tileWidth is 0.  Fused chains and FFT stages work on whole rows, so they use tiles of one strip or FFT tile height and
+//the full width instead.  The size is resolved afresh for every image, so a batch tunes each image for its own shape.
+//With --first-touch the threads first zero their bands of destImage, and with --replicate they copy srcImage to every
+//NUMA node and read their own node's copy.
 //Parameters: srcImage: The image being convoluted
 //           destImage: A pointer to a  pre-allocated (including space for the pixel array) structure to receive the convoluted image.  It should be the same size as srcImage
-//           algorithm: The kernel matrix to use for the convolution
+//           chain: The kernels to apply, one after another
+//           border: How to fill in pixels past the edge of the image (BORDER_CLAMP reuses the edge pixel)
+//           borderValue: The pixel value used past the edge for BORDER_CONSTANT
 //Returns: Nothing
-void convolute(Image* srcImage,Image* destImage,Matrix algorithm){
-    int row; 
-
-    // Parallelize the outer loop (the row loop)
-    // row is the loop variable
-    // srcImage, destImage, and algorithm are shared
-    // Reads from srcImage 
-    // Writes to destImage and each thread operates on a different 'row', so no two threads will ever write to the same memory location
-    #pragma omp parallel for
-    for (row=0;row<srcImage->height;row++){
-        
-        // pix and bit are declared inside the parallel loop
-        // This makes them private to each thread to avoid a race condition
-        int pix,bit; 
-        
-        for (pix=0;pix<srcImage->width;pix++){
-            for (bit=0;bit<srcImage->bpp;bit++){
-                destImage->data[Index(pix,row,srcImage->width,bit,srcImage->bpp)]=getPixelValue(srcImage,pix,row,bit,algorithm);
-            }
+static void convoluteOpenMP(Image* srcImage,Image* destImage,KernelChain* chain,enum BorderModes border,uint8_t borderValue){
+    int pass,done=0,width=tileWidth,height=tileHeight;
+    ChainPlan plan;
+    if (makeChainPlan(chain,srcImage,border,borderValue,&plan)){
+        printf("Error: Failed to allocate memory for the convolution.\n");
+        return;
+    }
+    omp_set_schedule(schedule,schedule==omp_sched_dynamic?1:0);
+    if (firstTouchEnabled()) touchImage(destImage);
+    if (replicationEnabled()) replicateImage(srcImage);
+    if (plan.fused || plan.plans[0].method==METHOD_FFT){
+        width=srcImage->width;
+        height=chainRowBlock(&plan,0,ROW_BLOCK);
+    }
+    else if (!width){
+        if (srcImage->height>=2*TILE_CANDIDATES*TUNE_ROWS) done=tuneTiles(srcImage,destImage,&plan,&width,&height);
+        else{
+            width=srcImage->width;
+            height=ROW_BLOCK;
         }
     }
+    if (width>srcImage->width) width=srcImage->width;
+    usedWidth=width;
+    usedHeight=height;
+
+    // A fused chain runs all of its stages in one pass of strips, otherwise each stage is a pass and the implicit barrier
+    // at the end of the parallel for finishes a stage before the next one reads it.
+    for (pass=0;pass<chainPasses(&plan);pass++){
+        if (plan.plans[pass].method==METHOD_FFT) runTiles(srcImage,destImage,&plan,pass,0,srcImage->height,srcImage->width,chainRowBlock(&plan,pass,ROW_BLOCK));
+        else runTiles(srcImage,destImage,&plan,pass,pass?0:done,srcImage->height,width,height);
+    }
+    if (replicated){
+        freeReplicas(replicas);
+        replicated=0;
+    }
+    freeChainPlan(&plan);
 }
 
-//Usage: Prints usage information for the program
-//Returns: -1
-int Usage(){
-    printf("Usage: image <filename> <type>\n\twhere type is one of (edge,sharpen,blur,gauss,emboss,identity)\n");
-    return -1;
+//GetSchedule: Converts the name of an OpenMP schedule into an omp_sched_t
+//Parameters: name: static, dynamic or guided
+//Returns: The matching schedule, dynamic for anything else
+static omp_sched_t GetSchedule(char* name){
+    if (!strcmp(name,"static")) return omp_sched_static;
+    else if (!strcmp(name,"guided")) return omp_sched_guided;
+    else return omp_sched_dynamic;
 }
 
-//GetKernelType: Converts the string name of a convolution into a value from the KernelTypes enumeration
-//Parameters: type: A string representation of the type
-//Returns: an appropriate entry from the KernelTypes enumeration, defaults to IDENTITY, which does nothing but copy the image.
-enum KernelTypes GetKernelType(char* type){
-    if (!strcmp(type,"edge")) return EDGE;
-    else if (!strcmp(type,"sharpen")) return SHARPEN;
-    else if (!strcmp(type,"blur")) return BLUR;
-    else if (!strcmp(type,"gauss")) return GAUSE_BLUR;
-    else if (!strcmp(type,"emboss")) return EMBOSS;
-    else return IDENTITY;
+//getScheduleName: Returns the name of the schedule convoluteOpenMP uses, for reports
+static const char* getScheduleName(){
+    if (schedule==omp_sched_static) return "static";
+    else if (schedule==omp_sched_guided) return "guided";
+    else return "dynamic";
 }
 
-//main:
-//argv is expected to take 2 arguments.  First is the source file name (can be jpg, png, bmp, tga).  Second is the lower case name of the algorithm.
-int main(int argc,char** argv){
-    long t1,t2;
-    t1=time(NULL);
-    
-    stbi_set_flip_vertically_on_load(0);  
-    if (argc!=3) return Usage();
-    char* fileName=argv[1];
-    if (!strcmp(argv[1],"pic4.jpg")&&!strcmp(argv[2],"gauss")){
-        printf("You have applied a gaussian filter to Gauss which has caused a tear in the time-space continum.\n");
-    }
-    enum KernelTypes type=GetKernelType(argv[2]);
+//runPngBlocks: Compresses the blocks of a PNG on the OpenMP threads
+//Parameters: function,argument,blocks: As for a PngRunner
+//Returns: Nothing
+static void runPngBlocks(PngBlockFunction function,void* argument,int blocks){
+    int block;
+    #pragma omp parallel for schedule(dynamic,1) num_threads(teamSize)
+    for (block=0;block<blocks;block++) function(argument,block);
+}
 
-    Image srcImage,destImage;
-    srcImage.data=stbi_load(fileName,&srcImage.width,&srcImage.height,&srcImage.bpp,0);
-    if (!srcImage.data){
-        printf("Error loading file %s.\n",fileName);
-        return -1;
-    }
-    destImage.bpp=srcImage.bpp;
-    destImage.height=srcImage.height;
-    destImage.width=srcImage.width;
-    destImage.data=malloc(sizeof(uint8_t)*destImage.width*destImage.bpp*destImage.height);
-    if (!destImage.data) {
-        printf("Error allocating memory for destination image.\n");
-        stbi_image_free(srcImage.data);
-        return -1;
-    }
+//reportTiles: Adds the tile size and schedule the last convoluteOpenMP call used to its timing record
+//Parameters: timing: The record to fill in
+static void reportTiles(Timing* timing){
+    timing->tileWidth=usedWidth;
+    timing->tileHeight=usedHeight;
+    timing->schedule=getScheduleName();
+}
 
-    // Print the number of threads being used
-    #pragma omp parallel
-    {
-        #pragma omp master
-        {
-            printf("Starting convolution with %d threads...\n", omp_get_num_threads());
-        }
+//startOpenMP: Applies --threads, --tile and --schedule, and pins the threads as --affinity asks
+//The runtime keeps the same threads for every later parallel region of the same size, so pinning them once here
+//holds for the whole run.
+static void startOpenMP(Options* options){
+    if (options->threads) omp_set_num_threads(options->threads);
+    teamSize=omp_get_max_threads();
+    tileWidth=options->tileWidth;
+    tileHeight=options->tileHeight;
+    schedule=options->schedule?GetSchedule(options->schedule):omp_sched_dynamic;
+    nodeThreads=teamSize;
+    threadNodes=calloc(nodeThreads,sizeof(int));
+    if (!threadNodes){
+        nodeThreads=0;
+        return;
     }
+    #pragma omp parallel num_threads(nodeThreads)
+    threadNodes[omp_get_thread_num()]=pinThread(omp_get_thread_num());
+}
+
+//openmpThreads: Returns the number of threads an OpenMP parallel region will use
+static int openmpThreads(){
+    return teamSize;
+}
 
+//stopOpenMP: The OpenMP runtime keeps its own threads, so only the node of each is released
+static void stopOpenMP(){
+    free(threadNodes);
+    threadNodes=NULL;
+    nodeThreads=0;
+}
 
-    convolute(&srcImage,&destImage,algorithms[type]);
-    
-    
-    stbi_write_png("output.png",destImage.width,destImage.height,destImage.bpp,destImage.data,destImage.bpp*destImage.width);
-    stbi_image_free(srcImage.data);
-    
-    free(destImage.data);
-    t2=time(NULL);
-    printf("Convolution took %ld seconds\n",t2-t1);
-   return 0;
-}
\ No newline at end of file
+const Backend openmpBackend={"openmp",startOpenMP,openmpThreads,convoluteOpenMP,runPngBlocks,reportTiles,stopOpenMP};
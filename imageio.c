@@ -0,0 +1,420 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "image.h"
+#include "options.h"
+#include "imageio.h"
+#include "stb_image.h"
+#include "png.h"
+#include "buffers.h"
+
+//readHeaderNumber: Reads the next decimal field of a PNM header, skipping whitespace and # comments
+//Parameters: data,length: The start of the file
+//            position: Where to start reading, moved past the field and the one whitespace character after it
+//Returns: The number, or -1 if the header is malformed
+static int readHeaderNumber(const uint8_t* data,size_t length,size_t* position){
+    size_t i=*position;
+    int value=0,digits=0;
+    while (i<length && (isspace(data[i]) || data[i]=='#')){
+        if (data[i]=='#') while (i<length && data[i]!='\n') i++;
+        else i++;
+    }
+    while (i<length && isdigit(data[i])){
+        if (value>100000000) return -1;
+        value=value*10+data[i++]-'0';
+        digits++;
+    }
+    if (!digits || i>=length || !isspace(data[i])) return -1;
+    *position=i+1;
+    return value;
+}
+
+//parsePnmHeader: Reads the header of a binary PPM (P6) or PGM (P5) file with a maxval of at most 255
+//Parameters: data,length: The start of the file, at least as far as the first pixel
+//            width,height,bpp: Receive the size of the image and its channels (3 for PPM, 1 for PGM)
+//Returns: The offset of the first pixel, or -1 if this is not a supported PNM header
+int parsePnmHeader(const uint8_t* data,size_t length,int* width,int* height,int* bpp){
+    size_t position=2;
+    int maxValue;
+    if (length<2 || data[0]!='P' || (data[1]!='5' && data[1]!='6')) return -1;
+    *bpp=data[1]=='5'?1:3;
+    *width=readHeaderNumber(data,length,&position);
+    *height=readHeaderNumber(data,length,&position);
+    maxValue=readHeaderNumber(data,length,&position);
+    if (*width<=0 || *height<=0 || maxValue<=0 || maxValue>255) return -1;
+    return (int)position;
+}
+
+//GetImageFormat: Picks the format of an image file from its extension
+//Parameters: fileName: The file
+//Returns: FORMAT_PNM for .ppm, .pgm and .pnm, FORMAT_RAW for .raw, otherwise FORMAT_STB
+enum ImageFormats GetImageFormat(char* fileName){
+    const char* dot=strrchr(fileName,'.');
+    if (!dot) return FORMAT_STB;
+    if (!strcasecmp(dot,".ppm") || !strcasecmp(dot,".pgm") || !strcasecmp(dot,".pnm")) return FORMAT_PNM;
+    if (!strcasecmp(dot,".raw")) return FORMAT_RAW;
+    return FORMAT_STB;
+}
+
+//mapFile: Maps a whole file read only
+//Parameters: fileName: The file
+//            file: Receives the mapping
+//            wholeFile: Whether every page will be read, so the kernel should start reading them all in now
+//Returns: 0 on success, -1 if the file could not be opened or mapped
+static int mapFile(char* fileName,ImageFile* file,int wholeFile){
+    struct stat info;
+    int descriptor=open(fileName,O_RDONLY);
+    if (descriptor<0) return -1;
+    if (fstat(descriptor,&info) || info.st_size<=0){
+        close(descriptor);
+        return -1;
+    }
+    file->length=info.st_size;
+    file->map=mmap(NULL,file->length,PROT_READ,MAP_PRIVATE,descriptor,0);
+    close(descriptor);
+    if (file->map==MAP_FAILED){
+        file->map=NULL;
+        return -1;
+    }
+    // start reading the whole file in now, since convolute will touch every page of it.  A region of interest only
+    // touches the pages under it, which are left to fault in.
+    if (wholeFile) madvise(file->map,file->length,MADV_WILLNEED);
+    return 0;
+}
+
+//openImage: Loads an image, mapping PPM/PGM and raw files instead of decoding them
+//Parameters: fileName: The image.  Files with a PNM extension, or any file when --raw gave the size of a headerless
+//                      image, are mapped and used in place.  Anything else is decoded by stb_image.
+//            options: The parsed command line, for rawWidth, rawHeight, rawBpp, planar and luma.  With --luma, stb_image
+//                     decodes straight to one channel of luma (a JPEG only decodes its Y channel), while mapped images
+//                     are left for reduceImage to convert.
+//            image: Receives the pixels and size of the image.  Mapped pixels are read only.
+//            file: Receives where the pixels live.  Release both with closeImage.
+//Returns: 0 on success, -1 if the file could not be read
+int openImage(char* fileName,Options* options,Image* image,ImageFile* file){
+    memset(file,0,sizeof(ImageFile));
+    file->format=options->rawWidth?FORMAT_RAW:GetImageFormat(fileName);
+    image->data=NULL;
+    if (options->planar && file->format!=FORMAT_RAW){
+        printf("Error: --planar needs raw input given with --raw.\n");
+        return -1;
+    }
+    if (file->format==FORMAT_STB){
+        image->data=stbi_load(fileName,&image->width,&image->height,&image->bpp,options->luma?1:0);
+        if (options->luma) image->bpp=1;
+        image->stride=image->width*image->bpp;
+        return image->data?0:-1;
+    }
+    if (mapFile(fileName,file,!options->roiWidth)) return -1;
+    if (file->format==FORMAT_RAW){
+        image->width=options->rawWidth;
+        image->height=options->rawHeight;
+        image->bpp=options->rawBpp;
+        image->stride=image->width*image->bpp;
+        if (file->length>=(size_t)image->width*image->height*image->bpp){
+            image->data=file->map;
+            return 0;
+        }
+    }
+    else{
+        int offset=parsePnmHeader(file->map,file->length,&image->width,&image->height,&image->bpp);
+        if (offset>=0 && file->length-offset>=(size_t)image->width*image->height*image->bpp){
+            image->data=file->map+offset;
+            image->stride=image->width*image->bpp;
+            return 0;
+        }
+    }
+    munmap(file->map,file->length);
+    file->map=NULL;
+    return -1;
+}
+
+//chainRadius: Returns how far from a pixel the kernels of a chain reach, all stages together
+static int chainRadius(KernelChain* chain){
+    int i,radius=0;
+    for (i=0;i<chain->count;i++) radius+=chain->kernels[i].size/2;
+    return radius;
+}
+
+//lumaOf: Returns the luma of one pixel with the integer weights stb_image converts decoded RGB with, so a mapped PPM
+//gets the same luma as the PNG it came from.  Gray and gray+alpha pixels are their gray channel.
+static uint8_t lumaOf(const uint8_t* pixel,int bpp){
+    if (bpp<3) return pixel[0];
+    return (uint8_t)((pixel[0]*77+pixel[1]*150+pixel[2]*29)>>8);
+}
+
+//reduceImage: Applies --scale, --roi and --luma to an image from openImage, so only the pixels that are needed get
+//convoluted
+//The scaled image is never built whole.  Each pixel of the region of interest, plus the chain's radius of halo around
+//it wherever the image reaches that far, is averaged from its scale by scale block of source pixels, and only the
+//source under the region is read.  stb_image cannot decode a JPEG at a lower resolution, so decoding still costs the
+//full image; mapped PPM/PGM and raw inputs only read the pages under the region.  With --luma a mapped color image is
+//converted to one channel of luma in the same pass, dropping any alpha.
+//Parameters: image: The opened image, replaced by the reduced copy
+//            file: Where its pixels live, updated to match
+//            options: The parsed command line, for scale, the roi fields, planar, luma and border
+//            chain: The kernels that will be applied, which decide the halo
+//Returns: 0 on success, -1 if the region does not fit or memory could not be allocated.  The image is released on
+//failure.
+int reduceImage(Image* image,ImageFile* file,Options* options,KernelChain* chain){
+    int scale=options->scale>1?options->scale:1,radius=chainRadius(chain),bpp=image->bpp,x,y,c;
+    int luma=options->luma && bpp>1;
+    int width=(image->width+scale-1)/scale,height=(image->height+scale-1)/scale;
+    int left=0,top=0,right=width,bottom=height;
+    size_t stride=image->stride;
+    Image reduced;
+    if (scale==1 && !options->roiWidth && !luma) return 0;
+    if (options->planar || (options->roiWidth && options->border==BORDER_WRAP)){
+        printf("Error: --scale, --roi and --luma need interleaved pixels, and --roi cannot use wrap borders.\n");
+        closeImage(image,file);
+        return -1;
+    }
+    if (options->roiWidth){
+        if (options->roiX+options->roiWidth>width || options->roiY+options->roiHeight>height){
+            printf("Error: --roi %d,%d,%d,%d does not fit in the %dx%d image.\n",options->roiX,options->roiY,
+                options->roiWidth,options->roiHeight,width,height);
+            closeImage(image,file);
+            return -1;
+        }
+        left=options->roiX>radius?options->roiX-radius:0;
+        top=options->roiY>radius?options->roiY-radius:0;
+        right=options->roiX+options->roiWidth+radius<width?options->roiX+options->roiWidth+radius:width;
+        bottom=options->roiY+options->roiHeight+radius<height?options->roiY+options->roiHeight+radius:height;
+    }
+    reduced.width=right-left;
+    reduced.height=bottom-top;
+    reduced.bpp=luma?1:bpp;
+    if (allocImage(&reduced)){
+        printf("Error allocating memory for the reduced image.\n");
+        closeImage(image,file);
+        return -1;
+    }
+    for (y=top;y<bottom;y++){
+        uint8_t* out=reduced.data+(size_t)(y-top)*reduced.stride;
+        const uint8_t* in=image->data+(size_t)y*scale*stride;
+        int rows=image->height-y*scale<scale?image->height-y*scale:scale;
+        if (scale==1 && !luma){
+            memcpy(out,in+(size_t)left*bpp,(size_t)reduced.width*bpp);
+            continue;
+        }
+        if (scale==1){
+            for (x=left;x<right;x++) *out++=lumaOf(in+(size_t)x*bpp,bpp);
+            continue;
+        }
+        for (x=left;x<right;x++){
+            const uint8_t* block=in+(size_t)x*scale*bpp;
+            int columns=image->width-x*scale<scale?image->width-x*scale:scale,count=rows*columns,r,k;
+            uint8_t pixel[4];
+            for (c=0;c<bpp;c++){
+                unsigned sum=0;
+                for (r=0;r<rows;r++) for (k=0;k<columns;k++) sum+=block[r*stride+k*bpp+c];
+                pixel[c]=(sum+count/2)/count;
+            }
+            if (luma) *out++=lumaOf(pixel,bpp);
+            else for (c=0;c<bpp;c++) *out++=pixel[c];
+        }
+    }
+    closeImage(image,file);
+    file->reduced=1;
+    *image=reduced;
+    return 0;
+}
+
+//outputSize: Sets the size of the image that convoluting srcImage will produce, which is the region of interest when
+//there is one and otherwise all of srcImage
+//Parameters: srcImage: The image from reduceImage
+//            options: The parsed command line, for the roi fields
+//            destImage: Receives the width, height and bpp
+//Returns: Nothing
+void outputSize(Image* srcImage,Options* options,Image* destImage){
+    destImage->bpp=srcImage->bpp;
+    destImage->width=options->roiWidth?options->roiWidth:srcImage->width;
+    destImage->height=options->roiWidth?options->roiHeight:srcImage->height;
+}
+
+//formatPnmHeader: Writes the header of a binary PGM (1 channel) or PPM (3 channel) file
+//Parameters: header: Receives the header, at least PNM_HEADER_MAX bytes
+//            width,height,bpp: The size of the image
+//Returns: The length of the header, or -1 if the format cannot hold bpp channels
+int formatPnmHeader(char* header,int width,int height,int bpp){
+    if (bpp!=1 && bpp!=3) return -1;
+    return sprintf(header,"P%c\n%d %d\n255\n",bpp==1?'5':'6',width,height);
+}
+
+//createImage: Allocates the pixels of an output image.  PPM/PGM and raw outputs are mapped straight from the output
+//file, so convolute writes into the page cache and nothing is left to encode.
+//Parameters: fileName: Where the image will be written.  The extension picks the format, see GetImageFormat.
+//            options: The parsed command line, for planar
+//            image: An image whose width, height and bpp are set.  Receives the pixels.
+//            file: Receives where the pixels live.  Write and release the image with closeImage.
+//Returns: 0 on success, -1 if the file could not be created or the format cannot hold the image
+int createImage(char* fileName,Options* options,Image* image,ImageFile* file){
+    char header[PNM_HEADER_MAX];
+    int headerLength=0,descriptor;
+    size_t size=(size_t)image->width*image->height*image->bpp;
+    memset(file,0,sizeof(ImageFile));
+    file->format=GetImageFormat(fileName);
+    file->output=1;
+    file->fileName=fileName;
+    image->data=NULL;
+    if (options->planar && file->format!=FORMAT_RAW){
+        printf("Error: planar images can only be written to a .raw file.\n");
+        return -1;
+    }
+    if (file->format==FORMAT_STB) return allocImage(image);
+    if (file->format==FORMAT_PNM){
+        headerLength=formatPnmHeader(header,image->width,image->height,image->bpp);
+        if (headerLength<0){
+            printf("Error: PPM/PGM output needs 1 or 3 channels, not %d.\n",image->bpp);
+            return -1;
+        }
+    }
+    file->length=headerLength+size;
+    descriptor=open(fileName,O_RDWR|O_CREAT|O_TRUNC,0666);
+    if (descriptor<0) return -1;
+    if (ftruncate(descriptor,file->length)){
+        close(descriptor);
+        return -1;
+    }
+    file->map=mmap(NULL,file->length,PROT_READ|PROT_WRITE,MAP_SHARED,descriptor,0);
+    close(descriptor);
+    if (file->map==MAP_FAILED){
+        file->map=NULL;
+        return -1;
+    }
+    memcpy(file->map,header,headerLength);
+    image->data=file->map+headerLength;
+    image->stride=image->width*image->bpp;
+    return 0;
+}
+
+//closeImage: Releases an image from openImage or createImage.  Outputs in FORMAT_STB are encoded as PNG first, and
+//mapped outputs are left for the kernel to write back.
+//Returns: 0 on success, -1 if the image could not be written
+int closeImage(Image* image,ImageFile* file){
+    int result=0;
+    if (file->map) munmap(file->map,file->length);
+    else if (file->output && image->data){
+        result=writePng(file->fileName,image);
+        freeImage(image);
+    }
+    else if (file->reduced) freeImage(image);
+    else if (image->data) stbi_image_free(image->data);
+    file->map=NULL;
+    image->data=NULL;
+    return result;
+}
+
+//isAlpha: Returns 1 if channel is the alpha channel of a bpp channel image, the last one of gray+alpha or RGBA
+static int isAlpha(int channel,int bpp){
+    return (bpp==2 || bpp==4) && channel==bpp-1;
+}
+
+//convolutePlane: Convolutes one channel of an image held as a single channel plane, or copies it through when it is
+//an alpha channel and --skip-alpha is set
+//Parameters: src,dest: The planes, with bpp 1
+//            channel,bpp: Which channel of how many the plane holds
+//            chain,options: As for convolutePlanes
+//Returns: Nothing
+static void convolutePlane(Image* src,Image* dest,int channel,int bpp,KernelChain* chain,Options* options){
+    int row;
+    if (options->skipAlpha && isAlpha(channel,bpp))
+        for (row=0;row<src->height;row++) memcpy(dest->data+(size_t)row*dest->stride,src->data+(size_t)row*src->stride,src->width);
+    else convolute(src,dest,chain,options->border,options->borderValue);
+}
+
+//convoluteSplit: Convolutes an interleaved image one channel at a time.  The channels are split into planes with cache
+//line aligned rows, each plane goes through convolute as a one channel image so its rows are contiguous bytes of a
+//single channel, and the results are interleaved again into destImage.  A skipped alpha plane is interleaved straight
+//from the source.
+//Parameters: srcImage,destImage,chain,options: As for convolutePlanes, with srcImage and destImage the same size
+//Returns: Nothing
+static void convoluteSplit(Image* srcImage,Image* destImage,KernelChain* chain,Options* options){
+    int bpp=srcImage->bpp,channel,x,y,failed=0;
+    Image planes[8];
+    for (channel=0;channel<2*bpp;channel++){
+        planes[channel]=*srcImage;
+        planes[channel].bpp=1;
+        if (allocImage(&planes[channel])) failed=1;
+    }
+    if (failed) printf("Error allocating memory for the planar image.\n");
+    else{
+        for (y=0;y<srcImage->height;y++){
+            const uint8_t* in=srcImage->data+(size_t)y*srcImage->stride;
+            for (channel=0;channel<bpp;channel++){
+                uint8_t* plane=planes[channel].data+(size_t)y*planes[channel].stride;
+                for (x=0;x<srcImage->width;x++) plane[x]=in[x*bpp+channel];
+            }
+        }
+        // a skipped alpha plane is interleaved from the source below, so there is nothing to copy
+        for (channel=0;channel<bpp;channel++)
+            if (!(options->skipAlpha && isAlpha(channel,bpp)))
+                convolutePlane(&planes[channel],&planes[bpp+channel],channel,bpp,chain,options);
+        for (y=0;y<srcImage->height;y++){
+            uint8_t* out=destImage->data+(size_t)y*destImage->stride;
+            for (channel=0;channel<bpp;channel++){
+                Image* plane=&planes[(options->skipAlpha && isAlpha(channel,bpp))?channel:bpp+channel];
+                const uint8_t* in=plane->data+(size_t)y*plane->stride;
+                for (x=0;x<srcImage->width;x++) out[x*bpp+channel]=in[x];
+            }
+        }
+    }
+    for (channel=0;channel<2*bpp;channel++) freeImage(&planes[channel]);
+}
+
+//convoluteLayout: Runs convolute over an image in the layout options describe, with srcImage and destImage the same
+//size.  Planar raw files are convoluted a plane at a time in place, interleaved images are split into planes first
+//when --layout planar asks for it or --skip-alpha has an alpha channel to skip, and everything else goes straight to
+//convolute.
+//Parameters: srcImage,destImage,chain,options: As for convolutePlanes
+//Returns: Nothing
+static void convoluteLayout(Image* srcImage,Image* destImage,KernelChain* chain,Options* options){
+    int bpp=srcImage->bpp,channel;
+    size_t size=(size_t)srcImage->width*srcImage->height;
+    if (bpp==1) convolute(srcImage,destImage,chain,options->border,options->borderValue);
+    else if (options->planar){
+        for (channel=0;channel<bpp;channel++){
+            Image src=*srcImage,dest=*destImage;
+            src.data+=channel*size;
+            dest.data+=channel*size;
+            src.bpp=dest.bpp=1;
+            src.stride=dest.stride=srcImage->width;
+            convolutePlane(&src,&dest,channel,bpp,chain,options);
+        }
+    }
+    else if (options->planarLayout || (options->skipAlpha && isAlpha(bpp-1,bpp))) convoluteSplit(srcImage,destImage,chain,options);
+    else convolute(srcImage,destImage,chain,options->border,options->borderValue);
+}
+
+//convolutePlanes: Runs convolute over an image whose layout options describe, see convoluteLayout
+//With --roi the source from reduceImage carries a halo around the region, which is convoluted along with it and then
+//cropped off, so the region matches a convolution of the whole image.
+//Parameters: srcImage,chain: As for convolute
+//            destImage: The image to write, sized by outputSize
+//            options: The parsed command line, for planar, planarLayout, skipAlpha, the roi fields, border and
+//                     borderValue
+//Returns: Nothing
+void convolutePlanes(Image* srcImage,Image* destImage,KernelChain* chain,Options* options){
+    if (srcImage->width!=destImage->width || srcImage->height!=destImage->height){
+        int radius=chainRadius(chain),row;
+        int left=options->roiX<radius?options->roiX:radius,top=options->roiY<radius?options->roiY:radius;
+        Image halo=*srcImage;
+        if (allocImage(&halo)){
+            printf("Error allocating memory for the region of interest.\n");
+            return;
+        }
+        convoluteLayout(srcImage,&halo,chain,options);
+        for (row=0;row<destImage->height;row++)
+            memcpy(destImage->data+(size_t)row*destImage->stride,halo.data+(size_t)(row+top)*halo.stride+(size_t)left*halo.bpp,
+                (size_t)destImage->width*destImage->bpp);
+        freeImage(&halo);
+        return;
+    }
+    convoluteLayout(srcImage,destImage,chain,options);
+}
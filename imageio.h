@@ -0,0 +1,37 @@
+#ifndef ___IMAGEIO
+#define ___IMAGEIO
+#include <stddef.h>
+#include <stdint.h>
+#include "image.h"
+#include "options.h"
+
+//How an image file is stored.  FORMAT_STB is anything stb_image reads, and is written as PNG.  PNM (binary PPM/PGM)
+//and raw files hold plain 8 bit pixels, so they are mapped into memory and used in place instead of decoded.
+enum ImageFormats{FORMAT_STB=0,FORMAT_PNM=1,FORMAT_RAW=2};
+
+//Room for the longest header formatPnmHeader writes
+#define PNM_HEADER_MAX 64
+
+//Where the pixels of an Image live.  For mapped formats map covers the whole file, header included, and the Image
+//points into it; otherwise the pixels were allocated by stb_image or allocImage, and reduced is set for the copies
+//made by reduceImage.  Output images keep fileName so closeImage knows where to encode them.
+typedef struct{
+    enum ImageFormats format;
+    int output;
+    int reduced;
+    char* fileName;
+    uint8_t* map;
+    size_t length;
+} ImageFile;
+
+int parsePnmHeader(const uint8_t* data,size_t length,int* width,int* height,int* bpp);
+int formatPnmHeader(char* header,int width,int height,int bpp);
+enum ImageFormats GetImageFormat(char* fileName);
+int openImage(char* fileName,Options* options,Image* image,ImageFile* file);
+int reduceImage(Image* image,ImageFile* file,Options* options,KernelChain* chain);
+void outputSize(Image* srcImage,Options* options,Image* destImage);
+int createImage(char* fileName,Options* options,Image* image,ImageFile* file);
+int closeImage(Image* image,ImageFile* file);
+void convolutePlanes(Image* srcImage,Image* destImage,KernelChain* chain,Options* options);
+
+#endif
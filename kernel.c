@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "image.h"
+#include "kernel.h"
+
+//kernelFromMatrix: Copies one of the built in 3x3 matrices into a Kernel
+//Parameters: algorithm: The kernel matrix to copy
+//            kernel: The Kernel to populate.  Release it with freeKernel.
+//Returns: 0 on success, -1 if memory could not be allocated
+int kernelFromMatrix(Matrix algorithm,Kernel* kernel){
+    int r,c;
+    kernel->size=3;
+    kernel->weights=malloc(9*sizeof(double));
+    if (!kernel->weights) return -1;
+    for (r=0;r<3;r++)
+        for (c=0;c<3;c++)
+            kernel->weights[r*3+c]=algorithm[r][c];
+    return 0;
+}
+
+//parseKernel: Reads a kernel from text
+//The text holds size*size numbers in row major order separated by spaces, commas or newlines, where size is odd.
+//They may be followed by a / and a divisor that every weight is divided by.  Lines starting with # are comments.
+//Parameters: text: The text to parse
+//            kernel: The Kernel to populate.  Release it with freeKernel.
+//Returns: 0 on success, -1 if the text is not a valid kernel
+int parseKernel(char* text,Kernel* kernel){
+    int count=0,capacity=64,size,i;
+    double divisor=1;
+    double* values=malloc(capacity*sizeof(double));
+    char* p=text;
+    if (!values) return -1;
+    while (*p){
+        char* end;
+        if (*p=='#'){
+            while (*p && *p!='\n') p++;
+            continue;
+        }
+        if (isspace((unsigned char)*p) || *p==','){
+            p++;
+            continue;
+        }
+        if (*p=='/'){
+            divisor=strtod(p+1,&end);
+            if (end==p+1 || divisor==0) break;
+            p=end;
+            while (isspace((unsigned char)*p)) p++;
+            if (*p) break;
+            continue;
+        }
+        if (count==capacity){
+            double* grown=realloc(values,2*capacity*sizeof(double));
+            if (!grown) break;
+            values=grown;
+            capacity*=2;
+        }
+        values[count]=strtod(p,&end);
+        if (end==p) break;
+        count++;
+        p=end;
+    }
+    for (size=1;size*size<count;size+=2);
+    if (*p || count==0 || size*size!=count || size>MAX_KERNEL_SIZE){
+        free(values);
+        return -1;
+    }
+    for (i=0;i<count;i++) values[i]/=divisor;
+    kernel->size=size;
+    kernel->weights=values;
+    return 0;
+}
+
+//loadKernelFile: Reads a kernel from a text file in the format accepted by parseKernel
+//Parameters: path: The file to read
+//            kernel: The Kernel to populate.  Release it with freeKernel.
+//Returns: 0 on success, -1 if the file cannot be read or is not a valid kernel
+int loadKernelFile(char* path,Kernel* kernel){
+    FILE* file=fopen(path,"rb");
+    long length;
+    char* text;
+    int result;
+    if (!file) return -1;
+    fseek(file,0,SEEK_END);
+    length=ftell(file);
+    fseek(file,0,SEEK_SET);
+    text=malloc(length+1);
+    if (!text || fread(text,1,length,file)!=(size_t)length){
+        free(text);
+        fclose(file);
+        return -1;
+    }
+    text[length]=0;
+    fclose(file);
+    result=parseKernel(text,kernel);
+    free(text);
+    return result;
+}
+
+//isWeight: Returns 1 if a comma separated token of a kernel chain is part of an inline weight list rather than a kernel name
+static int isWeight(const char* token){
+    return isdigit((unsigned char)*token) || *token=='-' || *token=='+' || *token=='.';
+}
+
+//GetKernel: Converts the kernel argument from the command line into a Kernel
+//Parameters: type: The lower case name of a built in kernel, @ followed by the path of a kernel file,
+//                  or a comma separated list of weights as accepted by parseKernel (for example 1,2,1,2,4,2,1,2,1/16)
+//            kernel: The Kernel to populate.  Release it with freeKernel.
+//Returns: 0 on success, -1 if a file or weight list could not be read.  Unknown names give IDENTITY, like GetKernelType.
+int GetKernel(char* type,Kernel* kernel){
+    if (type[0]=='@') return loadKernelFile(type+1,kernel);
+    if (strchr(type,',') || isWeight(type)) return parseKernel(type,kernel);
+    return kernelFromMatrix(algorithms[GetKernelType(type)],kernel);
+}
+
+//freeKernel: Releases the weights of a Kernel
+void freeKernel(Kernel* kernel){
+    free(kernel->weights);
+    kernel->weights=NULL;
+}
+
+//GetKernelChain: Converts a comma separated chain of kernels from the command line into a KernelChain
+//Each entry is anything GetKernel accepts.  Runs of numbers make up one inline weight list, which ends at the next name
+//or right after a /divisor, so gauss,1,2,1,2,4,2,1,2,1/16,edge is a chain of three kernels.
+//Parameters: text: The chain, for example gauss,edge
+//            chain: The KernelChain to populate.  Release it with freeKernelChain.
+//Returns: 0 on success, -1 if any entry could not be read
+int GetKernelChain(char* text,KernelChain* chain){
+    int length=strlen(text),start=0;
+    char* copy=malloc(length+1);
+    chain->count=0;
+    chain->kernels=malloc((length/2+1)*sizeof(Kernel));
+    if (!copy || !chain->kernels){
+        free(copy);
+        free(chain->kernels);
+        chain->kernels=NULL;
+        return -1;
+    }
+    memcpy(copy,text,length+1);
+    while (start<length){
+        int end=start,result;
+        if (isWeight(copy+start)){
+            // extend the weight list over following numeric tokens until one carries the divisor
+            while (1){
+                while (copy[end] && copy[end]!=',') end++;
+                if (memchr(copy+start,'/',end-start) || !copy[end] || !isWeight(copy+end+1)) break;
+                end++;
+            }
+        }
+        else while (copy[end] && copy[end]!=',') end++;
+        copy[end]=0;
+        result=end==start?-1:GetKernel(copy+start,&chain->kernels[chain->count]);
+        if (result){
+            free(copy);
+            freeKernelChain(chain);
+            return -1;
+        }
+        chain->count++;
+        start=end+1;
+    }
+    free(copy);
+    if (!chain->count){
+        freeKernelChain(chain);
+        return -1;
+    }
+    return 0;
+}
+
+//freeKernelChain: Releases every kernel of a KernelChain
+void freeKernelChain(KernelChain* chain){
+    int i;
+    for (i=0;i<chain->count;i++) freeKernel(&chain->kernels[i]);
+    free(chain->kernels);
+    chain->kernels=NULL;
+    chain->count=0;
+}
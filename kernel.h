@@ -0,0 +1,16 @@
+#ifndef ___KERNEL
+#define ___KERNEL
+#include "image.h"
+
+//The largest kernel accepted from a file or the command line
+#define MAX_KERNEL_SIZE 255
+
+int kernelFromMatrix(Matrix algorithm,Kernel* kernel);
+int parseKernel(char* text,Kernel* kernel);
+int loadKernelFile(char* path,Kernel* kernel);
+int GetKernel(char* type,Kernel* kernel);
+void freeKernel(Kernel* kernel);
+int GetKernelChain(char* text,KernelChain* chain);
+void freeKernelChain(KernelChain* chain);
+
+#endif
@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "image.h"
+#include "options.h"
+#include "kernel.h"
+#include "imageio.h"
+#include "png.h"
+#include "buffers.h"
+#include "backend.h"
+#include "stb_image.h"
+#include "library.h"
+
+//openImageContext: Opens a context for running jobs from a program that embeds the library
+//Parameters: context: The context to populate.  Release it with closeImageContext.
+//            backend: serial, openmp, pthreads or offload to start that backend, or NULL to use the one already
+//                     running (for the --serve mode of the image program, whose backend startRun has started)
+//            threads: The number of threads for the parallel backends, 0 for one per online core
+//Returns: 0 on success, -1 if the backend is unknown
+int openImageContext(ImageContext* context,const char* backend,int threads){
+    memset(context,0,sizeof(ImageContext));
+    context->options.scale=1;
+    context->options.threads=threads;
+    if (!backend){
+        context->backend=getBackend();
+        return 0;
+    }
+    context->backend=GetBackend((char*)backend);
+    if (!context->backend) return -1;
+    context->options.backend=(char*)context->backend->name;
+    switchBackend(context->backend,&context->options);
+    context->started=1;
+    return 0;
+}
+
+//setContextKernel: Sets the kernels the next jobs apply, parsing them only if they differ from the last ones
+//Parameters: context: The context
+//            kernel: A kernel type, weights or chain as given on the command line, such as gauss,edge
+//Returns: 0 on success, -1 if the kernels could not be read (the context then has none)
+int setContextKernel(ImageContext* context,const char* kernel){
+    if (context->kernel && !strcmp(context->kernel,kernel)) return 0;
+    if (context->kernel) freeKernelChain(&context->chain);
+    free(context->kernel);
+    context->kernel=strdup(kernel);
+    if (!context->kernel) return -1;
+    if (GetKernelChain(context->kernel,&context->chain)){
+        free(context->kernel);
+        context->kernel=NULL;
+        return -1;
+    }
+    return 0;
+}
+
+//decodeImageMemory: Decodes an image held in memory (anything stb_image reads) without touching the disk
+//Parameters: data,length: The encoded image
+//            luma: 1 to decode a color image straight to one channel of luma, as --luma does
+//            image: Receives the packed pixels, from the buffer pool.  Release them with freeImage.
+//Returns: 0 on success, -1 if the image could not be decoded
+int decodeImageMemory(const uint8_t* data,size_t length,int luma,Image* image){
+    memset(image,0,sizeof(Image));
+    if (length>0x7fffffff) return -1;
+    image->data=stbi_load_from_memory(data,(int)length,&image->width,&image->height,&image->bpp,luma?1:0);
+    if (!image->data) return -1;
+    if (luma) image->bpp=1;
+    image->stride=image->width*image->bpp;
+    return 0;
+}
+
+//convoluteContext: Applies the context's kernels to an image on its backend
+//Parameters: context: The context, with kernels from setContextKernel
+//            srcImage: The image to convolute.  Its pixels may live anywhere, with any stride.
+//            destImage: A caller provided image of the same size, from allocImage or the caller's own memory
+//Returns: 0 on success, -1 if no kernels are set or the images differ in size
+int convoluteContext(ImageContext* context,Image* srcImage,Image* destImage){
+    if (!context->kernel || srcImage->width!=destImage->width || srcImage->height!=destImage->height || srcImage->bpp!=destImage->bpp) return -1;
+    convolutePlanes(srcImage,destImage,&context->chain,&context->options);
+    return 0;
+}
+
+//encodeImageMemory: Compresses an image into a PNG in memory, on the backend's threads, see encodePng
+//Parameters: image: The image to compress
+//            data: Receives the PNG, to be released with free
+//            length: Receives its length in bytes
+//Returns: 0 on success, -1 if memory could not be allocated
+int encodeImageMemory(Image* image,uint8_t** data,size_t* length){
+    return encodePng(image,data,length);
+}
+
+//closeImageContext: Releases the kernels of a context, and stops its backend and frees the idle buffers of the pool if
+//the context started it
+void closeImageContext(ImageContext* context){
+    if (context->kernel) freeKernelChain(&context->chain);
+    free(context->kernel);
+    context->kernel=NULL;
+    if (!context->started) return;
+    context->backend->stop();
+    setBackend(&serialBackend);
+    setPngRunner(NULL);
+    freeBuffers();
+}
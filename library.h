@@ -0,0 +1,30 @@
+#ifndef ___LIBRARY
+#define ___LIBRARY
+#include <stddef.h>
+#include <stdint.h>
+#include "image.h"
+#include "options.h"
+#include "backend.h"
+
+//Everything a program embedding the library keeps between jobs: the backend with its threads, the kernels of the last
+//job so the same ones are not parsed again, and the settings every job uses.  Scratch memory comes from the buffer
+//pool, which keeps released buffers for the next job.  The backends are process wide, so only one context should be
+//open at a time.
+//options holds the settings convoluteContext uses: border, borderValue, planarLayout and skipAlpha may be changed
+//between jobs.  started is set when the context started its backend, and so stops it again in closeImageContext.
+typedef struct{
+    const Backend* backend;
+    Options options;
+    KernelChain chain;
+    char* kernel;
+    int started;
+} ImageContext;
+
+int openImageContext(ImageContext* context,const char* backend,int threads);
+int setContextKernel(ImageContext* context,const char* kernel);
+int decodeImageMemory(const uint8_t* data,size_t length,int luma,Image* image);
+int convoluteContext(ImageContext* context,Image* srcImage,Image* destImage);
+int encodeImageMemory(Image* image,uint8_t** data,size_t* length);
+void closeImageContext(ImageContext* context);
+
+#endif
@@ -0,0 +1,11 @@
+#include "image.h"
+
+//The backend used without --backend.  The makefile builds one program per backend so the older names keep working.
+#ifndef DEFAULT_BACKEND
+#define DEFAULT_BACKEND "serial"
+#endif
+
+//main: Runs the program, see runImage
+int main(int argc,char** argv){
+    return runImage(argc,argv,DEFAULT_BACKEND);
+}
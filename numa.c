@@ -0,0 +1,226 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
+#include "image.h"
+#include "buffers.h"
+#include "numa.h"
+
+static enum Affinities affinity=AFFINITY_NONE;
+static int firstTouch=0;
+static int replication=0;
+
+//The NUMA topology, read from sysfs the first time it is needed.  cpus lists every CPU this process may run on, grouped
+//by node, and the CPUs of node n are cpus[nodeStart[n]] up to cpus[nodeStart[n+1]-1].  Nodes without any of those CPUs
+//(memory only nodes, or nodes outside a cpuset) are left out, so node numbers here can differ from the kernel's.
+static pthread_once_t topologyOnce=PTHREAD_ONCE_INIT;
+static int nodeCount=1;
+static int cpuCount=0;
+static int cpus[NUMA_MAX_CPUS];
+static int nodeStart[NUMA_MAX_NODES+1];
+static int cpuNodes[NUMA_MAX_CPUS];
+
+//GetAffinity: Converts the name of a thread affinity into a value from the Affinities enumeration
+//Parameters: name: none, compact or scatter
+//Returns: The matching affinity, or -1 if the name is unknown
+int GetAffinity(char* name){
+    if (!strcmp(name,"none")) return AFFINITY_NONE;
+    else if (!strcmp(name,"compact")) return AFFINITY_COMPACT;
+    else if (!strcmp(name,"scatter")) return AFFINITY_SCATTER;
+    return -1;
+}
+
+//setAffinity: Sets how the threads of the openmp and pthreads backends are pinned, before they are started
+void setAffinity(enum Affinities value){
+    affinity=value;
+}
+
+//setFirstTouch: Turns on the pass that has every worker write the output rows it will compute before the convolution,
+//so the pages of a new output buffer are placed on that worker's node
+void setFirstTouch(int enabled){
+    firstTouch=enabled;
+}
+
+//setReplication: Turns on a copy of the source image on every NUMA node, so workers read their own node's copy
+void setReplication(int enabled){
+    replication=enabled;
+}
+
+enum Affinities getAffinity(){
+    return affinity;
+}
+
+int firstTouchEnabled(){
+    return firstTouch;
+}
+
+int replicationEnabled(){
+    return replication;
+}
+
+//getAffinityName: Returns the name of the affinity, for messages
+const char* getAffinityName(){
+    if (affinity==AFFINITY_COMPACT) return "compact";
+    else if (affinity==AFFINITY_SCATTER) return "scatter";
+    return "none";
+}
+
+#ifdef __linux__
+//addCpus: Adds the CPUs of a sysfs cpulist such as 0-15,32-47 to the current node, skipping those this process may
+//not run on
+static void addCpus(char* list,cpu_set_t* allowed){
+    char* range=strtok(list,",\n");
+    while (range){
+        int cpu,first,last;
+        int fields=sscanf(range,"%d-%d",&first,&last);
+        if (fields==1) last=first;
+        for (cpu=first;fields>0 && cpu<=last && cpu<NUMA_MAX_CPUS && cpuCount<NUMA_MAX_CPUS;cpu++){
+            if (!CPU_ISSET(cpu,allowed)) continue;
+            cpus[cpuCount++]=cpu;
+            cpuNodes[cpu]=nodeCount;
+        }
+        range=strtok(NULL,",\n");
+    }
+}
+#endif
+
+//readTopology: Fills in the NUMA topology.  A machine without /sys/devices/system/node is one node of every CPU, and
+//anything but Linux is one node with no CPUs to pin to.
+static void readTopology(){
+#ifdef __linux__
+    cpu_set_t allowed;
+    int node,cpu;
+    if (sched_getaffinity(0,sizeof(allowed),&allowed)) return;
+    nodeCount=0;
+    for (node=0;node<NUMA_MAX_NODES && nodeCount<NUMA_MAX_NODES;node++){
+        char path[64],list[4096];
+        FILE* file;
+        int first=cpuCount;
+        snprintf(path,sizeof(path),"/sys/devices/system/node/node%d/cpulist",node);
+        file=fopen(path,"r");
+        if (!file) continue;
+        if (fgets(list,sizeof(list),file)) addCpus(list,&allowed);
+        fclose(file);
+        if (cpuCount>first) nodeStart[nodeCount++]=first;
+    }
+    if (!nodeCount){
+        for (cpu=0;cpu<NUMA_MAX_CPUS;cpu++)
+            if (CPU_ISSET(cpu,&allowed)){
+                cpus[cpuCount++]=cpu;
+                cpuNodes[cpu]=0;
+            }
+        nodeStart[0]=0;
+        nodeCount=1;
+    }
+    nodeStart[nodeCount]=cpuCount;
+#endif
+}
+
+//numaNodes: Returns the number of NUMA nodes the process can run on
+int numaNodes(){
+    pthread_once(&topologyOnce,readTopology);
+    return nodeCount;
+}
+
+//currentNode: Returns the node of the CPU the calling thread is running on right now
+int currentNode(){
+#ifdef __linux__
+    int cpu;
+    pthread_once(&topologyOnce,readTopology);
+    cpu=sched_getcpu();
+    if (cpu>=0 && cpu<NUMA_MAX_CPUS) return cpuNodes[cpu];
+#endif
+    return 0;
+}
+
+//pinThread: Pins the calling thread to one CPU as the affinity asks
+//compact gives thread index the index-th CPU, filling each node before the next, and scatter deals the threads out to
+//the nodes in turn.  Either wraps around when there are more threads than CPUs.
+//Parameters: index: The number of the calling thread within its pool or team, from 0
+//Returns: The NUMA node the thread is now on.  Without an affinity (or if pinning fails) the thread is left alone and
+//         this is the node it happens to be running on.
+int pinThread(int index){
+#ifdef __linux__
+    pthread_once(&topologyOnce,readTopology);
+    if (affinity!=AFFINITY_NONE && cpuCount){
+        cpu_set_t set;
+        int cpu;
+        if (affinity==AFFINITY_COMPACT) cpu=cpus[index%cpuCount];
+        else{
+            int node=index%nodeCount;
+            cpu=cpus[nodeStart[node]+(index/nodeCount)%(nodeStart[node+1]-nodeStart[node])];
+        }
+        CPU_ZERO(&set);
+        CPU_SET(cpu,&set);
+        if (!pthread_setaffinity_np(pthread_self(),sizeof(set),&set)) return cpuNodes[cpu];
+    }
+#endif
+    return currentNode();
+}
+
+//touchRows: Writes zeros to rows startRow to endRow-1 of an image.  Linux places each page on the node of the thread
+//that first writes it, so the worker that will compute these rows should be the one to call this.  Pages that have
+//already been written, such as those of a buffer reused from the pool, stay where they are.
+void touchRows(Image* image,int startRow,int endRow){
+    if (startRow<endRow) memset(image->data+(long)startRow*image->stride,0,(long)(endRow-startRow)*image->stride);
+}
+
+//makeReplicas: Allocates one copy of an image's pixels for every NUMA node, to be filled with copyImageRows
+//The copies bypass the buffer pool: a pooled buffer would keep the pages of whichever node touched it first.
+//Parameters: srcImage: The image to copy
+//            replicas: An array of NUMA_MAX_NODES images, of which the first numaNodes() receive the copies.  Release
+//                      them with freeReplicas.
+//Returns: 0 on success, -1 if memory could not be allocated
+int makeReplicas(Image* srcImage,Image* replicas){
+    int node;
+    memset(replicas,0,NUMA_MAX_NODES*sizeof(Image));
+    for (node=0;node<numaNodes();node++){
+        replicas[node]=*srcImage;
+        replicas[node].stride=rowStride(srcImage->width,srcImage->bpp);
+        replicas[node].data=aligned_alloc(BUFFER_ALIGNMENT,(size_t)replicas[node].stride*srcImage->height);
+        if (!replicas[node].data){
+            freeReplicas(replicas);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+//replicaRows: Splits the copying of the replicas among the workers, each copying an equal share of its own node's
+//replica, so every page of a replica is first touched on its node
+//Parameters: nodes: The node of each worker, from pinThread
+//            threads: The number of workers
+//            item: The worker whose share is wanted
+//            height: The height of the image
+//            startRow,endRow: Receive the rows item copies into replica nodes[item]
+//Returns: Nothing
+void replicaRows(const int* nodes,int threads,int item,int height,int* startRow,int* endRow){
+    int i,rank=0,total=0;
+    for (i=0;i<threads;i++)
+        if (nodes[i]==nodes[item]){
+            if (i<item) rank++;
+            total++;
+        }
+    *startRow=(int)((long)height*rank/total);
+    *endRow=(int)((long)height*(rank+1)/total);
+}
+
+//copyImageRows: Copies rows startRow to endRow-1 of one image into another of the same size
+void copyImageRows(Image* srcImage,Image* destImage,int startRow,int endRow){
+    int row;
+    for (row=startRow;row<endRow;row++)
+        memcpy(destImage->data+(long)row*destImage->stride,srcImage->data+(long)row*srcImage->stride,(size_t)srcImage->width*srcImage->bpp);
+}
+
+//freeReplicas: Releases the copies from makeReplicas
+void freeReplicas(Image* replicas){
+    int node;
+    for (node=0;node<NUMA_MAX_NODES;node++){
+        free(replicas[node].data);
+        replicas[node].data=NULL;
+    }
+}
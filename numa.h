@@ -0,0 +1,30 @@
+#ifndef ___NUMA
+#define ___NUMA
+#include "image.h"
+
+//How worker threads are pinned to cores: none leaves them to the scheduler, compact fills every core of one NUMA node
+//before moving to the next, and scatter deals threads out to the nodes in turn
+enum Affinities{AFFINITY_NONE=0,AFFINITY_COMPACT=1,AFFINITY_SCATTER=2};
+
+//The most NUMA nodes looked at, and the most CPUs
+#define NUMA_MAX_NODES 64
+#define NUMA_MAX_CPUS 1024
+
+int GetAffinity(char* name);
+void setAffinity(enum Affinities affinity);
+void setFirstTouch(int enabled);
+void setReplication(int enabled);
+enum Affinities getAffinity();
+int firstTouchEnabled();
+int replicationEnabled();
+const char* getAffinityName();
+int numaNodes();
+int currentNode();
+int pinThread(int index);
+void touchRows(Image* image,int startRow,int endRow);
+int makeReplicas(Image* srcImage,Image* replicas);
+void replicaRows(const int* nodes,int threads,int item,int height,int* startRow,int* endRow);
+void copyImageRows(Image* srcImage,Image* destImage,int startRow,int endRow);
+void freeReplicas(Image* replicas);
+
+#endif
@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "image.h"
+#include "options.h"
+#include "simd.h"
+#include "convolve.h"
+#include "chain.h"
+#include "png.h"
+#include "backend.h"
+#include "numa.h"
+#include "counters.h"
+#include "pyramid.h"
+
+//Usage: Prints usage information for the program
+//Returns: -1
+int Usage(){
+    printf("Usage: image <filename|directory|@list> <type> [--report json|csv] [--report-file <path>] [--simd scalar|sse4|avx2|neon|auto]\n\t[--border clamp|mirror|wrap|constant] [--border-value <0-255>] [--no-separable] [--no-fuse]\n\t[--method auto|direct|separable|fft] [--backend serial|openmp|pthreads|offload] [--threads <count>]\n\t[--tile auto|<width>x<height>] [--schedule static|dynamic|guided]\n\t[--outdir <directory>] [--queue-depth <count>]\n\t[--stream] [--raw <width>x<height>x<channels>] [--planar] [--output <path>]\n\t[--png-level <0-9>] [--png-filter none|sub|up|average|paeth|adaptive]\n\t[--scale 1|1/2|1/4|1/8] [--roi <x>,<y>,<width>,<height>] [--layout interleaved|planar] [--skip-alpha] [--luma]\n\t[--affinity none|compact|scatter] [--first-touch] [--replicate]\n\t[--tune] [--tune-file <path>] [--counters] [--pyramid <levels>]\n   or: image --serve <socket path|-> [options]\n\twhere type is one of (edge,sharpen,blur,gauss,emboss,identity), @<kernel file>,\n\tor an odd square list of weights such as 1,2,1,2,4,2,1,2,1/16.\n\tSeveral types separated by commas (gauss,edge) are applied in order.\n\t--tile and --schedule only apply to the openmp backend, and --affinity, --first-touch and --replicate to the\n\topenmp and pthreads backends.  --counters reads cycles, instructions and cache misses with perf_event.\n");
+    return -1;
+}
+
+//ParseOptions: Fills an Options struct from the command line
+//Parameters: argc,argv: The arguments passed to main.  The first two positional arguments are the file name and kernel type,
+//            optionally followed by --report <json|csv>, --report-file <path>, --simd <scalar|sse4|avx2|neon|auto>,
+//            --border <clamp|mirror|wrap|constant>, --border-value <0-255>, --no-separable, --no-fuse,
+//            --method <auto|direct|separable|fft>, --backend <serial|openmp|pthreads|offload>, --tile <auto|WIDTHxHEIGHT>,
+//            --schedule <static|dynamic|guided>, --threads <count>, --outdir <directory>, --queue-depth <count>, --stream, --raw <WIDTHxHEIGHTxCHANNELS>,
+//            --planar, --output <path>, --png-level <0-9>, --png-filter <none|sub|up|average|paeth|adaptive>,
+//            --scale <1|1/2|1/4|1/8>, --roi <X,Y,WIDTH,HEIGHT>, --layout <interleaved|planar>, --skip-alpha, --luma,
+//            --affinity <none|compact|scatter>, --first-touch, --replicate, --tune, --tune-file <path>, --counters
+//            and --pyramid <levels>.
+//            image --serve <socket path|-> [options] starts the service instead, with the same options after the path.
+//            --simd, --method and the PNG and NUMA settings take effect immediately, since every convolute variant shares
+//            the row functions, planner, encoder and node layout.
+//            options: The struct to populate
+//Returns: 0 on success, or the result of Usage() if the arguments are malformed
+int ParseOptions(int argc,char** argv,Options* options){
+    int i;
+    memset(options,0,sizeof(Options));
+    if (argc<3) return Usage();
+    options->fileName=argv[1];
+    options->type=argv[2];
+    options->scale=1;
+    if (!strcmp(argv[1],"--serve")){
+        options->serve=argv[2];
+        options->fileName=argv[2];
+        options->type="identity";
+    }
+    for (i=3;i<argc;i++){
+        if (!strcmp(argv[i],"--report") && i+1<argc){
+            options->reportFormat=GetReportFormat(argv[++i]);
+            if (options->reportFormat==REPORT_NONE) return Usage();
+        }
+        else if (!strcmp(argv[i],"--report-file") && i+1<argc){
+            options->reportFile=argv[++i];
+            if (options->reportFormat==REPORT_NONE) options->reportFormat=REPORT_JSON;
+        }
+        else if (!strcmp(argv[i],"--simd") && i+1<argc){
+            options->simd=argv[++i];
+            if (setSimdLevel(options->simd)) return Usage();
+        }
+        else if (!strcmp(argv[i],"--border") && i+1<argc){
+            int border=GetBorderMode(argv[++i]);
+            if (border<0) return Usage();
+            options->border=(enum BorderModes)border;
+        }
+        else if (!strcmp(argv[i],"--border-value") && i+1<argc){
+            int value=atoi(argv[++i]);
+            if (value<0 || value>255) return Usage();
+            options->borderValue=(uint8_t)value;
+        }
+        else if (!strcmp(argv[i],"--no-separable")){
+            setSeparable(0);
+        }
+        else if (!strcmp(argv[i],"--tile") && i+1<argc){
+            char* size=argv[++i];
+            if (strcmp(size,"auto")){
+                if (sscanf(size,"%dx%d",&options->tileWidth,&options->tileHeight)!=2 || options->tileWidth<1 || options->tileHeight<1) return Usage();
+            }
+        }
+        else if (!strcmp(argv[i],"--schedule") && i+1<argc){
+            options->schedule=argv[++i];
+            if (strcmp(options->schedule,"static") && strcmp(options->schedule,"dynamic") && strcmp(options->schedule,"guided")) return Usage();
+        }
+        else if (!strcmp(argv[i],"--backend") && i+1<argc){
+            options->backend=argv[++i];
+            if (!GetBackend(options->backend)) return Usage();
+        }
+        else if (!strcmp(argv[i],"--threads") && i+1<argc){
+            options->threads=atoi(argv[++i]);
+            if (options->threads<1) return Usage();
+        }
+        else if (!strcmp(argv[i],"--outdir") && i+1<argc){
+            options->outDir=argv[++i];
+        }
+        else if (!strcmp(argv[i],"--queue-depth") && i+1<argc){
+            options->queueDepth=atoi(argv[++i]);
+            if (options->queueDepth<1) return Usage();
+        }
+        else if (!strcmp(argv[i],"--stream")){
+            options->stream=1;
+        }
+        else if (!strcmp(argv[i],"--raw") && i+1<argc){
+            if (sscanf(argv[++i],"%dx%dx%d",&options->rawWidth,&options->rawHeight,&options->rawBpp)!=3 ||
+                options->rawWidth<1 || options->rawHeight<1 || options->rawBpp<1 || options->rawBpp>4) return Usage();
+        }
+        else if (!strcmp(argv[i],"--planar")){
+            options->planar=1;
+        }
+        else if (!strcmp(argv[i],"--output") && i+1<argc){
+            options->output=argv[++i];
+        }
+        else if (!strcmp(argv[i],"--layout") && i+1<argc){
+            char* layout=argv[++i];
+            if (!strcmp(layout,"planar")) options->planarLayout=1;
+            else if (!strcmp(layout,"interleaved")) options->planarLayout=0;
+            else return Usage();
+        }
+        else if (!strcmp(argv[i],"--skip-alpha")){
+            options->skipAlpha=1;
+        }
+        else if (!strcmp(argv[i],"--luma")){
+            options->luma=1;
+        }
+        else if (!strcmp(argv[i],"--scale") && i+1<argc){
+            char* scale=argv[++i];
+            if (!strcmp(scale,"1")) options->scale=1;
+            else if (!strcmp(scale,"1/2")) options->scale=2;
+            else if (!strcmp(scale,"1/4")) options->scale=4;
+            else if (!strcmp(scale,"1/8")) options->scale=8;
+            else return Usage();
+        }
+        else if (!strcmp(argv[i],"--roi") && i+1<argc){
+            char extra;
+            if (sscanf(argv[++i],"%d,%d,%d,%d%c",&options->roiX,&options->roiY,&options->roiWidth,&options->roiHeight,&extra)!=4 ||
+                options->roiX<0 || options->roiY<0 || options->roiWidth<1 || options->roiHeight<1) return Usage();
+        }
+        else if (!strcmp(argv[i],"--png-level") && i+1<argc){
+            int level=atoi(argv[++i]);
+            if (level<0 || level>9 || !isdigit((unsigned char)argv[i][0])) return Usage();
+            setPngLevel(level);
+        }
+        else if (!strcmp(argv[i],"--png-filter") && i+1<argc){
+            int filter=GetPngFilter(argv[++i]);
+            if (filter<0) return Usage();
+            setPngFilter((enum PngFilters)filter);
+        }
+        else if (!strcmp(argv[i],"--affinity") && i+1<argc){
+            int affinity=GetAffinity(argv[++i]);
+            if (affinity<0) return Usage();
+            setAffinity((enum Affinities)affinity);
+        }
+        else if (!strcmp(argv[i],"--first-touch")){
+            setFirstTouch(1);
+        }
+        else if (!strcmp(argv[i],"--replicate")){
+            setReplication(1);
+        }
+        else if (!strcmp(argv[i],"--tune")){
+            options->tune=1;
+        }
+        else if (!strcmp(argv[i],"--tune-file") && i+1<argc){
+            options->tuneFile=argv[++i];
+        }
+        else if (!strcmp(argv[i],"--pyramid") && i+1<argc){
+            options->pyramid=atoi(argv[++i]);
+            if (options->pyramid<1 || options->pyramid>PYRAMID_MAX_LEVELS) return Usage();
+        }
+        else if (!strcmp(argv[i],"--counters")){
+            setCounters(1);
+        }
+        else if (!strcmp(argv[i],"--no-fuse")){
+            setChainFusion(0);
+        }
+        else if (!strcmp(argv[i],"--method") && i+1<argc){
+            int method=GetConvolutionMethod(argv[++i]);
+            if (method<METHOD_AUTO) return Usage();
+            setConvolutionMethod((enum ConvolutionMethods)method);
+        }
+        else return Usage();
+    }
+    return 0;
+}
@@ -0,0 +1,63 @@
+#ifndef ___OPTIONS
+#define ___OPTIONS
+#include "image.h"
+#include "timing.h"
+
+//Command line settings shared by every backend.  backend is the name given with --backend, or NULL for the build's
+//default.  tileWidth and tileHeight are 0 when the tile size should be autotuned, and like schedule are only used by the
+//OpenMP backend.  threads is 0 for one thread per online core.
+//outDir is where a batch writes its results, and a directory or @list needs one.  queueDepth is how many images may wait
+//between two stages of a batch, 0 for the default.  stream processes one strip of rows at a time, reading a headerless
+//file of rawWidth by rawHeight pixels of rawBpp channels when rawWidth is set.
+//planar raw files hold each channel as its own plane instead of interleaved.  output is where a single image is
+//written, output.png when NULL, and its extension picks the format.
+//scale is 1, 2, 4 or 8 to shrink the image by that much before convoluting it, and roiWidth is 0 unless only the
+//roiWidth by roiHeight rectangle at roiX,roiY of the (scaled) image is convoluted and written.
+//planarLayout splits interleaved images into one plane per channel while they are convoluted, and skipAlpha copies
+//the alpha channel of gray+alpha and RGBA images through instead of convoluting it.
+//luma converts color images to one channel of luma as they are loaded, so only that channel is convoluted and written.
+//tune times each backend and thread count on a single image before convoluting it and saves the fastest to tuneFile,
+//which later single image runs given none of --backend, --threads and --tile read their configuration from.  tuneFile
+//is image.tune when NULL.  --counters, which reads hardware counters around the convolution, takes effect immediately
+//and is not kept here.
+//serve is the socket path (or - for stdin and stdout) of --serve, which keeps the backend running and convolutes the
+//images sent to it until stopped, or NULL for a normal run.  pyramid is the number of levels of --pyramid, each
+//filtered and halved from the one before and written next to output, or 0 to write the convoluted image.
+typedef struct{
+    char* fileName;
+    char* type;
+    enum ReportFormats reportFormat;
+    char* reportFile;
+    char* simd;
+    enum BorderModes border;
+    uint8_t borderValue;
+    int tileWidth;
+    int tileHeight;
+    char* schedule;
+    char* backend;
+    int threads;
+    char* outDir;
+    int queueDepth;
+    int stream;
+    int rawWidth;
+    int rawHeight;
+    int rawBpp;
+    int planar;
+    char* output;
+    int scale;
+    int roiX;
+    int roiY;
+    int roiWidth;
+    int roiHeight;
+    int planarLayout;
+    int skipAlpha;
+    int tune;
+    char* tuneFile;
+    int luma;
+    char* serve;
+    int pyramid;
+} Options;
+
+int ParseOptions(int argc,char** argv,Options* options);
+
+#endif
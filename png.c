@@ -0,0 +1,555 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "image.h"
+#include "png.h"
+#include "buffers.h"
+
+//The deflate window, and the size of the table of 3 byte hashes that finds earlier matches in it
+#define WINDOW_SIZE 32768
+#define HASH_BITS 15
+
+static int pngLevel=PNG_DEFAULT_LEVEL;
+static enum PngFilters pngFilter=PNG_FILTER_ADAPTIVE;
+static PngRunner pngRunner=NULL;
+
+//How many earlier matches each level looks at, and the match length at which it stops looking
+static const int chainLengths[10]={0,4,8,16,32,64,128,256,512,1024};
+static const int niceLengths[10]={0,8,16,32,32,64,128,128,258,258};
+
+//The base value and number of extra bits of each deflate length code (257 to 285) and distance code (0 to 29)
+static const int lengthBase[29]={3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258};
+static const int lengthExtra[29]={0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0};
+static const int distanceBase[30]={1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,
+    8193,12289,16385,24577};
+static const int distanceExtra[30]={0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
+
+//Tables filled in by initTables: the fixed Huffman code of every literal/length symbol, stored bit reversed so it can
+//be written least significant bit first, the length code of every match length, and the distance code of every
+//distance (distances up to 256 directly, longer ones by (distance-1)>>7)
+static uint16_t literalCodes[288];
+static uint8_t literalLengths[288];
+static uint8_t lengthCodes[259];
+static uint8_t distanceCodes[512];
+static uint32_t crcTable[256];
+static int tablesReady=0;
+
+//setPngLevel: Sets the compression level of PNG output
+//Parameters: level: 0 to store the rows uncompressed, up to 9 for the smallest files
+//Returns: Nothing
+void setPngLevel(int level){
+    pngLevel=level<0?0:level>9?9:level;
+}
+
+//setPngFilter: Sets the row filter of PNG output, PNG_FILTER_ADAPTIVE to choose one per row
+void setPngFilter(enum PngFilters filter){
+    pngFilter=filter;
+}
+
+//setPngRunner: Sets how the blocks of a PNG are spread over threads, or NULL to compress them one after another
+void setPngRunner(PngRunner runner){
+    pngRunner=runner;
+}
+
+//GetPngFilter: Converts the name of a PNG filter into a value from the PngFilters enumeration
+//Parameters: name: none, sub, up, average, paeth or adaptive
+//Returns: The matching PngFilters entry, or -1 for anything else
+int GetPngFilter(char* name){
+    static const char* names[]={"none","sub","up","average","paeth","adaptive"};
+    int i;
+    for (i=0;i<6;i++)
+        if (!strcmp(name,names[i])) return i;
+    return -1;
+}
+
+//reverseBits: Reverses the lowest count bits of a Huffman code
+static uint16_t reverseBits(int code,int count){
+    int i,result=0;
+    for (i=0;i<count;i++) result|=((code>>i)&1)<<(count-1-i);
+    return result;
+}
+
+//initTables: Fills in the Huffman, length, distance and CRC tables.  Called before any block runs so worker threads
+//only ever read them.
+static void initTables(){
+    int i,code;
+    if (tablesReady) return;
+    for (i=0;i<288;i++){
+        if (i<144){ code=0x30+i; literalLengths[i]=8; }
+        else if (i<256){ code=0x190+i-144; literalLengths[i]=9; }
+        else if (i<280){ code=i-256; literalLengths[i]=7; }
+        else{ code=0xc0+i-280; literalLengths[i]=8; }
+        literalCodes[i]=reverseBits(code,literalLengths[i]);
+    }
+    for (code=0;code<29;code++)
+        for (i=lengthBase[code];i<(code<28?lengthBase[code+1]:259);i++) lengthCodes[i]=code;
+    for (code=0;code<30;code++)
+        for (i=distanceBase[code];i<(code<29?distanceBase[code+1]:32769);i++){
+            if (i<=256) distanceCodes[i-1]=code;
+            else distanceCodes[256+((i-1)>>7)]=code;
+        }
+    for (i=0;i<256;i++){
+        uint32_t c=i;
+        int k;
+        for (k=0;k<8;k++) c=c&1?0xedb88320u^(c>>1):c>>1;
+        crcTable[i]=c;
+    }
+    tablesReady=1;
+}
+
+//Bits waiting to be written to a deflate stream, least significant first
+typedef struct{
+    uint8_t* out;
+    size_t length;
+    uint64_t bits;
+    int count;
+} BitWriter;
+
+//putBits: Appends the lowest count bits of value (at most 32) to a deflate stream
+static void putBits(BitWriter* writer,uint32_t value,int count){
+    writer->bits|=(uint64_t)value<<writer->count;
+    writer->count+=count;
+    while (writer->count>=8){
+        writer->out[writer->length++]=(uint8_t)writer->bits;
+        writer->bits>>=8;
+        writer->count-=8;
+    }
+}
+
+//putMatch: Writes a length and distance pair with the fixed Huffman codes
+static void putMatch(BitWriter* writer,int length,int distance){
+    int code=lengthCodes[length];
+    putBits(writer,literalCodes[257+code],literalLengths[257+code]);
+    putBits(writer,length-lengthBase[code],lengthExtra[code]);
+    code=distance<=256?distanceCodes[distance-1]:distanceCodes[256+((distance-1)>>7)];
+    putBits(writer,reverseBits(code,5),5);
+    putBits(writer,distance-distanceBase[code],distanceExtra[code]);
+}
+
+//storeBlocks: Writes data as non-final stored deflate blocks of at most 65535 bytes
+//Returns: The number of bytes written to out, at most length+5*(length/65535+1)
+static size_t storeBlocks(const uint8_t* data,size_t length,uint8_t* out){
+    uint8_t* start=out;
+    do{
+        size_t size=length<65535?length:65535;
+        out[0]=0;
+        out[1]=size&0xff;
+        out[2]=size>>8;
+        out[3]=~size&0xff;
+        out[4]=(~size>>8)&0xff;
+        memcpy(out+5,data,size);
+        out+=5+size;
+        data+=size;
+        length-=size;
+    }while (length);
+    return out-start;
+}
+
+//deflateBlock: Compresses data as one non-final fixed Huffman deflate block, matching only within data, and ends it
+//with an empty stored block so the stream stops on a byte boundary
+//Parameters: data,length: The bytes to compress
+//            out: Room for at least length*9/8+16 bytes, the size of the worst case of all 9 bit literals
+//            level: 1 to 9, how hard to search for matches
+//Returns: The number of bytes written to out, or 0 if the match tables could not be allocated
+static size_t deflateBlock(const uint8_t* data,size_t length,uint8_t* out,int level){
+    BitWriter writer={out,0,0,0};
+    int32_t *head=takeBuffer(sizeof(int32_t)<<HASH_BITS),*previous=takeBuffer(sizeof(int32_t)*WINDOW_SIZE);
+    int32_t i=0;
+    if (!head || !previous){
+        giveBuffer(head);
+        giveBuffer(previous);
+        return 0;
+    }
+    memset(head,0xff,sizeof(int32_t)<<HASH_BITS);
+    putBits(&writer,0,1);
+    putBits(&writer,1,2);
+    while (i<(int32_t)length){
+        int best=0,distance=0;
+        if (i+3<=(int32_t)length){
+            int limit=length-i<258?length-i:258,tries=chainLengths[level];
+            uint32_t hash=((data[i]<<16|data[i+1]<<8|data[i+2])*2654435761u)>>(32-HASH_BITS);
+            int32_t candidate=head[hash];
+            while (candidate>=0 && i-candidate<=WINDOW_SIZE && tries--){
+                int32_t next;
+                if (data[candidate+best]==data[i+best]){
+                    int matched=0;
+                    while (matched<limit && data[candidate+matched]==data[i+matched]) matched++;
+                    if (matched>best){
+                        best=matched;
+                        distance=i-candidate;
+                        if (best>=niceLengths[level] || best==limit) break;
+                    }
+                }
+                next=previous[candidate&(WINDOW_SIZE-1)];
+                // a slot reused by a position a window later would send the chain forward, so stop there
+                if (next>=candidate) break;
+                candidate=next;
+            }
+            previous[i&(WINDOW_SIZE-1)]=head[hash];
+            head[hash]=i;
+        }
+        if (best>=3){
+            int32_t end=i+best;
+            putMatch(&writer,best,distance);
+            for (i++;i<end;i++){
+                if (i+3<=(int32_t)length){
+                    uint32_t hash=((data[i]<<16|data[i+1]<<8|data[i+2])*2654435761u)>>(32-HASH_BITS);
+                    previous[i&(WINDOW_SIZE-1)]=head[hash];
+                    head[hash]=i;
+                }
+            }
+        }
+        else{
+            putBits(&writer,literalCodes[data[i]],literalLengths[data[i]]);
+            i++;
+        }
+    }
+    putBits(&writer,literalCodes[256],literalLengths[256]);
+    // an empty stored block: its 3 bit header, padding to the next byte, then a length of 0 and its complement
+    putBits(&writer,0,3);
+    if (writer.count) putBits(&writer,0,8-writer.count);
+    putBits(&writer,0,16);
+    putBits(&writer,0xffff,16);
+    giveBuffer(head);
+    giveBuffer(previous);
+    return writer.length;
+}
+
+//paeth: The PNG Paeth predictor, whichever of left, up and up left is closest to left+up-upLeft
+static int paeth(int a,int b,int c){
+    int p=a+b-c,pa=abs(p-a),pb=abs(p-b),pc=abs(p-c);
+    if (pa<=pb && pa<=pc) return a;
+    return pb<=pc?b:c;
+}
+
+//filterRow: Applies one PNG filter to a row
+//Parameters: row: The row, span bytes
+//            previous: The row above, all zeros for the first row of the image
+//            span,bpp: The bytes in a row and in a pixel
+//            filter: PNG_FILTER_NONE to PNG_FILTER_PAETH
+//            out: Receives the filter type byte followed by span filtered bytes
+//Returns: Nothing
+static void filterRow(const uint8_t* row,const uint8_t* previous,int span,int bpp,int filter,uint8_t* out){
+    int i;
+    *out++=filter;
+    // each filter gets its own loop, with the first pixel (which has nothing to its left) split off, so they vectorize
+    switch (filter){
+        case PNG_FILTER_SUB:
+            for (i=0;i<bpp;i++) out[i]=row[i];
+            for (;i<span;i++) out[i]=row[i]-row[i-bpp];
+            break;
+        case PNG_FILTER_UP:
+            for (i=0;i<span;i++) out[i]=row[i]-previous[i];
+            break;
+        case PNG_FILTER_AVERAGE:
+            for (i=0;i<bpp;i++) out[i]=row[i]-(previous[i]>>1);
+            for (;i<span;i++) out[i]=row[i]-((row[i-bpp]+previous[i])>>1);
+            break;
+        case PNG_FILTER_PAETH:
+            for (i=0;i<bpp;i++) out[i]=row[i]-previous[i];
+            for (;i<span;i++) out[i]=row[i]-paeth(row[i-bpp],previous[i],previous[i-bpp]);
+            break;
+        default:
+            memcpy(out,row,span);
+    }
+}
+
+//filterCost: Returns the sum of the filtered bytes of a row taken as signed values, which is lower for rows that
+//compress better
+static long filterCost(const uint8_t* filtered,int span){
+    int i;
+    long sum=0;
+    for (i=0;i<span;i++) sum+=abs((int8_t)filtered[i]);
+    return sum;
+}
+
+//The rows of one writePngRows call, shared by the blocks compressing them
+typedef struct{
+    PngWriter* writer;
+    const uint8_t* rows;
+    size_t stride;
+    int count;
+    int blockRows;
+    uint8_t* filtered;
+    uint8_t** outputs;
+    size_t* outputLengths;
+} PngStrip;
+
+//compressBlock: Filters and deflates one block of a strip.  A failed block leaves its output NULL.
+static void compressBlock(void* argument,int block){
+    PngStrip* strip=argument;
+    PngWriter* writer=strip->writer;
+    int row,span=writer->width*writer->bpp,first=block*strip->blockRows;
+    int last=first+strip->blockRows<strip->count?first+strip->blockRows:strip->count;
+    uint8_t* filtered=strip->filtered+(size_t)first*(span+1);
+    size_t length=(size_t)(last-first)*(span+1);
+    uint8_t *scratch=NULL,*out;
+    if (pngFilter==PNG_FILTER_ADAPTIVE && !(scratch=malloc(span+1))) return;
+    for (row=first;row<last;row++){
+        const uint8_t* source=strip->rows+(size_t)row*strip->stride;
+        const uint8_t* previous=row?source-strip->stride:writer->previous;
+        uint8_t* destination=filtered+(size_t)(row-first)*(span+1);
+        if (pngFilter==PNG_FILTER_ADAPTIVE){
+            int filter;
+            long best;
+            filterRow(source,previous,span,writer->bpp,PNG_FILTER_NONE,destination);
+            best=filterCost(destination+1,span);
+            for (filter=PNG_FILTER_SUB;filter<=PNG_FILTER_PAETH;filter++){
+                long sum;
+                filterRow(source,previous,span,writer->bpp,filter,scratch);
+                sum=filterCost(scratch+1,span);
+                if (sum<best){
+                    best=sum;
+                    memcpy(destination,scratch,span+1);
+                }
+            }
+        }
+        else filterRow(source,previous,span,writer->bpp,pngFilter,destination);
+    }
+    free(scratch);
+    out=takeBuffer(pngLevel?length+length/8+16:length+5*(length/65535+1));
+    if (!out) return;
+    strip->outputLengths[block]=pngLevel?deflateBlock(filtered,length,out,pngLevel):storeBlocks(filtered,length,out);
+    if (!strip->outputLengths[block]){
+        giveBuffer(out);
+        return;
+    }
+    strip->outputs[block]=out;
+}
+
+//crc32Update: Continues a PNG CRC-32 over more bytes.  Start with 0xffffffff and invert the result.
+static uint32_t crc32Update(uint32_t crc,const uint8_t* data,size_t length){
+    size_t i;
+    for (i=0;i<length;i++) crc=crcTable[(crc^data[i])&0xff]^(crc>>8);
+    return crc;
+}
+
+//adler32Update: Continues the zlib Adler-32 checksum over more bytes.  Start with 1.
+static uint32_t adler32Update(uint32_t adler,const uint8_t* data,size_t length){
+    uint32_t a=adler&0xffff,b=adler>>16;
+    while (length){
+        // 5552 is the most bytes that can be summed before b could overflow 32 bits
+        size_t block=length<5552?length:5552,i;
+        for (i=0;i<block;i++){
+            a+=data[i];
+            b+=a;
+        }
+        a%=65521;
+        b%=65521;
+        data+=block;
+        length-=block;
+    }
+    return b<<16|a;
+}
+
+//putBigEndian: Stores a 32 bit value most significant byte first, the PNG byte order
+static void putBigEndian(uint8_t* out,uint32_t value){
+    out[0]=value>>24;
+    out[1]=value>>16;
+    out[2]=value>>8;
+    out[3]=value;
+}
+
+//writeChunk: Writes one PNG chunk whose data is split over several buffers: its length, type, data and CRC
+//Parameters: file: The PNG file
+//            type: The four letter chunk type
+//            parts,lengths: The buffers holding the chunk data, in order
+//            count: The number of buffers
+//Returns: 0 on success, -1 on a write error
+static int writeChunk(FILE* file,const char* type,const uint8_t** parts,const size_t* lengths,int count){
+    uint8_t header[8],footer[4];
+    uint32_t crc;
+    size_t length=0;
+    int i;
+    for (i=0;i<count;i++) length+=lengths[i];
+    putBigEndian(header,length);
+    memcpy(header+4,type,4);
+    crc=crc32Update(0xffffffffu,header+4,4);
+    if (fwrite(header,1,8,file)!=8) return -1;
+    for (i=0;i<count;i++){
+        crc=crc32Update(crc,parts[i],lengths[i]);
+        if (lengths[i] && fwrite(parts[i],1,lengths[i],file)!=lengths[i]) return -1;
+    }
+    putBigEndian(footer,crc^0xffffffffu);
+    return fwrite(footer,1,4,file)==4?0:-1;
+}
+
+//zlibHeader: Writes the two byte zlib stream header, with the level hint a decoder may show
+static void zlibHeader(uint8_t* out){
+    out[0]=0x78;
+    out[1]=pngLevel<2?0x01:pngLevel<6?0x5e:pngLevel==6?0x9c:0xda;
+}
+
+//openPngStream: Starts a PNG on an open stream and writes its header
+//Parameters: file: The stream, which the writer owns from now on and closePngWriter closes, even on failure
+//            width,height,bpp: The size of the image and its channels (1 gray, 2 gray and alpha, 3 RGB or 4 RGBA)
+//            writer: The PngWriter to populate.  Finish it with closePngWriter.
+//Returns: 0 on success, -1 if the header could not be written
+static int openPngStream(FILE* file,int width,int height,int bpp,PngWriter* writer){
+    static const uint8_t signature[8]={0x89,'P','N','G','\r','\n',0x1a,'\n'};
+    static const uint8_t colorTypes[5]={0,0,4,2,6};
+    uint8_t header[13];
+    const uint8_t* part=header;
+    size_t length=13;
+    memset(writer,0,sizeof(PngWriter));
+    if (bpp<1 || bpp>4){
+        fclose(file);
+        return -1;
+    }
+    initTables();
+    // the row above the first one counts as all zeros
+    writer->previous=calloc((size_t)width*bpp,1);
+    if (!writer->previous){
+        fclose(file);
+        return -1;
+    }
+    writer->file=file;
+    writer->width=width;
+    writer->height=height;
+    writer->bpp=bpp;
+    writer->adler=1;
+    putBigEndian(header,width);
+    putBigEndian(header+4,height);
+    header[8]=8;
+    header[9]=colorTypes[bpp];
+    header[10]=header[11]=header[12]=0;
+    if (fwrite(signature,1,8,writer->file)!=8 || writeChunk(writer->file,"IHDR",&part,&length,1)){
+        fclose(writer->file);
+        free(writer->previous);
+        writer->file=NULL;
+        return -1;
+    }
+    return 0;
+}
+
+//openPngWriter: Starts a PNG file and writes its header
+//Parameters: fileName: The file to create
+//            width,height,bpp: The size of the image and its channels (1 gray, 2 gray and alpha, 3 RGB or 4 RGBA)
+//            writer: The PngWriter to populate.  Finish it with closePngWriter.
+//Returns: 0 on success, -1 if the file could not be created
+int openPngWriter(char* fileName,int width,int height,int bpp,PngWriter* writer){
+    FILE* file=fopen(fileName,"wb");
+    if (!file){
+        memset(writer,0,sizeof(PngWriter));
+        return -1;
+    }
+    return openPngStream(file,width,height,bpp,writer);
+}
+
+//writePngRows: Filters, compresses and appends rows to a PNG as one IDAT chunk
+//The rows are cut into blocks of about PNG_BLOCK_BYTES, which are filtered and deflated independently, on the threads
+//of the runner from setPngRunner when there is one.
+//Parameters: writer: The writer from openPngWriter
+//            rows: count rows of width*bpp bytes each
+//            stride: The bytes from the start of one row to the next
+//            count: The number of rows
+//Returns: 0 on success, -1 on a write or allocation error
+int writePngRows(PngWriter* writer,uint8_t* rows,size_t stride,int count){
+    int i,result=0,span=writer->width*writer->bpp,parts;
+    int blockRows=PNG_BLOCK_BYTES/(span+1)>0?PNG_BLOCK_BYTES/(span+1):1,blocks=(count+blockRows-1)/blockRows;
+    uint8_t header[2];
+    const uint8_t** partData;
+    size_t* partLengths;
+    PngStrip strip={writer,rows,stride,count,blockRows,NULL,NULL,NULL};
+    if (count<=0) return 0;
+    strip.filtered=takeBuffer((size_t)count*(span+1));
+    strip.outputs=calloc(blocks,sizeof(uint8_t*));
+    strip.outputLengths=calloc(blocks,sizeof(size_t));
+    partData=malloc((blocks+1)*sizeof(uint8_t*));
+    partLengths=malloc((blocks+1)*sizeof(size_t));
+    if (strip.filtered && strip.outputs && strip.outputLengths && partData && partLengths){
+        if (pngRunner && blocks>1) pngRunner(compressBlock,&strip,blocks);
+        else for (i=0;i<blocks;i++) compressBlock(&strip,i);
+        parts=0;
+        if (!writer->rowsWritten){
+            zlibHeader(header);
+            partData[parts]=header;
+            partLengths[parts++]=2;
+        }
+        for (i=0;i<blocks;i++){
+            if (!strip.outputs[i]) result=-1;
+            partData[parts]=strip.outputs[i];
+            partLengths[parts++]=strip.outputLengths[i];
+        }
+        if (!result){
+            writer->adler=adler32Update(writer->adler,strip.filtered,(size_t)count*(span+1));
+            result=writeChunk(writer->file,"IDAT",partData,partLengths,parts);
+            memcpy(writer->previous,rows+(size_t)(count-1)*stride,span);
+            writer->rowsWritten+=count;
+        }
+    }
+    else result=-1;
+    if (strip.outputs)
+        for (i=0;i<blocks;i++) giveBuffer(strip.outputs[i]);
+    giveBuffer(strip.filtered);
+    free(strip.outputs);
+    free(strip.outputLengths);
+    free(partData);
+    free(partLengths);
+    return result;
+}
+
+//closePngWriter: Ends the deflate stream of a PNG, writes the trailer and closes the file
+//Returns: 0 on success, -1 if a write failed or fewer rows than the image height were written
+int closePngWriter(PngWriter* writer){
+    uint8_t tail[11],*out=tail;
+    const uint8_t* part=tail;
+    size_t length;
+    int result=writer->rowsWritten==writer->height?0:-1;
+    if (!writer->file) return -1;
+    if (!writer->rowsWritten){
+        zlibHeader(out);
+        out+=2;
+    }
+    // an empty final stored block, then the checksum of everything the blocks held
+    out[0]=1;
+    out[1]=out[2]=0;
+    out[3]=out[4]=0xff;
+    putBigEndian(out+5,writer->adler);
+    length=out+9-tail;
+    if (writeChunk(writer->file,"IDAT",&part,&length,1) || writeChunk(writer->file,"IEND",NULL,NULL,0)) result=-1;
+    if (fclose(writer->file)) result=-1;
+    writer->file=NULL;
+    free(writer->previous);
+    writer->previous=NULL;
+    return result;
+}
+
+//writeWholePng: Writes a whole image through a writer from openPngWriter or openPngStream, and closes it
+static int writeWholePng(Image* image,PngWriter* writer){
+    if (writePngRows(writer,image->data,image->stride,image->height)){
+        closePngWriter(writer);
+        return -1;
+    }
+    return closePngWriter(writer);
+}
+
+//encodePng: Compresses a whole image into a PNG in memory, with the level and filter from setPngLevel and setPngFilter
+//Parameters: image: The image to compress
+//            data: Receives the PNG, to be released with free
+//            length: Receives its length in bytes
+//Returns: 0 on success, -1 if memory could not be allocated
+int encodePng(Image* image,uint8_t** data,size_t* length){
+    PngWriter writer;
+    char* buffer=NULL;
+    FILE* file=open_memstream(&buffer,length);
+    *data=NULL;
+    if (!file) return -1;
+    // the stream only hands over its buffer once it is closed, which closePngWriter always does
+    if (openPngStream(file,image->width,image->height,image->bpp,&writer) || writeWholePng(image,&writer)){
+        free(buffer);
+        return -1;
+    }
+    *data=(uint8_t*)buffer;
+    return 0;
+}
+
+//writePng: Writes a whole image as a PNG with the level and filter from setPngLevel and setPngFilter
+//Parameters: fileName: The file to create
+//            image: The image to write
+//Returns: 0 on success, -1 if the file could not be written
+int writePng(char* fileName,Image* image){
+    PngWriter writer;
+    if (openPngWriter(fileName,image->width,image->height,image->bpp,&writer)) return -1;
+    return writeWholePng(image,&writer);
+}
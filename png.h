@@ -0,0 +1,48 @@
+#ifndef ___PNG
+#define ___PNG
+#include <stdio.h>
+#include <stdint.h>
+#include "image.h"
+
+//Roughly how many bytes of rows are filtered and deflated as one independent block.  Blocks are compressed in parallel
+//when a runner is set, and always cut at the same rows so the file does not depend on the number of threads.
+#define PNG_BLOCK_BYTES (256*1024)
+
+//The compression level used unless --png-level says otherwise: 0 stores the rows, 9 searches hardest for matches
+#define PNG_DEFAULT_LEVEL 6
+
+//The PNG row filters, and PNG_FILTER_ADAPTIVE to pick the one with the smallest sum of absolute differences per row
+enum PngFilters{PNG_FILTER_NONE=0,PNG_FILTER_SUB=1,PNG_FILTER_UP=2,PNG_FILTER_AVERAGE=3,PNG_FILTER_PAETH=4,PNG_FILTER_ADAPTIVE=5};
+
+//The work for one block of a parallel PNG write
+typedef void (*PngBlockFunction)(void* argument,int block);
+
+//Runs function(argument,block) for every block from 0 to blocks-1, in any order and on any threads, and returns once
+//all of them are done.  Each build supplies one that runs on its own worker threads.
+typedef void (*PngRunner)(PngBlockFunction function,void* argument,int blocks);
+
+//Writes a PNG one strip of rows at a time.  Each strip becomes one IDAT chunk holding its blocks' deflate streams, each
+//ending on a byte boundary with an empty stored block so they can simply be placed one after another.  Only the
+//current strip and the last row of the previous one (for the up, average and paeth filters) are held in memory.
+//previous starts out as zeros, which is what the filters take the row above the first one to be.
+typedef struct{
+    FILE* file;
+    int width;
+    int height;
+    int bpp;
+    int rowsWritten;
+    uint32_t adler;
+    uint8_t* previous;
+} PngWriter;
+
+void setPngLevel(int level);
+void setPngFilter(enum PngFilters filter);
+void setPngRunner(PngRunner runner);
+int GetPngFilter(char* name);
+int openPngWriter(char* fileName,int width,int height,int bpp,PngWriter* writer);
+int writePngRows(PngWriter* writer,uint8_t* rows,size_t stride,int count);
+int closePngWriter(PngWriter* writer);
+int writePng(char* fileName,Image* image);
+int encodePng(Image* image,uint8_t** data,size_t* length);
+
+#endif
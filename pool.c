@@ -0,0 +1,173 @@
+#include <stdlib.h>
+#include <pthread.h>
+#include "timing.h"
+#include "numa.h"
+#include "pool.h"
+
+//Arguments for one worker thread
+typedef struct{
+    ThreadPool* pool;
+    int index;
+} PoolWorker;
+
+//takeItem: Returns the next item for a worker, from its own deque if it has any left, otherwise stolen from another
+//Parameters: pool: The pool
+//            index: The worker asking
+//Returns: The item, or -1 when every deque is empty
+static int takeItem(ThreadPool* pool,int index){
+    int i,item=-1;
+    PoolDeque* deque=&pool->deques[index];
+    pthread_mutex_lock(&deque->lock);
+    if (deque->head<deque->tail) item=deque->head++;
+    pthread_mutex_unlock(&deque->lock);
+    // look at the other workers starting with the next one, so thieves spread out instead of all hitting worker 0
+    for (i=1;item<0 && i<pool->threads;i++){
+        deque=&pool->deques[(index+i)%pool->threads];
+        pthread_mutex_lock(&deque->lock);
+        if (deque->head<deque->tail) item=--deque->tail;
+        pthread_mutex_unlock(&deque->lock);
+        if (item>=0) pool->steals[index]++;
+    }
+    return item;
+}
+
+//poolWorker: The loop each pool thread runs.  It pins itself and reports its node, then waits for a new job, takes
+//items until none are left anywhere, and waits again.
+static void* poolWorker(void* argument){
+    PoolWorker* worker=argument;
+    ThreadPool* pool=worker->pool;
+    int item,index=worker->index,generation=0;
+    int node=pinThread(index);
+    free(worker);
+    pthread_mutex_lock(&pool->lock);
+    pool->nodes[index]=node;
+    pool->finished++;
+    pthread_cond_signal(&pool->done);
+    pthread_mutex_unlock(&pool->lock);
+    while (1){
+        int64_t busy=0;
+        int stopping;
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->stopping && pool->generation==generation) pthread_cond_wait(&pool->wake,&pool->lock);
+        generation=pool->generation;
+        stopping=pool->stopping;
+        pthread_mutex_unlock(&pool->lock);
+        if (stopping) break;
+        while ((item=takeItem(pool,index))>=0){
+            int64_t start=timingNow();
+            pool->function(pool->argument,item,index);
+            busy+=timingNow()-start;
+        }
+        pthread_mutex_lock(&pool->lock);
+        pool->jobBusyNs[index]=busy;
+        if (++pool->finished==pool->threads) pthread_cond_signal(&pool->done);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    return NULL;
+}
+
+//makeThreadPool: Starts a pool of worker threads
+//Parameters: threads: The number of workers
+//Returns: The new pool, or NULL if it could not be created.  Release it with freeThreadPool.
+ThreadPool* makeThreadPool(int threads){
+    int i;
+    ThreadPool* pool=calloc(1,sizeof(ThreadPool));
+    if (!pool) return NULL;
+    pool->workers=malloc(threads*sizeof(pthread_t));
+    pool->deques=calloc(threads,sizeof(PoolDeque));
+    pool->jobBusyNs=calloc(threads,sizeof(int64_t));
+    pool->busyNs=calloc(threads,sizeof(int64_t));
+    pool->idleNs=calloc(threads,sizeof(int64_t));
+    pool->steals=calloc(threads,sizeof(int));
+    pool->nodes=calloc(threads,sizeof(int));
+    pthread_mutex_init(&pool->jobLock,NULL);
+    pthread_mutex_init(&pool->lock,NULL);
+    pthread_cond_init(&pool->wake,NULL);
+    pthread_cond_init(&pool->done,NULL);
+    if (!pool->workers || !pool->deques || !pool->jobBusyNs || !pool->busyNs || !pool->idleNs || !pool->steals || !pool->nodes){
+        freeThreadPool(pool);
+        return NULL;
+    }
+    for (i=0;i<threads;i++) pthread_mutex_init(&pool->deques[i].lock,NULL);
+    for (i=0;i<threads;i++){
+        PoolWorker* worker=malloc(sizeof(PoolWorker));
+        if (!worker) break;
+        worker->pool=pool;
+        worker->index=i;
+        if (pthread_create(&pool->workers[i],NULL,poolWorker,worker)){
+            free(worker);
+            break;
+        }
+        pool->threads++;
+    }
+    if (!pool->threads){
+        freeThreadPool(pool);
+        return NULL;
+    }
+    // wait for every worker to be pinned, so nodes is filled in before the first job
+    pthread_mutex_lock(&pool->lock);
+    while (pool->finished<pool->threads) pthread_cond_wait(&pool->done,&pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+    return pool;
+}
+
+//poolRun: Runs function(argument,item,worker) for every item from 0 to items-1 on the pool's threads
+//Worker w starts with the items from items*w/threads up to items*(w+1)/threads, the same split as a static schedule,
+//and only steals once it has finished those.
+//Parameters: pool: The pool to run on
+//            function: The work for one item
+//            argument: Passed through to function
+//            items: The number of items
+//Returns: Nothing, once every item has finished.  A call made while another thread's job is running waits for it.
+void poolRun(ThreadPool* pool,PoolFunction function,void* argument,int items){
+    int i;
+    int64_t elapsed;
+    if (items<=0) return;
+    pthread_mutex_lock(&pool->jobLock);
+    pthread_mutex_lock(&pool->lock);
+    for (i=0;i<pool->threads;i++){
+        pthread_mutex_lock(&pool->deques[i].lock);
+        pool->deques[i].head=(int)((int64_t)items*i/pool->threads);
+        pool->deques[i].tail=(int)((int64_t)items*(i+1)/pool->threads);
+        pthread_mutex_unlock(&pool->deques[i].lock);
+    }
+    pool->function=function;
+    pool->argument=argument;
+    pool->finished=0;
+    pool->started=timingNow();
+    pool->generation++;
+    pthread_cond_broadcast(&pool->wake);
+    while (pool->finished<pool->threads) pthread_cond_wait(&pool->done,&pool->lock);
+    elapsed=timingNow()-pool->started;
+    for (i=0;i<pool->threads;i++){
+        pool->busyNs[i]+=pool->jobBusyNs[i];
+        pool->idleNs[i]+=elapsed-pool->jobBusyNs[i];
+    }
+    pthread_mutex_unlock(&pool->lock);
+    pthread_mutex_unlock(&pool->jobLock);
+}
+
+//freeThreadPool: Stops and joins the workers of a pool and releases it.  NULL is ignored.
+void freeThreadPool(ThreadPool* pool){
+    int i;
+    if (!pool) return;
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping=1;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    for (i=0;i<pool->threads;i++) pthread_join(pool->workers[i],NULL);
+    if (pool->deques)
+        for (i=0;i<pool->threads;i++) pthread_mutex_destroy(&pool->deques[i].lock);
+    pthread_mutex_destroy(&pool->jobLock);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->wake);
+    pthread_cond_destroy(&pool->done);
+    free(pool->workers);
+    free(pool->deques);
+    free(pool->jobBusyNs);
+    free(pool->busyNs);
+    free(pool->idleNs);
+    free(pool->steals);
+    free(pool->nodes);
+    free(pool);
+}
@@ -0,0 +1,48 @@
+#ifndef ___POOL
+#define ___POOL
+#include <stdint.h>
+#include <pthread.h>
+
+//The work done for one item of a poolRun call.  worker is the index of the pool thread running it, from 0 to threads-1.
+typedef void (*PoolFunction)(void* argument,int item,int worker);
+
+//The items of the current job still queued for one worker, items head to tail-1.  The owner takes items from the head
+//in order, and workers that run out steal from the tail, the items furthest from where the owner is working.
+typedef struct{
+    pthread_mutex_t lock;
+    int head;
+    int tail;
+} PoolDeque;
+
+//A fixed set of worker threads that sleep between jobs.  One job runs at a time: poolRun splits the items of a job into
+//one contiguous run per worker and returns once every worker has run out of its own items and found nothing to steal.
+//poolRun calls from several threads run one after another, holding jobLock.
+//busyNs, idleNs and steals accumulate for each worker over every job since the pool was made: the time spent running
+//items, the rest of each job's wall time, and the number of items taken from other workers.
+//Each worker pins itself with pinThread as it starts, and nodes holds the NUMA node it ended up on.
+typedef struct{
+    int threads;
+    pthread_t* workers;
+    PoolDeque* deques;
+    pthread_mutex_t jobLock;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    int generation;
+    int stopping;
+    int finished;
+    PoolFunction function;
+    void* argument;
+    int64_t started;
+    int64_t* jobBusyNs;
+    int64_t* busyNs;
+    int64_t* idleNs;
+    int* steals;
+    int* nodes;
+} ThreadPool;
+
+ThreadPool* makeThreadPool(int threads);
+void poolRun(ThreadPool* pool,PoolFunction function,void* argument,int items);
+void freeThreadPool(ThreadPool* pool);
+
+#endif
@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "image.h"
+#include "options.h"
+#include "timing.h"
+#include "convolve.h"
+#include "imageio.h"
+#include "png.h"
+#include "buffers.h"
+#include "backend.h"
+#include "pyramid.h"
+
+//One level of the pyramid for the backend's threads to compute, a band of PYRAMID_BAND_ROWS output rows per block
+typedef struct{
+    Image* srcImage;
+    Image* destImage;
+    Kernel* kernel;
+    FixedKernel fixed;
+    int isFixed;
+    enum BorderModes border;
+    uint8_t borderValue;
+    int skipAlpha;
+    uint8_t* constantRow;
+    int failed;
+} LevelJob;
+
+//levelRow: Returns the source row for y, remapped by the border mode when it falls outside the image
+static const uint8_t* levelRow(LevelJob* job,int y){
+    y=borderIndex(y,job->srcImage->height,job->border);
+    return y<0?job->constantRow:job->srcImage->data+(size_t)y*job->srcImage->stride;
+}
+
+//decimatedHorizontal: Computes the horizontal taps of a separable kernel at the even columns of one source row, the ones
+//that survive decimation.  The interior goes through the vectorized horizontal function a whole row at a time, which
+//even with every other sum dropped beats a strided scalar loop several times over, and only the even columns near
+//the edges are remapped by the border mode.
+//Parameters: job: The level
+//            row: The source row
+//            dense: Scratch for the sums of the whole row, srcImage->width pixels
+//            out: Receives destImage->width pixels of sums
+static void decimatedHorizontal(LevelJob* job,const uint8_t* row,int16_t* dense,int16_t* out){
+    int x,c,bit,width=job->srcImage->width,bpp=job->srcImage->bpp;
+    int size=job->fixed.size,radius=job->fixed.size/2;
+    const int16_t* taps=job->fixed.horizontal;
+    if (width-radius>radius) job->fixed.horizontalFunction(row+radius*bpp,dense+radius*bpp,(width-2*radius)*bpp,bpp,taps,size);
+    for (x=(radius+1)/2;2*x<width-radius;x++){
+        const int16_t* in=dense+2*x*bpp;
+        int16_t* pixel=out+x*bpp;
+        switch (bpp){
+            case 4: pixel[3]=in[3]; // fall through
+            case 3: pixel[2]=in[2]; // fall through
+            case 2: pixel[1]=in[1]; // fall through
+            default: pixel[0]=in[0];
+        }
+    }
+    // the even columns within radius of either edge, the ones the compaction above skipped
+    for (x=0;x<job->destImage->width;x++){
+        int center=2*x;
+        if (center>=radius && center<width-radius) x=(width-radius+1)/2;
+        if (x>=job->destImage->width) break;
+        center=2*x;
+        for (bit=0;bit<bpp;bit++){
+            int sum=0;
+            for (c=0;c<size;c++){
+                int column=borderIndex(center+c-radius,width,job->border);
+                sum+=taps[c]*(column<0?job->borderValue:row[column*bpp+bit]);
+            }
+            out[x*bpp+bit]=(int16_t)sum;
+        }
+    }
+}
+
+//reduceBandSeparable: Computes output rows startRow to endRow-1 of a level with a rank one integer kernel
+//Each source row the band reaches is run through the horizontal taps once, keeping the even columns, into a rolling
+//buffer of size rows, and each output row combines the buffered rows around its even source row with the vertical row
+//function.  The integer sums are those convolute computes for the same pixels.
+//Returns: 0 on success, -1 if memory could not be allocated
+static int reduceBandSeparable(LevelJob* job,int startRow,int endRow){
+    int row,r,next,size=job->fixed.size,radius=job->fixed.size/2;
+    size_t span=(size_t)job->destImage->width*job->srcImage->bpp;
+    int16_t* buffer=malloc((size*span+(size_t)job->srcImage->width*job->srcImage->bpp)*sizeof(int16_t));
+    const int16_t** rows=malloc(size*sizeof(int16_t*));
+    int16_t* dense=buffer+size*span;
+    if (!buffer || !rows){
+        free(buffer);
+        free(rows);
+        return -1;
+    }
+    // buffer row (y-first)%size holds the horizontal pass of source row y, where first is the band's first source row
+    next=2*startRow-radius;
+    for (row=startRow;row<endRow;row++){
+        int first=2*startRow-radius,top=2*row-radius;
+        if (next<top) next=top;
+        for (;next<=2*row+radius;next++) decimatedHorizontal(job,levelRow(job,next),dense,buffer+((next-first)%size)*span);
+        for (r=0;r<size;r++) rows[r]=buffer+((top+r-first)%size)*span;
+        job->fixed.verticalFunction(rows,job->destImage->data+(size_t)row*job->destImage->stride,(int)span,job->fixed.vertical,size,&job->fixed.simd);
+    }
+    free(rows);
+    free(buffer);
+    return 0;
+}
+
+//reduceBandDirect: Computes output rows startRow to endRow-1 of a level with all size*size taps at each even pixel, for
+//kernels that are not rank one or have no integer form
+static void reduceBandDirect(LevelJob* job,int startRow,int endRow){
+    int row,x,r,c,bit,width=job->srcImage->width,bpp=job->srcImage->bpp;
+    int size=job->kernel->size,radius=job->kernel->size/2;
+    for (row=startRow;row<endRow;row++){
+        uint8_t* out=job->destImage->data+(size_t)row*job->destImage->stride;
+        for (x=0;x<job->destImage->width;x++)
+            for (bit=0;bit<bpp;bit++){
+                int32_t sum=0;
+                double result=0;
+                for (r=0;r<size;r++){
+                    const uint8_t* source=levelRow(job,2*row+r-radius);
+                    for (c=0;c<size;c++){
+                        int column=borderIndex(2*x+c-radius,width,job->border);
+                        int value=column<0?job->borderValue:source[column*bpp+bit];
+                        if (job->isFixed) sum+=job->fixed.weights[r*size+c]*value;
+                        else result+=job->kernel->weights[r*size+c]*value;
+                    }
+                }
+                if (job->isFixed) out[x*bpp+bit]=fixedDivide(sum,&job->fixed);
+                else out[x*bpp+bit]=result>255?255:result<0?0:(uint8_t)result;
+            }
+    }
+}
+
+//reduceBand: Computes one band of output rows of a level on a backend thread, as a PngBlockFunction, and with
+//--skip-alpha copies the alpha of each surviving source pixel through
+static void reduceBand(void* argument,int block){
+    LevelJob* job=argument;
+    int row,x,bpp=job->srcImage->bpp;
+    int startRow=block*PYRAMID_BAND_ROWS;
+    int endRow=startRow+PYRAMID_BAND_ROWS<job->destImage->height?startRow+PYRAMID_BAND_ROWS:job->destImage->height;
+    if (job->isFixed && job->fixed.separable){
+        if (reduceBandSeparable(job,startRow,endRow)) job->failed=1;
+    }
+    else reduceBandDirect(job,startRow,endRow);
+    if (!job->skipAlpha || (bpp!=2 && bpp!=4)) return;
+    for (row=startRow;row<endRow;row++){
+        const uint8_t* in=job->srcImage->data+(size_t)2*row*job->srcImage->stride;
+        uint8_t* out=job->destImage->data+(size_t)row*job->destImage->stride;
+        for (x=0;x<job->destImage->width;x++) out[x*bpp+bpp-1]=in[2*x*bpp+bpp-1];
+    }
+}
+
+//reduceLevel: Computes the next level of a pyramid in one pass: the kernel's output at every other row and column,
+//without computing the pixels decimation would throw away.  Each output pixel equals the direct convolution with the
+//same kernel and border at twice its coordinates.  Bands of rows are shared out over the threads of the
+//backend's block runner, the one the PNG encoder uses.
+//Parameters: srcImage: The level to reduce
+//            destImage: Receives the next level, (width+1)/2 by (height+1)/2 pixels, whose data is already allocated
+//            kernel: The low pass kernel, normally gauss
+//            border,borderValue: How pixels past the edge of the level are filled in
+//            skipAlpha: 1 to decimate the alpha channel of gray+alpha and RGBA images without filtering it
+//Returns: 0 on success, -1 if memory could not be allocated
+int reduceLevel(Image* srcImage,Image* destImage,Kernel* kernel,enum BorderModes border,uint8_t borderValue,int skipAlpha){
+    LevelJob job;
+    PngRunner runner=getBackend()->pngRunner;
+    int i,blocks=(destImage->height+PYRAMID_BAND_ROWS-1)/PYRAMID_BAND_ROWS;
+    memset(&job,0,sizeof(LevelJob));
+    job.srcImage=srcImage;
+    job.destImage=destImage;
+    job.kernel=kernel;
+    job.border=border;
+    job.borderValue=borderValue;
+    job.skipAlpha=skipAlpha;
+    job.isFixed=!makeFixedKernel(kernel,&job.fixed);
+    if (border==BORDER_CONSTANT){
+        job.constantRow=malloc((size_t)srcImage->width*srcImage->bpp);
+        if (!job.constantRow){
+            if (job.isFixed) freeFixedKernel(&job.fixed);
+            return -1;
+        }
+        memset(job.constantRow,borderValue,(size_t)srcImage->width*srcImage->bpp);
+    }
+    if (runner) runner(reduceBand,&job,blocks);
+    else for (i=0;i<blocks;i++) reduceBand(&job,i);
+    if (job.isFixed) freeFixedKernel(&job.fixed);
+    free(job.constantRow);
+    return job.failed?-1:0;
+}
+
+//GetLevelPath: Names the file a level of the pyramid is written to
+//Parameters: outPath: The --output path, or output.png
+//            level: The level, 1 for the first reduced one
+//Returns: outPath with -<level> before its extension, such as output-1.png.  Release it with free.
+char* GetLevelPath(char* outPath,int level){
+    const char* slash=strrchr(outPath,'/');
+    const char* dot=strrchr(outPath,'.');
+    int length=dot && dot>(slash?slash+1:outPath)?(int)(dot-outPath):(int)strlen(outPath);
+    char* path=malloc(strlen(outPath)+16);
+    if (path) sprintf(path,"%.*s-%d%s",length,outPath,level,outPath+length);
+    return path;
+}
+
+//runPyramid: Writes --pyramid levels of an image from a single decode.  Each level is reduced from the one before it
+//with reduceLevel and written once the next has been computed from it, so at most two levels are held at a time and
+//every level after the source costs a quarter of the one before.  Mapped PPM/PGM and raw outputs are reduced straight
+//into the output file.  The pyramid stops early once a level is a single pixel.
+//Parameters: srcImage,srcFile: The decoded image from openImage and reduceImage, released here.  It is a whole interleaved
+//                              image, since runImage rejects planar layouts, --roi and --scale.
+//            options: The parsed command line, for pyramid, output, border, borderValue and skipAlpha
+//            chain: The kernels, a single low pass kernel such as gauss, of which only the first is used
+//            timing: Receives the size of the source and the time spent reducing and writing every level
+//Returns: 0 on success, -1 on failure
+int runPyramid(Image* srcImage,ImageFile* srcFile,Options* options,KernelChain* chain,Timing* timing){
+    char* outPath=options->output?options->output:"output.png";
+    char* paths[PYRAMID_MAX_LEVELS+1]={NULL};
+    Image levels[2];
+    ImageFile files[2];
+    int level,result=0;
+    int64_t t;
+    timing->width=srcImage->width;
+    timing->height=srcImage->height;
+    timing->bpp=srcImage->bpp;
+    levels[0]=*srcImage;
+    files[0]=*srcFile;
+    for (level=1;level<=options->pyramid && !result;level++){
+        Image* src=&levels[(level-1)%2];
+        Image* dest=&levels[level%2];
+        ImageFile* srcLevelFile=&files[(level-1)%2];
+        ImageFile* destFile=&files[level%2];
+        if (src->width==1 && src->height==1) break;
+        paths[level]=GetLevelPath(outPath,level);
+        dest->width=(src->width+1)/2;
+        dest->height=(src->height+1)/2;
+        dest->bpp=src->bpp;
+        t=timingNow();
+        if (!paths[level] || createImage(paths[level],options,dest,destFile) || !dest->data){
+            printf("Error creating output image %s.\n",paths[level]?paths[level]:outPath);
+            result=-1;
+            break;
+        }
+        timing->allocNs+=timingNow()-t;
+        t=timingNow();
+        if (reduceLevel(src,dest,&chain->kernels[0],options->border,options->borderValue,options->skipAlpha)){
+            printf("Error allocating memory for level %d.\n",level);
+            result=-1;
+        }
+        timing->convoluteNs+=timingNow()-t;
+        t=timingNow();
+        if (closeImage(src,srcLevelFile) && level>1){
+            printf("Error writing file %s.\n",paths[level-1]);
+            result=-1;
+        }
+        timing->encodeNs+=timingNow()-t;
+    }
+    t=timingNow();
+    level--;
+    if (closeImage(&levels[level%2],&files[level%2]) && level>0){
+        printf("Error writing file %s.\n",paths[level]);
+        result=-1;
+    }
+    timing->encodeNs+=timingNow()-t;
+    for (level=0;level<=PYRAMID_MAX_LEVELS;level++) free(paths[level]);
+    return result;
+}
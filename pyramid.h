@@ -0,0 +1,18 @@
+#ifndef ___PYRAMID
+#define ___PYRAMID
+#include "image.h"
+#include "options.h"
+#include "timing.h"
+#include "imageio.h"
+
+//The most levels --pyramid writes.  Each halves the image, so 16 takes any image this program reads down to a pixel.
+#define PYRAMID_MAX_LEVELS 16
+
+//How many output rows of a level each block of the backend's runner computes
+#define PYRAMID_BAND_ROWS 32
+
+int reduceLevel(Image* srcImage,Image* destImage,Kernel* kernel,enum BorderModes border,uint8_t borderValue,int skipAlpha);
+char* GetLevelPath(char* outPath,int level);
+int runPyramid(Image* srcImage,ImageFile* srcFile,Options* options,KernelChain* chain,Timing* timing);
+
+#endif
@@ -0,0 +1,175 @@
+#include <stdlib.h>
+#include <sched.h>
+#include "timing.h"
+#include "queue.h"
+
+//makeSpscQueue: Prepares an empty queue
+//Parameters: queue: The queue to initialize
+//            capacity: The most items the queue holds before spscPush waits
+//Returns: 0 on success, -1 if the slots could not be allocated
+int makeSpscQueue(SpscQueue* queue,int capacity){
+    queue->slots=malloc(capacity*sizeof(void*));
+    if (!queue->slots) return -1;
+    if (pthread_mutex_init(&queue->lock,NULL)){
+        free(queue->slots);
+        return -1;
+    }
+    if (pthread_cond_init(&queue->changed,NULL)){
+        pthread_mutex_destroy(&queue->lock);
+        free(queue->slots);
+        return -1;
+    }
+    queue->capacity=capacity;
+    atomic_init(&queue->head,0);
+    atomic_init(&queue->tail,0);
+    atomic_init(&queue->closed,0);
+    atomic_init(&queue->waiters,0);
+    queue->pushes=0;
+    queue->depthSum=0;
+    queue->maxDepth=0;
+    queue->blockedNs=0;
+    queue->starvedNs=0;
+    return 0;
+}
+
+//freeSpscQueue: Releases the slots of a queue.  Items still queued are not freed.
+void freeSpscQueue(SpscQueue* queue){
+    free(queue->slots);
+    queue->slots=NULL;
+    pthread_cond_destroy(&queue->changed);
+    pthread_mutex_destroy(&queue->lock);
+}
+
+//wakeWaiters: Wakes the other side if it is asleep, after this side has published a change to head, tail or closed.
+//The fence orders that store before the load of waiters, pairing with the one in waitFor: either the sleeper sees the
+//change when it looks again, or this side sees it waiting and signals under the lock it holds until it sleeps.
+static void wakeWaiters(SpscQueue* queue){
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!atomic_load_explicit(&queue->waiters,memory_order_relaxed)) return;
+    pthread_mutex_lock(&queue->lock);
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+//waitFor: Waits until ready(queue) returns 1, yielding for the first SPSC_SPINS tries and then sleeping until the other
+//side changes the queue
+//Parameters: queue: The queue
+//            ready: Checks whether the caller can go on
+//            spins: How many tries the caller has made so far, updated
+static void waitFor(SpscQueue* queue,int (*ready)(SpscQueue*),int* spins){
+    if (++*spins<=SPSC_SPINS){
+        sched_yield();
+        return;
+    }
+    pthread_mutex_lock(&queue->lock);
+    atomic_fetch_add_explicit(&queue->waiters,1,memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!ready(queue)) pthread_cond_wait(&queue->changed,&queue->lock);
+    atomic_fetch_sub_explicit(&queue->waiters,1,memory_order_relaxed);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+//isFull: Returns 1 if the producer has to wait before pushing.  Only the consumer empties the queue, so once this
+//returns 0 the next push is sure to succeed.
+static int isFull(SpscQueue* queue){
+    unsigned tail=atomic_load_explicit(&queue->tail,memory_order_relaxed);
+    return tail-atomic_load_explicit(&queue->head,memory_order_acquire)>=(unsigned)queue->capacity;
+}
+
+//hasRoom: Returns 1 once the producer can push, for waitFor
+static int hasRoom(SpscQueue* queue){
+    return !isFull(queue);
+}
+
+//hasItem: Returns 1 once the consumer has something to do: an item to pop, or a closed queue, for waitFor
+static int hasItem(SpscQueue* queue){
+    return atomic_load_explicit(&queue->head,memory_order_relaxed)!=atomic_load_explicit(&queue->tail,memory_order_acquire) ||
+        atomic_load_explicit(&queue->closed,memory_order_acquire);
+}
+
+//spscTryPush: Adds an item to the back of the queue if there is room.  Only the producer thread may call this.
+//Parameters: queue: The queue
+//            item: The item to add
+//            depth: Set to the number of items queued including the new one, or NULL.  It is written before the item
+//                   is handed over, so it may point into the item.
+//Returns: 1 if the item was added, 0 if the queue was full
+int spscTryPush(SpscQueue* queue,void* item,int* depth){
+    unsigned tail=atomic_load_explicit(&queue->tail,memory_order_relaxed);
+    unsigned head=atomic_load_explicit(&queue->head,memory_order_acquire);
+    int queued=tail+1-head;
+    if (tail-head>=(unsigned)queue->capacity) return 0;
+    queue->pushes++;
+    queue->depthSum+=queued;
+    if (queued>queue->maxDepth) queue->maxDepth=queued;
+    if (depth) *depth=queued;
+    queue->slots[tail%queue->capacity]=item;
+    atomic_store_explicit(&queue->tail,tail+1,memory_order_release);
+    wakeWaiters(queue);
+    return 1;
+}
+
+//spscPush: Adds an item to the back of the queue, waiting while it is full.  Only the producer thread may call this.
+//Parameters: queue: The queue
+//            item: The item to add
+//            blockedNs: Incremented by the time spent waiting for room, or NULL
+//            depth: Set to the number of items queued including the new one (how far the consumer is behind), or NULL
+//            Both are written before the item is handed over, so they may point into the item.
+//Returns: Nothing
+void spscPush(SpscQueue* queue,void* item,int64_t* blockedNs,int* depth){
+    int64_t start=0,waited;
+    int spins=0;
+    while (isFull(queue)){
+        if (!start) start=timingNow();
+        waitFor(queue,hasRoom,&spins);
+    }
+    if (start){
+        waited=timingNow()-start;
+        queue->blockedNs+=waited;
+        if (blockedNs) *blockedNs+=waited;
+    }
+    spscTryPush(queue,item,depth);
+}
+
+//spscTryPop: Removes the item at the front of the queue if there is one.  Only the consumer thread may call this.
+//Returns: The item, or NULL if the queue is empty
+void* spscTryPop(SpscQueue* queue){
+    unsigned head=atomic_load_explicit(&queue->head,memory_order_relaxed);
+    unsigned tail=atomic_load_explicit(&queue->tail,memory_order_acquire);
+    void* item;
+    if (head==tail) return NULL;
+    item=queue->slots[head%queue->capacity];
+    atomic_store_explicit(&queue->head,head+1,memory_order_release);
+    wakeWaiters(queue);
+    return item;
+}
+
+//spscPop: Removes the item at the front of the queue, waiting while it is empty.  Only the consumer thread may call this.
+//Parameters: queue: The queue
+//            starvedNs: Incremented by the time spent waiting for an item, or NULL
+//Returns: The item, or NULL once the queue is empty and the producer has called spscClose
+void* spscPop(SpscQueue* queue,int64_t* starvedNs){
+    int64_t start=0,waited;
+    int spins=0;
+    void* item;
+    while (!(item=spscTryPop(queue))){
+        // check closed before looking again so an item pushed just before spscClose is not lost
+        if (atomic_load_explicit(&queue->closed,memory_order_acquire)){
+            item=spscTryPop(queue);
+            break;
+        }
+        if (!start) start=timingNow();
+        waitFor(queue,hasItem,&spins);
+    }
+    if (start){
+        waited=timingNow()-start;
+        queue->starvedNs+=waited;
+        if (starvedNs) *starvedNs+=waited;
+    }
+    return item;
+}
+
+//spscClose: Tells the consumer no more items are coming.  Only the producer thread may call this, after its last push.
+void spscClose(SpscQueue* queue){
+    atomic_store_explicit(&queue->closed,1,memory_order_release);
+    wakeWaiters(queue);
+}
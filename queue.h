@@ -0,0 +1,41 @@
+#ifndef ___QUEUE
+#define ___QUEUE
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+//How many times a full or empty queue makes the caller yield before it sleeps until the other side signals
+#define SPSC_SPINS 64
+
+//A bounded queue of pointers between exactly one producer thread and one consumer thread.  Only the producer writes tail
+//and only the consumer writes head, so no lock is needed: each side publishes its index with a release store after
+//touching the slots.  A full or empty queue makes the caller yield SPSC_SPINS times and then sleep on changed, so a long
+//convolute or encode on the other side does not keep a core busy.  waiters counts the sleepers, and each side only
+//takes lock to wake them when it is not 0, so the lock stays off the path of a queue that is keeping up.
+//The statistics are written only by the side that owns them: pushes, depthSum, maxDepth and blockedNs by the producer,
+//starvedNs by the consumer.
+typedef struct{
+    void** slots;
+    int capacity;
+    atomic_uint head;
+    atomic_uint tail;
+    atomic_int closed;
+    atomic_int waiters;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    int pushes;
+    int64_t depthSum;
+    int maxDepth;
+    int64_t blockedNs;
+    int64_t starvedNs;
+} SpscQueue;
+
+int makeSpscQueue(SpscQueue* queue,int capacity);
+void freeSpscQueue(SpscQueue* queue);
+void spscPush(SpscQueue* queue,void* item,int64_t* blockedNs,int* depth);
+void* spscPop(SpscQueue* queue,int64_t* starvedNs);
+int spscTryPush(SpscQueue* queue,void* item,int* depth);
+void* spscTryPop(SpscQueue* queue);
+void spscClose(SpscQueue* queue);
+
+#endif
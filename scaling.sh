@@ -0,0 +1,51 @@
+#!/bin/sh
+# Strong and weak scaling of image-mpi.
+# Strong scaling convolutes one WIDTHxHEIGHT image on 1, 2, 4, ... up to MAX_RANKS ranks, and weak scaling gives each
+# rank its own WIDTHxHEIGHT share, so the image grows with the ranks.  Both read and write raw files, so every rank
+# writes its band in parallel.  Each run adds a line to $OUT.strong or $OUT.weak, the --report csv output, and a table
+# of both ends up in $OUT.  Once the exchange time rivals the convolute time the interconnect has started to dominate.
+# Settings come from the environment: MPIRUN (for example srun under SLURM), MAX_RANKS, WIDTH, HEIGHT, KERNEL,
+# THREADS (per rank), SCRATCH (a directory every rank can see) and OUT.
+MPIRUN=${MPIRUN:-mpirun}
+MAX_RANKS=${MAX_RANKS:-4}
+WIDTH=${WIDTH:-4096}
+HEIGHT=${HEIGHT:-2048}
+KERNEL=${KERNEL:-edge}
+THREADS=${THREADS:-1}
+SCRATCH=${SCRATCH:-/tmp}
+OUT=${OUT:-scaling.csv}
+
+# makeImage <height> <file>: writes a raw RGB image of random pixels
+makeImage(){
+    [ -f "$2" ] || head -c $((WIDTH*$1*3)) /dev/urandom > "$2"
+}
+
+# run <mode> <ranks> <height> <file>
+run(){
+    $MPIRUN -n $2 ./image-mpi "$4" "$KERNEL" --raw ${WIDTH}x$3x3 --threads $THREADS --output "$SCRATCH/scaling_out.raw" \
+        --report csv --report-file "$OUT.$1" > /dev/null || exit 1
+}
+
+rm -f "$OUT" "$OUT.strong" "$OUT.weak"
+makeImage $HEIGHT "$SCRATCH/scaling_$HEIGHT.raw"
+ranks=1
+while [ $ranks -le $MAX_RANKS ]; do
+    run strong $ranks $HEIGHT "$SCRATCH/scaling_$HEIGHT.raw"
+    makeImage $((HEIGHT*ranks)) "$SCRATCH/scaling_$((HEIGHT*ranks)).raw"
+    run weak $ranks $((HEIGHT*ranks)) "$SCRATCH/scaling_$((HEIGHT*ranks)).raw"
+    ranks=$((ranks*2))
+done
+
+# one table of both studies.  t1/tN is the speedup over one rank for strong scaling and the efficiency for weak scaling.
+printf "%-6s %5s %10s %12s %12s %12s %8s\n" mode ranks height total_s convolute_s exchange_s t1/tN | tee "$OUT"
+for mode in strong weak; do
+    # the kernel field may be quoted and hold commas, so columns are found by name and counted from the end of the line
+    awk -F, -v mode=$mode 'NR==1 {for (i=1;i<=NF;i++) back[$i]=NF-i; next}
+        function field(name) {return $(NF-back[name])}
+        {
+            total=field("total_ns")/1e9; if (NR==2) first=total
+            printf "%-6s %5d %10d %12.6f %12.6f %12.6f %8.2f\n",mode,field("ranks"),field("height"),total,
+                field("convolute_ns")/1e9,field("exchange_ns")/1e9,first/total
+        }' "$OUT.$mode" | tee -a "$OUT"
+done
+rm -f "$SCRATCH/scaling_out.raw"
@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "image.h"
+#include "options.h"
+#include "buffers.h"
+#include "library.h"
+#include "service.h"
+
+//Set by SIGINT and SIGTERM to stop the service between jobs
+static volatile sig_atomic_t stopping=0;
+
+//stopService: Asks the service to stop, as the SIGINT and SIGTERM handler
+static void stopService(int signal){
+    (void)signal;
+    stopping=1;
+}
+
+//catchSignals: Stops the service on SIGINT and SIGTERM, without restarting the accept or read they interrupt, and
+//ignores SIGPIPE so a client that goes away only fails the write to it
+static void catchSignals(){
+    struct sigaction action;
+    memset(&action,0,sizeof(action));
+    action.sa_handler=stopService;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT,&action,NULL);
+    sigaction(SIGTERM,&action,NULL);
+    action.sa_handler=SIG_IGN;
+    sigaction(SIGPIPE,&action,NULL);
+}
+
+//sendError: Answers a job with ERROR and a message
+static void sendError(FILE* out,const char* message){
+    fprintf(out,"ERROR %s\n",message);
+    fflush(out);
+}
+
+//runJob: Convolutes one image on the context and answers with its PNG
+//Parameters: context: The context, kept between jobs
+//            kernel: The kernels the job asked for
+//            data,length: The encoded image
+//            luma: 1 to convolute only the luma
+//            out: Where the answer goes
+//Returns: 0 if the answer was written, -1 if the client has gone
+static int runJob(ImageContext* context,const char* kernel,const uint8_t* data,size_t length,int luma,FILE* out){
+    Image srcImage,destImage;
+    uint8_t* png=NULL;
+    size_t pngLength=0;
+    int result;
+    if (setContextKernel(context,kernel)){
+        sendError(out,"bad kernel");
+        return ferror(out)?-1:0;
+    }
+    if (decodeImageMemory(data,length,luma,&srcImage)){
+        sendError(out,"bad image");
+        return ferror(out)?-1:0;
+    }
+    destImage=srcImage;
+    if (allocImage(&destImage)){
+        freeImage(&srcImage);
+        sendError(out,"out of memory");
+        return ferror(out)?-1:0;
+    }
+    convoluteContext(context,&srcImage,&destImage);
+    freeImage(&srcImage);
+    result=encodeImageMemory(&destImage,&png,&pngLength);
+    freeImage(&destImage);
+    if (result) sendError(out,"out of memory");
+    else{
+        fprintf(out,"OK %zu\n",pngLength);
+        fwrite(png,1,pngLength,out);
+        fflush(out);
+    }
+    free(png);
+    return ferror(out)?-1:0;
+}
+
+//serveStream: Answers the jobs of one client in order until it closes its end, sends a malformed request or the service
+//is stopped.  Each request is a line "<kernel> <length> [luma]" followed by length bytes of an encoded image (anything
+//stb_image reads), and each answer is "OK <length>" and a PNG of that many bytes, or a line "ERROR <message>".
+//Parameters: context: The context, kept between jobs and clients
+//            in,out: The client's requests and where its answers go
+//            luma: 1 to convolute only the luma of every job, as --luma does, not just those that ask
+static void serveStream(ImageContext* context,FILE* in,FILE* out,int luma){
+    char line[1024],kernel[1024],flag[16];
+    size_t length;
+    uint8_t* data;
+    int fields;
+    while (!stopping && fgets(line,sizeof(line),in)){
+        fields=sscanf(line,"%1023s %zu %15s",kernel,&length,flag);
+        if (fields<2 || (fields==3 && strcmp(flag,"luma")) || !strchr(line,'\n')){
+            sendError(out,"malformed request");
+            return;
+        }
+        if (length==0 || length>SERVICE_MAX_BYTES){
+            sendError(out,"bad length");
+            return;
+        }
+        data=malloc(length);
+        if (!data){
+            sendError(out,"out of memory");
+            return;
+        }
+        if (fread(data,1,length,in)!=length){
+            free(data);
+            return;
+        }
+        fields=runJob(context,kernel,data,length,fields==3 || luma,out);
+        free(data);
+        if (fields) return;
+    }
+}
+
+//listenOn: Binds a Unix domain socket at path, replacing any left over from an earlier run
+//Returns: The listening socket, or -1 on failure
+static int listenOn(const char* path){
+    struct sockaddr_un address;
+    int fd;
+    if (strlen(path)>=sizeof(address.sun_path)) return -1;
+    fd=socket(AF_UNIX,SOCK_STREAM,0);
+    if (fd<0) return -1;
+    memset(&address,0,sizeof(address));
+    address.sun_family=AF_UNIX;
+    strcpy(address.sun_path,path);
+    unlink(path);
+    if (bind(fd,(struct sockaddr*)&address,sizeof(address)) || listen(fd,SERVICE_BACKLOG)){
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+//serveSocket: Accepts clients on a Unix domain socket and serves them one after another until stopped
+//Returns: 0 once stopped, -1 if the socket could not be created
+static int serveSocket(ImageContext* context,const char* path,int luma){
+    int server=listenOn(path),client;
+    FILE* in;
+    FILE* out;
+    if (server<0){
+        printf("Error listening on %s.\n",path);
+        return -1;
+    }
+    printf("Serving on %s.\n",path);
+    fflush(stdout);
+    while (!stopping){
+        client=accept(server,NULL,NULL);
+        if (client<0){
+            if (errno==EINTR) continue;
+            break;
+        }
+        in=fdopen(client,"rb");
+        out=in?fdopen(dup(client),"wb"):NULL;
+        if (out) serveStream(context,in,out,luma);
+        else printf("Error opening connection.\n");
+        if (out) fclose(out);
+        if (in) fclose(in);
+        else close(client);
+    }
+    close(server);
+    unlink(path);
+    return 0;
+}
+
+//serveStdio: Serves one client on stdin and stdout.  Anything else the program prints goes to stderr instead, so
+//stdout carries only answers.
+//Returns: 0 once stdin closes or the service is stopped, -1 if stdout could not be taken over
+static int serveStdio(ImageContext* context,int luma){
+    FILE* out;
+    int fd;
+    fflush(stdout);
+    fd=dup(STDOUT_FILENO);
+    out=fd<0?NULL:fdopen(fd,"wb");
+    if (!out){
+        if (fd>=0) close(fd);
+        printf("Error opening stdout.\n");
+        return -1;
+    }
+    dup2(STDERR_FILENO,STDOUT_FILENO);
+    serveStream(context,stdin,out,luma);
+    fclose(out);
+    return 0;
+}
+
+//runService: Keeps the backend startRun started running and convolutes the images clients send, so each job pays for
+//neither starting threads nor loading the program.  The kernels of the last job and the buffer pool carry over
+//between jobs.
+//Parameters: options: The parsed command line.  serve is a Unix socket path, or - for one client on stdin and stdout.
+//                     border, borderValue, layout, skip-alpha and luma settings apply to every job.
+//Returns: 0 once stopped, -1 on failure
+int runService(Options* options){
+    ImageContext context;
+    int result;
+    openImageContext(&context,NULL,options->threads);
+    context.options.border=options->border;
+    context.options.borderValue=options->borderValue;
+    context.options.planarLayout=options->planarLayout;
+    context.options.skipAlpha=options->skipAlpha;
+    catchSignals();
+    if (!strcmp(options->serve,"-")) result=serveStdio(&context,options->luma);
+    else result=serveSocket(&context,options->serve,options->luma);
+    closeImageContext(&context);
+    return result;
+}
@@ -0,0 +1,13 @@
+#ifndef ___SERVICE
+#define ___SERVICE
+#include "options.h"
+
+//The largest encoded image one job may send
+#define SERVICE_MAX_BYTES (256*1024*1024)
+
+//How many connections may wait while one is being served
+#define SERVICE_BACKLOG 16
+
+int runService(Options* options);
+
+#endif
@@ -0,0 +1,736 @@
+#include <stdint.h>
+#include <string.h>
+#include "simd.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_X86
+#endif
+#if defined(__aarch64__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define SIMD_ARM
+#endif
+
+static enum SimdLevels simdLevel=SIMD_AUTO;
+
+//makeSimdKernel: Prepares a fixed point kernel for the 16 bit vector row functions
+//Parameters: weights: The size*size integer numerators of the kernel.  The SimdKernel points at them rather than copying them.
+//            size: The width and height of the kernel
+//            divisor: The common denominator of the kernel
+//            maxSum: The largest non-negative sum the kernel can produce on 8 bit input
+//            kernel: The SimdKernel to populate
+//Returns: 0 on success, -1 if the kernel could overflow a 16 bit lane or has no exact 16 bit reciprocal
+int makeSimdKernel(int16_t* weights,int size,int divisor,int maxSum,SimdKernel* kernel){
+    int i,magnitude=0,shift;
+    kernel->size=size;
+    kernel->weights=weights;
+    for (i=0;i<size*size;i++){
+        magnitude+=weights[i]<0?-weights[i]:weights[i];
+        // every partial sum has to stay inside a signed 16 bit lane
+        if (magnitude*255>INT16_MAX) return -1;
+    }
+    if ((divisor&(divisor-1))==0){
+        kernel->multiplier=0;
+        for (shift=0;(1<<shift)<divisor;shift++);
+        kernel->shift=shift;
+        return 0;
+    }
+    for (shift=0;shift<16;shift++){
+        uint32_t multiplier=((1u<<(16+shift))+divisor-1)/divisor;
+        uint32_t error=multiplier*divisor-(1u<<(16+shift));
+        if (multiplier>UINT16_MAX) break;
+        if ((uint64_t)maxSum*error<(1ull<<(16+shift))){
+            kernel->multiplier=(uint16_t)multiplier;
+            kernel->shift=shift;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+//simdDivide: The scalar equivalent of the vector clamp, divide and saturating pack
+static inline uint8_t simdDivide(int sum,const SimdKernel* kernel){
+    if (sum<0) sum=0;
+    if (kernel->multiplier) sum=(int)(((uint32_t)sum*kernel->multiplier)>>16);
+    sum>>=kernel->shift;
+    return sum>255?255:(uint8_t)sum;
+}
+
+//rowScalar: Scalar row function for output bytes start..count-1
+static void rowScalar(const uint8_t** rows,uint8_t* out,int start,int count,int bpp,const SimdKernel* kernel){
+    int i,r,c,size=kernel->size,radius=kernel->size/2;
+    for (i=start;i<count;i++){
+        int sum=0;
+        for (r=0;r<size;r++)
+            for (c=0;c<size;c++)
+                sum+=kernel->weights[r*size+c]*rows[r][i+(c-radius)*bpp];
+        out[i]=simdDivide(sum,kernel);
+    }
+}
+
+//horizontalScalar: Scalar horizontal pass for sums start..count-1
+static void horizontalScalar(const uint8_t* row,int16_t* out,int start,int count,int bpp,const int16_t* taps,int size){
+    int i,c,radius=size/2;
+    for (i=start;i<count;i++){
+        int sum=0;
+        for (c=0;c<size;c++) sum+=taps[c]*row[i+(c-radius)*bpp];
+        out[i]=(int16_t)sum;
+    }
+}
+
+//verticalScalar: Scalar vertical pass for output bytes start..count-1
+static void verticalScalar(const int16_t** rows,uint8_t* out,int start,int count,const int16_t* taps,int size,const SimdKernel* kernel){
+    int i,r;
+    for (i=start;i<count;i++){
+        int sum=0;
+        for (r=0;r<size;r++) sum+=taps[r]*rows[r][i];
+        out[i]=simdDivide(sum,kernel);
+    }
+}
+
+//simdRowScalar: Portable version of the row function, used on CPUs without vector support
+void simdRowScalar(const uint8_t** rows,uint8_t* out,int count,int bpp,const SimdKernel* kernel){
+    rowScalar(rows,out,0,count,bpp,kernel);
+}
+
+//simdHorizontalScalar: Portable horizontal pass of a separable kernel
+void simdHorizontalScalar(const uint8_t* row,int16_t* out,int count,int bpp,const int16_t* taps,int size){
+    horizontalScalar(row,out,0,count,bpp,taps,size);
+}
+
+//simdVerticalScalar: Portable vertical pass of a separable kernel
+void simdVerticalScalar(const int16_t** rows,uint8_t* out,int count,const int16_t* taps,int size,const SimdKernel* kernel){
+    verticalScalar(rows,out,0,count,taps,size,kernel);
+}
+
+#ifdef SIMD_X86
+//simdRowSse4: Computes 16 output bytes per iteration with SSE4.1
+__attribute__((target("sse4.1")))
+static void simdRowSse4(const uint8_t** rows,uint8_t* out,int count,int bpp,const SimdKernel* kernel){
+    int i,r,c,size=kernel->size,radius=kernel->size/2;
+    const __m128i zero=_mm_setzero_si128();
+    const __m128i multiplier=_mm_set1_epi16((short)kernel->multiplier);
+    const __m128i shift=_mm_cvtsi32_si128(kernel->shift);
+    for (i=0;i+16<=count;i+=16){
+        __m128i low=zero,high=zero;
+        for (r=0;r<size;r++){
+            for (c=0;c<size;c++){
+                int16_t weight=kernel->weights[r*size+c];
+                if (!weight) continue;
+                __m128i pixels=_mm_loadu_si128((const __m128i*)(rows[r]+i+(c-radius)*bpp));
+                __m128i w=_mm_set1_epi16(weight);
+                low=_mm_add_epi16(low,_mm_mullo_epi16(_mm_cvtepu8_epi16(pixels),w));
+                high=_mm_add_epi16(high,_mm_mullo_epi16(_mm_cvtepu8_epi16(_mm_srli_si128(pixels,8)),w));
+            }
+        }
+        low=_mm_max_epi16(low,zero);
+        high=_mm_max_epi16(high,zero);
+        if (kernel->multiplier){
+            low=_mm_mulhi_epu16(low,multiplier);
+            high=_mm_mulhi_epu16(high,multiplier);
+        }
+        low=_mm_srl_epi16(low,shift);
+        high=_mm_srl_epi16(high,shift);
+        _mm_storeu_si128((__m128i*)(out+i),_mm_packus_epi16(low,high));
+    }
+    rowScalar(rows,out,i,count,bpp,kernel);
+}
+
+//simdHorizontalSse4: Horizontal pass of a separable kernel, 16 sums per iteration
+__attribute__((target("sse4.1")))
+static void simdHorizontalSse4(const uint8_t* row,int16_t* out,int count,int bpp,const int16_t* taps,int size){
+    int i,c,radius=size/2;
+    for (i=0;i+16<=count;i+=16){
+        __m128i low=_mm_setzero_si128(),high=_mm_setzero_si128();
+        for (c=0;c<size;c++){
+            __m128i pixels=_mm_loadu_si128((const __m128i*)(row+i+(c-radius)*bpp));
+            __m128i w=_mm_set1_epi16(taps[c]);
+            low=_mm_add_epi16(low,_mm_mullo_epi16(_mm_cvtepu8_epi16(pixels),w));
+            high=_mm_add_epi16(high,_mm_mullo_epi16(_mm_cvtepu8_epi16(_mm_srli_si128(pixels,8)),w));
+        }
+        _mm_storeu_si128((__m128i*)(out+i),low);
+        _mm_storeu_si128((__m128i*)(out+i+8),high);
+    }
+    horizontalScalar(row,out,i,count,bpp,taps,size);
+}
+
+//simdVerticalSse4: Vertical pass of a separable kernel, 16 output bytes per iteration
+__attribute__((target("sse4.1")))
+static void simdVerticalSse4(const int16_t** rows,uint8_t* out,int count,const int16_t* taps,int size,const SimdKernel* kernel){
+    int i,r;
+    const __m128i zero=_mm_setzero_si128();
+    const __m128i multiplier=_mm_set1_epi16((short)kernel->multiplier);
+    const __m128i shift=_mm_cvtsi32_si128(kernel->shift);
+    for (i=0;i+16<=count;i+=16){
+        __m128i low=zero,high=zero;
+        for (r=0;r<size;r++){
+            __m128i w=_mm_set1_epi16(taps[r]);
+            low=_mm_add_epi16(low,_mm_mullo_epi16(_mm_loadu_si128((const __m128i*)(rows[r]+i)),w));
+            high=_mm_add_epi16(high,_mm_mullo_epi16(_mm_loadu_si128((const __m128i*)(rows[r]+i+8)),w));
+        }
+        low=_mm_max_epi16(low,zero);
+        high=_mm_max_epi16(high,zero);
+        if (kernel->multiplier){
+            low=_mm_mulhi_epu16(low,multiplier);
+            high=_mm_mulhi_epu16(high,multiplier);
+        }
+        low=_mm_srl_epi16(low,shift);
+        high=_mm_srl_epi16(high,shift);
+        _mm_storeu_si128((__m128i*)(out+i),_mm_packus_epi16(low,high));
+    }
+    verticalScalar(rows,out,i,count,taps,size,kernel);
+}
+
+//simdRowAvx2: Computes 32 output bytes per iteration with AVX2
+__attribute__((target("avx2")))
+static void simdRowAvx2(const uint8_t** rows,uint8_t* out,int count,int bpp,const SimdKernel* kernel){
+    int i,r,c,size=kernel->size,radius=kernel->size/2;
+    const __m256i zero=_mm256_setzero_si256();
+    const __m256i multiplier=_mm256_set1_epi16((short)kernel->multiplier);
+    const __m128i shift=_mm_cvtsi32_si128(kernel->shift);
+    for (i=0;i+32<=count;i+=32){
+        __m256i low=zero,high=zero;
+        for (r=0;r<size;r++){
+            for (c=0;c<size;c++){
+                int16_t weight=kernel->weights[r*size+c];
+                if (!weight) continue;
+                __m256i pixels=_mm256_loadu_si256((const __m256i*)(rows[r]+i+(c-radius)*bpp));
+                __m256i w=_mm256_set1_epi16(weight);
+                low=_mm256_add_epi16(low,_mm256_mullo_epi16(_mm256_cvtepu8_epi16(_mm256_castsi256_si128(pixels)),w));
+                high=_mm256_add_epi16(high,_mm256_mullo_epi16(_mm256_cvtepu8_epi16(_mm256_extracti128_si256(pixels,1)),w));
+            }
+        }
+        low=_mm256_max_epi16(low,zero);
+        high=_mm256_max_epi16(high,zero);
+        if (kernel->multiplier){
+            low=_mm256_mulhi_epu16(low,multiplier);
+            high=_mm256_mulhi_epu16(high,multiplier);
+        }
+        low=_mm256_srl_epi16(low,shift);
+        high=_mm256_srl_epi16(high,shift);
+        // packus works inside each 128 bit lane, so put the quarters back in order afterward
+        _mm256_storeu_si256((__m256i*)(out+i),_mm256_permute4x64_epi64(_mm256_packus_epi16(low,high),0xD8));
+    }
+    rowScalar(rows,out,i,count,bpp,kernel);
+}
+
+//simdHorizontalAvx2: Horizontal pass of a separable kernel, 32 sums per iteration
+__attribute__((target("avx2")))
+static void simdHorizontalAvx2(const uint8_t* row,int16_t* out,int count,int bpp,const int16_t* taps,int size){
+    int i,c,radius=size/2;
+    for (i=0;i+32<=count;i+=32){
+        __m256i low=_mm256_setzero_si256(),high=_mm256_setzero_si256();
+        for (c=0;c<size;c++){
+            __m256i pixels=_mm256_loadu_si256((const __m256i*)(row+i+(c-radius)*bpp));
+            __m256i w=_mm256_set1_epi16(taps[c]);
+            low=_mm256_add_epi16(low,_mm256_mullo_epi16(_mm256_cvtepu8_epi16(_mm256_castsi256_si128(pixels)),w));
+            high=_mm256_add_epi16(high,_mm256_mullo_epi16(_mm256_cvtepu8_epi16(_mm256_extracti128_si256(pixels,1)),w));
+        }
+        _mm256_storeu_si256((__m256i*)(out+i),low);
+        _mm256_storeu_si256((__m256i*)(out+i+16),high);
+    }
+    horizontalScalar(row,out,i,count,bpp,taps,size);
+}
+
+//simdVerticalAvx2: Vertical pass of a separable kernel, 32 output bytes per iteration
+__attribute__((target("avx2")))
+static void simdVerticalAvx2(const int16_t** rows,uint8_t* out,int count,const int16_t* taps,int size,const SimdKernel* kernel){
+    int i,r;
+    const __m256i zero=_mm256_setzero_si256();
+    const __m256i multiplier=_mm256_set1_epi16((short)kernel->multiplier);
+    const __m128i shift=_mm_cvtsi32_si128(kernel->shift);
+    for (i=0;i+32<=count;i+=32){
+        __m256i low=zero,high=zero;
+        for (r=0;r<size;r++){
+            __m256i w=_mm256_set1_epi16(taps[r]);
+            low=_mm256_add_epi16(low,_mm256_mullo_epi16(_mm256_loadu_si256((const __m256i*)(rows[r]+i)),w));
+            high=_mm256_add_epi16(high,_mm256_mullo_epi16(_mm256_loadu_si256((const __m256i*)(rows[r]+i+16)),w));
+        }
+        low=_mm256_max_epi16(low,zero);
+        high=_mm256_max_epi16(high,zero);
+        if (kernel->multiplier){
+            low=_mm256_mulhi_epu16(low,multiplier);
+            high=_mm256_mulhi_epu16(high,multiplier);
+        }
+        low=_mm256_srl_epi16(low,shift);
+        high=_mm256_srl_epi16(high,shift);
+        _mm256_storeu_si256((__m256i*)(out+i),_mm256_permute4x64_epi64(_mm256_packus_epi16(low,high),0xD8));
+    }
+    verticalScalar(rows,out,i,count,taps,size,kernel);
+}
+#endif
+
+//The integer taps of the built-in 3x3 kernels over their smallest divisors, as makeFixedKernel produces them.  Each gets
+//row functions with its taps compiled in, so zero taps disappear, taps of one become plain adds and subtracts and powers
+//of two become shifts.  The divide still comes from the SimdKernel.
+#define EDGE_TAPS 0,-1,0,-1,4,-1,0,-1,0
+#define SHARPEN_TAPS 0,-1,0,-1,5,-1,0,-1,0
+#define BLUR_TAPS 1,1,1,1,1,1,1,1,1
+#define GAUSS_TAPS 1,2,1,2,4,2,1,2,1
+#define EMBOSS_TAPS -2,-1,0,-1,1,1,0,1,2
+//The taps of the two passes of the separable built-ins, blur and gauss
+#define BOX_TAPS 1,1,1
+#define BINOMIAL_TAPS 1,2,1
+
+static const int16_t builtinTaps[][9]={{EDGE_TAPS},{SHARPEN_TAPS},{BLUR_TAPS},{GAUSS_TAPS},{EMBOSS_TAPS}};
+static const int16_t builtinPassTaps[][3]={{BOX_TAPS},{BINOMIAL_TAPS}};
+#define BUILTIN_COUNT 5
+#define BUILTIN_PASS_COUNT 2
+
+//APPLY9 and APPLY3 expand TAP once per tap of a list like EDGE_TAPS, with its row and column (or just its index)
+#define APPLY9(TAP,...) APPLY9_(TAP,__VA_ARGS__)
+#define APPLY9_(TAP,w0,w1,w2,w3,w4,w5,w6,w7,w8) TAP(0,0,w0) TAP(0,1,w1) TAP(0,2,w2) TAP(1,0,w3) TAP(1,1,w4) TAP(1,2,w5) \
+    TAP(2,0,w6) TAP(2,1,w7) TAP(2,2,w8)
+#define APPLY3(TAP,...) APPLY3_(TAP,__VA_ARGS__)
+#define APPLY3_(TAP,w0,w1,w2) TAP(0,w0) TAP(1,w1) TAP(2,w2)
+
+//Scalar versions, which with constant taps the compiler strength reduces on its own
+#define ROW_TAP_SCALAR(r,c,w) sum+=(w)*rows[r][i+((c)-1)*bpp];
+#define HORIZONTAL_TAP_SCALAR(c,w) sum+=(w)*row[i+((c)-1)*bpp];
+#define VERTICAL_TAP_SCALAR(r,w) sum+=(w)*rows[r][i];
+#define SPECIALIZED_SCALAR(name,taps) \
+static void row##name##Scalar(const uint8_t** rows,uint8_t* out,int count,int bpp,const SimdKernel* kernel){ \
+    int i; \
+    for (i=0;i<count;i++){ \
+        int sum=0; \
+        APPLY9(ROW_TAP_SCALAR,taps) \
+        out[i]=simdDivide(sum,kernel); \
+    } \
+}
+#define SPECIALIZED_PASS_SCALAR(name,taps) \
+static void horizontal##name##Scalar(const uint8_t* row,int16_t* out,int count,int bpp,const int16_t* passTaps,int size){ \
+    int i; \
+    (void)passTaps; (void)size; \
+    for (i=0;i<count;i++){ \
+        int sum=0; \
+        APPLY3(HORIZONTAL_TAP_SCALAR,taps) \
+        out[i]=(int16_t)sum; \
+    } \
+} \
+static void vertical##name##Scalar(const int16_t** rows,uint8_t* out,int count,const int16_t* passTaps,int size,const SimdKernel* kernel){ \
+    int i; \
+    (void)passTaps; (void)size; \
+    for (i=0;i<count;i++){ \
+        int sum=0; \
+        APPLY3(VERTICAL_TAP_SCALAR,taps) \
+        out[i]=simdDivide(sum,kernel); \
+    } \
+}
+SPECIALIZED_SCALAR(Edge,EDGE_TAPS)
+SPECIALIZED_SCALAR(Sharpen,SHARPEN_TAPS)
+SPECIALIZED_SCALAR(Blur,BLUR_TAPS)
+SPECIALIZED_SCALAR(Gauss,GAUSS_TAPS)
+SPECIALIZED_SCALAR(Emboss,EMBOSS_TAPS)
+SPECIALIZED_PASS_SCALAR(Box,BOX_TAPS)
+SPECIALIZED_PASS_SCALAR(Binomial,BINOMIAL_TAPS)
+static const SimdRowFunction builtinRowsScalar[BUILTIN_COUNT]={rowEdgeScalar,rowSharpenScalar,rowBlurScalar,rowGaussScalar,rowEmbossScalar};
+static const SimdHorizontalFunction builtinHorizontalScalar[BUILTIN_PASS_COUNT]={horizontalBoxScalar,horizontalBinomialScalar};
+static const SimdVerticalFunction builtinVerticalScalar[BUILTIN_PASS_COUNT]={verticalBoxScalar,verticalBinomialScalar};
+
+#ifdef SIMD_X86
+//scaleSse4, scaleAvx2: Multiply 16 bit lanes by a positive constant tap, as a shift when it is a power of two
+__attribute__((target("sse4.1"),always_inline))
+static inline __m128i scaleSse4(__m128i pixels,int tap){
+    if (tap==1) return pixels;
+    if (!(tap&(tap-1))) return _mm_slli_epi16(pixels,__builtin_ctz(tap));
+    return _mm_mullo_epi16(pixels,_mm_set1_epi16(tap));
+}
+
+__attribute__((target("avx2"),always_inline))
+static inline __m256i scaleAvx2(__m256i pixels,int tap){
+    if (tap==1) return pixels;
+    if (!(tap&(tap-1))) return _mm256_slli_epi16(pixels,__builtin_ctz(tap));
+    return _mm256_mullo_epi16(pixels,_mm256_set1_epi16(tap));
+}
+
+//ACCUMULATE_SSE4, ACCUMULATE_AVX2: Add or subtract one tap's products into the low and high sums
+#define ACCUMULATE_SSE4(w,lowPixels,highPixels) \
+    if ((w)>0){ \
+        low=_mm_add_epi16(low,scaleSse4(lowPixels,(w))); \
+        high=_mm_add_epi16(high,scaleSse4(highPixels,(w))); \
+    } \
+    else{ \
+        low=_mm_sub_epi16(low,scaleSse4(lowPixels,-(w))); \
+        high=_mm_sub_epi16(high,scaleSse4(highPixels,-(w))); \
+    }
+#define ACCUMULATE_AVX2(w,lowPixels,highPixels) \
+    if ((w)>0){ \
+        low=_mm256_add_epi16(low,scaleAvx2(lowPixels,(w))); \
+        high=_mm256_add_epi16(high,scaleAvx2(highPixels,(w))); \
+    } \
+    else{ \
+        low=_mm256_sub_epi16(low,scaleAvx2(lowPixels,-(w))); \
+        high=_mm256_sub_epi16(high,scaleAvx2(highPixels,-(w))); \
+    }
+
+//DIVIDE_SSE4, DIVIDE_AVX2: Clamp the sums at zero, divide them like the generic row functions and store 16 or 32 bytes
+#define DIVIDE_SSE4 \
+    low=_mm_max_epi16(low,zero); \
+    high=_mm_max_epi16(high,zero); \
+    if (kernel->multiplier){ \
+        low=_mm_mulhi_epu16(low,multiplier); \
+        high=_mm_mulhi_epu16(high,multiplier); \
+    } \
+    low=_mm_srl_epi16(low,shift); \
+    high=_mm_srl_epi16(high,shift); \
+    _mm_storeu_si128((__m128i*)(out+i),_mm_packus_epi16(low,high));
+#define DIVIDE_AVX2 \
+    low=_mm256_max_epi16(low,zero); \
+    high=_mm256_max_epi16(high,zero); \
+    if (kernel->multiplier){ \
+        low=_mm256_mulhi_epu16(low,multiplier); \
+        high=_mm256_mulhi_epu16(high,multiplier); \
+    } \
+    low=_mm256_srl_epi16(low,shift); \
+    high=_mm256_srl_epi16(high,shift); \
+    _mm256_storeu_si256((__m256i*)(out+i),_mm256_permute4x64_epi64(_mm256_packus_epi16(low,high),0xD8));
+
+#define ROW_TAP_SSE4(r,c,w) \
+    if (w){ \
+        __m128i pixels=_mm_loadu_si128((const __m128i*)(rows[r]+i+((c)-1)*bpp)); \
+        __m128i lowPixels=_mm_cvtepu8_epi16(pixels),highPixels=_mm_cvtepu8_epi16(_mm_srli_si128(pixels,8)); \
+        ACCUMULATE_SSE4(w,lowPixels,highPixels) \
+    }
+#define ROW_TAP_AVX2(r,c,w) \
+    if (w){ \
+        __m256i pixels=_mm256_loadu_si256((const __m256i*)(rows[r]+i+((c)-1)*bpp)); \
+        __m256i lowPixels=_mm256_cvtepu8_epi16(_mm256_castsi256_si128(pixels)); \
+        __m256i highPixels=_mm256_cvtepu8_epi16(_mm256_extracti128_si256(pixels,1)); \
+        ACCUMULATE_AVX2(w,lowPixels,highPixels) \
+    }
+#define HORIZONTAL_TAP_SSE4(c,w) \
+    { \
+        __m128i pixels=_mm_loadu_si128((const __m128i*)(row+i+((c)-1)*bpp)); \
+        __m128i lowPixels=_mm_cvtepu8_epi16(pixels),highPixels=_mm_cvtepu8_epi16(_mm_srli_si128(pixels,8)); \
+        ACCUMULATE_SSE4(w,lowPixels,highPixels) \
+    }
+#define HORIZONTAL_TAP_AVX2(c,w) \
+    { \
+        __m256i pixels=_mm256_loadu_si256((const __m256i*)(row+i+((c)-1)*bpp)); \
+        __m256i lowPixels=_mm256_cvtepu8_epi16(_mm256_castsi256_si128(pixels)); \
+        __m256i highPixels=_mm256_cvtepu8_epi16(_mm256_extracti128_si256(pixels,1)); \
+        ACCUMULATE_AVX2(w,lowPixels,highPixels) \
+    }
+#define VERTICAL_TAP_SSE4(r,w) \
+    { \
+        __m128i lowPixels=_mm_loadu_si128((const __m128i*)(rows[r]+i)); \
+        __m128i highPixels=_mm_loadu_si128((const __m128i*)(rows[r]+i+8)); \
+        ACCUMULATE_SSE4(w,lowPixels,highPixels) \
+    }
+#define VERTICAL_TAP_AVX2(r,w) \
+    { \
+        __m256i lowPixels=_mm256_loadu_si256((const __m256i*)(rows[r]+i)); \
+        __m256i highPixels=_mm256_loadu_si256((const __m256i*)(rows[r]+i+16)); \
+        ACCUMULATE_AVX2(w,lowPixels,highPixels) \
+    }
+
+//SPECIALIZED_X86: Defines the SSE4 and AVX2 row functions of one built-in kernel, which finish their rows with the
+//generic scalar loop like simdRowSse4 and simdRowAvx2
+#define SPECIALIZED_X86(name,taps) \
+__attribute__((target("sse4.1"))) \
+static void row##name##Sse4(const uint8_t** rows,uint8_t* out,int count,int bpp,const SimdKernel* kernel){ \
+    int i; \
+    const __m128i zero=_mm_setzero_si128(); \
+    const __m128i multiplier=_mm_set1_epi16((short)kernel->multiplier); \
+    const __m128i shift=_mm_cvtsi32_si128(kernel->shift); \
+    for (i=0;i+16<=count;i+=16){ \
+        __m128i low=zero,high=zero; \
+        APPLY9(ROW_TAP_SSE4,taps) \
+        DIVIDE_SSE4 \
+    } \
+    rowScalar(rows,out,i,count,bpp,kernel); \
+} \
+__attribute__((target("avx2"))) \
+static void row##name##Avx2(const uint8_t** rows,uint8_t* out,int count,int bpp,const SimdKernel* kernel){ \
+    int i; \
+    const __m256i zero=_mm256_setzero_si256(); \
+    const __m256i multiplier=_mm256_set1_epi16((short)kernel->multiplier); \
+    const __m128i shift=_mm_cvtsi32_si128(kernel->shift); \
+    for (i=0;i+32<=count;i+=32){ \
+        __m256i low=zero,high=zero; \
+        APPLY9(ROW_TAP_AVX2,taps) \
+        DIVIDE_AVX2 \
+    } \
+    rowScalar(rows,out,i,count,bpp,kernel); \
+}
+
+//SPECIALIZED_PASS_X86: Defines the SSE4 and AVX2 horizontal and vertical passes of one separable built-in
+#define SPECIALIZED_PASS_X86(name,taps) \
+__attribute__((target("sse4.1"))) \
+static void horizontal##name##Sse4(const uint8_t* row,int16_t* out,int count,int bpp,const int16_t* passTaps,int size){ \
+    int i; \
+    for (i=0;i+16<=count;i+=16){ \
+        __m128i low=_mm_setzero_si128(),high=_mm_setzero_si128(); \
+        APPLY3(HORIZONTAL_TAP_SSE4,taps) \
+        _mm_storeu_si128((__m128i*)(out+i),low); \
+        _mm_storeu_si128((__m128i*)(out+i+8),high); \
+    } \
+    horizontalScalar(row,out,i,count,bpp,passTaps,size); \
+} \
+__attribute__((target("sse4.1"))) \
+static void vertical##name##Sse4(const int16_t** rows,uint8_t* out,int count,const int16_t* passTaps,int size,const SimdKernel* kernel){ \
+    int i; \
+    const __m128i zero=_mm_setzero_si128(); \
+    const __m128i multiplier=_mm_set1_epi16((short)kernel->multiplier); \
+    const __m128i shift=_mm_cvtsi32_si128(kernel->shift); \
+    for (i=0;i+16<=count;i+=16){ \
+        __m128i low=zero,high=zero; \
+        APPLY3(VERTICAL_TAP_SSE4,taps) \
+        DIVIDE_SSE4 \
+    } \
+    verticalScalar(rows,out,i,count,passTaps,size,kernel); \
+} \
+__attribute__((target("avx2"))) \
+static void horizontal##name##Avx2(const uint8_t* row,int16_t* out,int count,int bpp,const int16_t* passTaps,int size){ \
+    int i; \
+    for (i=0;i+32<=count;i+=32){ \
+        __m256i low=_mm256_setzero_si256(),high=_mm256_setzero_si256(); \
+        APPLY3(HORIZONTAL_TAP_AVX2,taps) \
+        _mm256_storeu_si256((__m256i*)(out+i),low); \
+        _mm256_storeu_si256((__m256i*)(out+i+16),high); \
+    } \
+    horizontalScalar(row,out,i,count,bpp,passTaps,size); \
+} \
+__attribute__((target("avx2"))) \
+static void vertical##name##Avx2(const int16_t** rows,uint8_t* out,int count,const int16_t* passTaps,int size,const SimdKernel* kernel){ \
+    int i; \
+    const __m256i zero=_mm256_setzero_si256(); \
+    const __m256i multiplier=_mm256_set1_epi16((short)kernel->multiplier); \
+    const __m128i shift=_mm_cvtsi32_si128(kernel->shift); \
+    for (i=0;i+32<=count;i+=32){ \
+        __m256i low=zero,high=zero; \
+        APPLY3(VERTICAL_TAP_AVX2,taps) \
+        DIVIDE_AVX2 \
+    } \
+    verticalScalar(rows,out,i,count,passTaps,size,kernel); \
+}
+
+SPECIALIZED_X86(Edge,EDGE_TAPS)
+SPECIALIZED_X86(Sharpen,SHARPEN_TAPS)
+SPECIALIZED_X86(Blur,BLUR_TAPS)
+SPECIALIZED_X86(Gauss,GAUSS_TAPS)
+SPECIALIZED_X86(Emboss,EMBOSS_TAPS)
+SPECIALIZED_PASS_X86(Box,BOX_TAPS)
+SPECIALIZED_PASS_X86(Binomial,BINOMIAL_TAPS)
+static const SimdRowFunction builtinRowsSse4[BUILTIN_COUNT]={rowEdgeSse4,rowSharpenSse4,rowBlurSse4,rowGaussSse4,rowEmbossSse4};
+static const SimdRowFunction builtinRowsAvx2[BUILTIN_COUNT]={rowEdgeAvx2,rowSharpenAvx2,rowBlurAvx2,rowGaussAvx2,rowEmbossAvx2};
+static const SimdHorizontalFunction builtinHorizontalSse4[BUILTIN_PASS_COUNT]={horizontalBoxSse4,horizontalBinomialSse4};
+static const SimdHorizontalFunction builtinHorizontalAvx2[BUILTIN_PASS_COUNT]={horizontalBoxAvx2,horizontalBinomialAvx2};
+static const SimdVerticalFunction builtinVerticalSse4[BUILTIN_PASS_COUNT]={verticalBoxSse4,verticalBinomialSse4};
+static const SimdVerticalFunction builtinVerticalAvx2[BUILTIN_PASS_COUNT]={verticalBoxAvx2,verticalBinomialAvx2};
+#endif
+
+#ifdef SIMD_ARM
+//neonDivide: Clamps 16 sums at zero, divides them and packs them to bytes with saturation
+static inline uint8x16_t neonDivide(int16x8_t low,int16x8_t high,const SimdKernel* kernel){
+    const int16x8_t zero=vdupq_n_s16(0);
+    const int16x8_t shift=vdupq_n_s16((int16_t)-kernel->shift);
+    uint16x8_t ulow=vreinterpretq_u16_s16(vmaxq_s16(low,zero));
+    uint16x8_t uhigh=vreinterpretq_u16_s16(vmaxq_s16(high,zero));
+    if (kernel->multiplier){
+        ulow=vcombine_u16(vshrn_n_u32(vmull_n_u16(vget_low_u16(ulow),kernel->multiplier),16),
+                          vshrn_n_u32(vmull_n_u16(vget_high_u16(ulow),kernel->multiplier),16));
+        uhigh=vcombine_u16(vshrn_n_u32(vmull_n_u16(vget_low_u16(uhigh),kernel->multiplier),16),
+                           vshrn_n_u32(vmull_n_u16(vget_high_u16(uhigh),kernel->multiplier),16));
+    }
+    ulow=vshlq_u16(ulow,shift);
+    uhigh=vshlq_u16(uhigh,shift);
+    return vcombine_u8(vqmovn_u16(ulow),vqmovn_u16(uhigh));
+}
+
+//simdRowNeon: Computes 16 output bytes per iteration with NEON
+static void simdRowNeon(const uint8_t** rows,uint8_t* out,int count,int bpp,const SimdKernel* kernel){
+    int i,r,c,size=kernel->size,radius=kernel->size/2;
+    for (i=0;i+16<=count;i+=16){
+        int16x8_t low=vdupq_n_s16(0),high=vdupq_n_s16(0);
+        for (r=0;r<size;r++){
+            for (c=0;c<size;c++){
+                int16_t weight=kernel->weights[r*size+c];
+                if (!weight) continue;
+                uint8x16_t pixels=vld1q_u8(rows[r]+i+(c-radius)*bpp);
+                low=vmlaq_n_s16(low,vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(pixels))),weight);
+                high=vmlaq_n_s16(high,vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(pixels))),weight);
+            }
+        }
+        vst1q_u8(out+i,neonDivide(low,high,kernel));
+    }
+    rowScalar(rows,out,i,count,bpp,kernel);
+}
+
+//simdHorizontalNeon: Horizontal pass of a separable kernel, 16 sums per iteration
+static void simdHorizontalNeon(const uint8_t* row,int16_t* out,int count,int bpp,const int16_t* taps,int size){
+    int i,c,radius=size/2;
+    for (i=0;i+16<=count;i+=16){
+        int16x8_t low=vdupq_n_s16(0),high=vdupq_n_s16(0);
+        for (c=0;c<size;c++){
+            uint8x16_t pixels=vld1q_u8(row+i+(c-radius)*bpp);
+            low=vmlaq_n_s16(low,vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(pixels))),taps[c]);
+            high=vmlaq_n_s16(high,vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(pixels))),taps[c]);
+        }
+        vst1q_s16(out+i,low);
+        vst1q_s16(out+i+8,high);
+    }
+    horizontalScalar(row,out,i,count,bpp,taps,size);
+}
+
+//simdVerticalNeon: Vertical pass of a separable kernel, 16 output bytes per iteration
+static void simdVerticalNeon(const int16_t** rows,uint8_t* out,int count,const int16_t* taps,int size,const SimdKernel* kernel){
+    int i,r;
+    for (i=0;i+16<=count;i+=16){
+        int16x8_t low=vdupq_n_s16(0),high=vdupq_n_s16(0);
+        for (r=0;r<size;r++){
+            low=vmlaq_n_s16(low,vld1q_s16(rows[r]+i),taps[r]);
+            high=vmlaq_n_s16(high,vld1q_s16(rows[r]+i+8),taps[r]);
+        }
+        vst1q_u8(out+i,neonDivide(low,high,kernel));
+    }
+    verticalScalar(rows,out,i,count,taps,size,kernel);
+}
+#endif
+
+//detectSimdLevel: Picks the widest instruction set the running CPU supports
+static enum SimdLevels detectSimdLevel(){
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return SIMD_AVX2;
+    if (__builtin_cpu_supports("sse4.1")) return SIMD_SSE4;
+#endif
+#ifdef SIMD_ARM
+    return SIMD_NEON;
+#endif
+    return SIMD_SCALAR;
+}
+
+//simdSupported: Checks whether a level can run on this build and CPU
+static int simdSupported(enum SimdLevels level){
+    enum SimdLevels best=detectSimdLevel();
+    if (level==SIMD_SCALAR || level==best) return 1;
+    return level==SIMD_SSE4 && best==SIMD_AVX2;
+}
+
+//setSimdLevel: Overrides the automatically detected instruction set, mostly useful for benchmarking the scalar path
+//Parameters: name: One of scalar, sse4, avx2, neon or auto
+//Returns: 0 on success, -1 if the name is unknown or the CPU cannot run it
+int setSimdLevel(char* name){
+    enum SimdLevels level;
+    if (!strcmp(name,"scalar")) level=SIMD_SCALAR;
+    else if (!strcmp(name,"sse4")) level=SIMD_SSE4;
+    else if (!strcmp(name,"avx2")) level=SIMD_AVX2;
+    else if (!strcmp(name,"neon")) level=SIMD_NEON;
+    else if (!strcmp(name,"auto")) level=SIMD_AUTO;
+    else return -1;
+    if (level!=SIMD_AUTO && !simdSupported(level)) return -1;
+    simdLevel=level;
+    return 0;
+}
+
+//getSimdRowFunction: Runtime CPU dispatch for the row function
+//Returns: The fastest row function allowed by the CPU and setSimdLevel
+SimdRowFunction getSimdRowFunction(){
+    if (simdLevel==SIMD_AUTO) simdLevel=detectSimdLevel();
+    switch (simdLevel){
+#ifdef SIMD_X86
+        case SIMD_AVX2: return simdRowAvx2;
+        case SIMD_SSE4: return simdRowSse4;
+#endif
+#ifdef SIMD_ARM
+        case SIMD_NEON: return simdRowNeon;
+#endif
+        default: return simdRowScalar;
+    }
+}
+
+//getSimdHorizontalFunction: Runtime CPU dispatch for the horizontal pass of separable kernels
+SimdHorizontalFunction getSimdHorizontalFunction(){
+    getSimdRowFunction();
+    switch (simdLevel){
+#ifdef SIMD_X86
+        case SIMD_AVX2: return simdHorizontalAvx2;
+        case SIMD_SSE4: return simdHorizontalSse4;
+#endif
+#ifdef SIMD_ARM
+        case SIMD_NEON: return simdHorizontalNeon;
+#endif
+        default: return simdHorizontalScalar;
+    }
+}
+
+//getSimdVerticalFunction: Runtime CPU dispatch for the vertical pass of separable kernels
+SimdVerticalFunction getSimdVerticalFunction(){
+    getSimdRowFunction();
+    switch (simdLevel){
+#ifdef SIMD_X86
+        case SIMD_AVX2: return simdVerticalAvx2;
+        case SIMD_SSE4: return simdVerticalSse4;
+#endif
+#ifdef SIMD_ARM
+        case SIMD_NEON: return simdVerticalNeon;
+#endif
+        default: return simdVerticalScalar;
+    }
+}
+
+//getSimdName: Returns the name of the instruction set getSimdRowFunction selects
+const char* getSimdName(){
+    static const char* names[]={"scalar","sse4","avx2","neon"};
+    getSimdRowFunction();
+    return names[simdLevel];
+}
+
+//findTaps: Returns the index of the entry of a table of tap lists equal to taps, or -1 if there is none
+static int findTaps(const int16_t* taps,const int16_t* table,int entries,int length){
+    int i;
+    for (i=0;i<entries;i++)
+        if (!memcmp(taps,table+i*length,length*sizeof(int16_t))) return i;
+    return -1;
+}
+
+//getSpecializedRowFunction: Looks for a row function with these exact weights compiled in
+//Parameters: weights,size: The size*size integer weights of a FixedKernel
+//Returns: The row function for the selected instruction set when the weights are one of the built-in 3x3 kernels, or
+//         NULL when they are not or the instruction set has no specialized versions (NEON)
+SimdRowFunction getSpecializedRowFunction(const int16_t* weights,int size){
+    int builtin=size==3?findTaps(weights,builtinTaps[0],BUILTIN_COUNT,9):-1;
+    if (builtin<0) return NULL;
+    getSimdRowFunction();
+    switch (simdLevel){
+#ifdef SIMD_X86
+        case SIMD_AVX2: return builtinRowsAvx2[builtin];
+        case SIMD_SSE4: return builtinRowsSse4[builtin];
+#endif
+        case SIMD_SCALAR: return builtinRowsScalar[builtin];
+        default: return NULL;
+    }
+}
+
+//getSpecializedHorizontalFunction: Looks for a horizontal pass with these exact taps compiled in, see
+//getSpecializedRowFunction
+SimdHorizontalFunction getSpecializedHorizontalFunction(const int16_t* taps,int size){
+    int builtin=size==3?findTaps(taps,builtinPassTaps[0],BUILTIN_PASS_COUNT,3):-1;
+    if (builtin<0) return NULL;
+    getSimdRowFunction();
+    switch (simdLevel){
+#ifdef SIMD_X86
+        case SIMD_AVX2: return builtinHorizontalAvx2[builtin];
+        case SIMD_SSE4: return builtinHorizontalSse4[builtin];
+#endif
+        case SIMD_SCALAR: return builtinHorizontalScalar[builtin];
+        default: return NULL;
+    }
+}
+
+//getSpecializedVerticalFunction: Looks for a vertical pass with these exact taps compiled in, see
+//getSpecializedRowFunction
+SimdVerticalFunction getSpecializedVerticalFunction(const int16_t* taps,int size){
+    int builtin=size==3?findTaps(taps,builtinPassTaps[0],BUILTIN_PASS_COUNT,3):-1;
+    if (builtin<0) return NULL;
+    getSimdRowFunction();
+    switch (simdLevel){
+#ifdef SIMD_X86
+        case SIMD_AVX2: return builtinVerticalAvx2[builtin];
+        case SIMD_SSE4: return builtinVerticalSse4[builtin];
+#endif
+        case SIMD_SCALAR: return builtinVerticalScalar[builtin];
+        default: return NULL;
+    }
+}
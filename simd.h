@@ -0,0 +1,39 @@
+#ifndef ___SIMD
+#define ___SIMD
+#include <stdint.h>
+
+enum SimdLevels{SIMD_SCALAR=0,SIMD_SSE4=1,SIMD_AVX2=2,SIMD_NEON=3,SIMD_AUTO=4};
+
+//The form of a FixedKernel used by the vector row functions.  Sums are accumulated in 16 bit lanes, clamped at zero, then
+//divided either by a right shift (multiplier==0) or by taking the high half of sum*multiplier followed by a right shift.
+typedef struct{
+    int size;
+    int16_t* weights;
+    uint16_t multiplier;
+    int shift;
+} SimdKernel;
+
+//A row function computes count output bytes.  rows[0..size-1] point at the first output byte's position in each of the size
+//source rows the kernel covers, and each output byte reads the bytes up to size/2 pixels (size/2*bpp bytes) before and after it.
+typedef void (*SimdRowFunction)(const uint8_t** rows,uint8_t* out,int count,int bpp,const SimdKernel* kernel);
+
+//The two passes of a separable kernel.  The horizontal pass computes count 16 bit sums of size taps spaced bpp bytes apart
+//and centered on each byte; the vertical pass combines count entries of size horizontal sum rows and divides and saturates
+//them like the row function.
+typedef void (*SimdHorizontalFunction)(const uint8_t* row,int16_t* out,int count,int bpp,const int16_t* taps,int size);
+typedef void (*SimdVerticalFunction)(const int16_t** rows,uint8_t* out,int count,const int16_t* taps,int size,const SimdKernel* kernel);
+
+int makeSimdKernel(int16_t* weights,int size,int divisor,int maxSum,SimdKernel* kernel);
+void simdRowScalar(const uint8_t** rows,uint8_t* out,int count,int bpp,const SimdKernel* kernel);
+void simdHorizontalScalar(const uint8_t* row,int16_t* out,int count,int bpp,const int16_t* taps,int size);
+void simdVerticalScalar(const int16_t** rows,uint8_t* out,int count,const int16_t* taps,int size,const SimdKernel* kernel);
+SimdRowFunction getSimdRowFunction();
+SimdHorizontalFunction getSimdHorizontalFunction();
+SimdVerticalFunction getSimdVerticalFunction();
+SimdRowFunction getSpecializedRowFunction(const int16_t* weights,int size);
+SimdHorizontalFunction getSpecializedHorizontalFunction(const int16_t* taps,int size);
+SimdVerticalFunction getSpecializedVerticalFunction(const int16_t* taps,int size);
+int setSimdLevel(char* name);
+const char* getSimdName();
+
+#endif
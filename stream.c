@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "image.h"
+#include "timing.h"
+#include "options.h"
+#include "batch.h"
+#include "imageio.h"
+#include "png.h"
+#include "buffers.h"
+#include "counters.h"
+#include "stream.h"
+
+//openRowReader: Opens an image whose rows can be read in order without decoding the whole file
+//Parameters: fileName: A binary PPM (P6) or PGM (P5) file with a maxval of at most 255, or a headerless raw file of
+//                      interleaved 8 bit channels when options gives its size with --raw
+//            options: The parsed command line, for rawWidth, rawHeight and rawBpp
+//            reader: The RowReader to populate.  Release it with closeRowReader.
+//Returns: 0 on success, -1 if the file could not be opened or is not a supported format
+int openRowReader(char* fileName,Options* options,RowReader* reader){
+    uint8_t header[4096];
+    size_t length;
+    int offset;
+    memset(reader,0,sizeof(RowReader));
+    reader->file=fopen(fileName,"rb");
+    if (!reader->file) return -1;
+    if (options->rawWidth){
+        reader->width=options->rawWidth;
+        reader->height=options->rawHeight;
+        reader->bpp=options->rawBpp;
+        return 0;
+    }
+    length=fread(header,1,sizeof(header),reader->file);
+    offset=parsePnmHeader(header,length,&reader->width,&reader->height,&reader->bpp);
+    if (offset>=0 && !fseek(reader->file,offset,SEEK_SET)) return 0;
+    closeRowReader(reader);
+    return -1;
+}
+
+//readRows: Reads the next rows of an image
+//Parameters: reader: The reader from openRowReader
+//            rows: Receives count rows of width*bpp bytes each
+//            count: The number of rows to read
+//Returns: 0 on success, -1 if the file ended early
+int readRows(RowReader* reader,uint8_t* rows,int count){
+    size_t bytes=(size_t)count*reader->width*reader->bpp;
+    if (count<=0) return 0;
+    if (fread(rows,1,bytes,reader->file)!=bytes) return -1;
+    reader->rowsRead+=count;
+    return 0;
+}
+
+//closeRowReader: Closes the file of a RowReader
+void closeRowReader(RowReader* reader){
+    if (reader->file) fclose(reader->file);
+    reader->file=NULL;
+}
+
+//openRowWriter: Opens an output image to be written a strip of rows at a time
+//Parameters: fileName: Where the image goes.  The extension picks the format, see GetImageFormat.
+//            width,height,bpp: The size of the image
+//            writer: The RowWriter to populate.  Finish it with closeRowWriter.
+//Returns: 0 on success, -1 if the file could not be created or the format cannot hold bpp channels
+int openRowWriter(char* fileName,int width,int height,int bpp,RowWriter* writer){
+    char header[PNM_HEADER_MAX];
+    int headerLength=0;
+    memset(writer,0,sizeof(RowWriter));
+    writer->format=GetImageFormat(fileName);
+    writer->span=(size_t)width*bpp;
+    if (writer->format==FORMAT_STB) return openPngWriter(fileName,width,height,bpp,&writer->png);
+    if (writer->format==FORMAT_PNM){
+        headerLength=formatPnmHeader(header,width,height,bpp);
+        if (headerLength<0){
+            printf("Error: PPM/PGM output needs 1 or 3 channels, not %d.\n",bpp);
+            return -1;
+        }
+    }
+    writer->file=fopen(fileName,"wb");
+    if (!writer->file) return -1;
+    if (fwrite(header,1,headerLength,writer->file)!=(size_t)headerLength){
+        fclose(writer->file);
+        writer->file=NULL;
+        return -1;
+    }
+    return 0;
+}
+
+//writeRows: Writes the next rows of an image
+//Parameters: writer: The writer from openRowWriter
+//            rows: The first row
+//            stride: The bytes from one row to the next
+//            count: The number of rows
+//Returns: 0 on success, -1 if they could not be written
+int writeRows(RowWriter* writer,uint8_t* rows,size_t stride,int count){
+    int row;
+    if (writer->format==FORMAT_STB) return writePngRows(&writer->png,rows,stride,count);
+    for (row=0;row<count;row++)
+        if (fwrite(rows+row*stride,1,writer->span,writer->file)!=writer->span) return -1;
+    return 0;
+}
+
+//closeRowWriter: Finishes an image, writing the end of a PNG, and closes its file
+//Returns: 0 on success, -1 if the image could not be written
+int closeRowWriter(RowWriter* writer){
+    int result;
+    if (writer->format==FORMAT_STB) return closePngWriter(&writer->png);
+    result=fclose(writer->file)?-1:0;
+    writer->file=NULL;
+    return result;
+}
+
+//runStream: Applies a kernel chain to an image too large to hold in memory, one strip of rows at a time
+//Only a window of one strip plus the chain's radius of rows above and below it is held, for both the source and the
+//result.  Each window goes through the build's own convolute, so the rows within the radius of a window edge that is
+//not an image edge come out wrong, and are exactly the ones that are not written: those are recomputed as part of the
+//next strip.  After each strip the rows the next window shares with this one slide to its top and the rest are read
+//in.  Wrap borders need the far edge of the image and cannot be streamed.
+//Parameters: options: The parsed command line.  fileName is a binary PPM/PGM or, with --raw, a raw image, and the
+//                     result goes to output.png, the --output path (PNG, PPM/PGM or raw, written as the strips
+//                     come) or into outDir.
+//            chain: The kernels to apply
+//            timing: The Timing to fill in, with backend, kernel, simd and threads already set
+//            hook: Called after the last strip to fill in backend specific Timing fields, or NULL
+//Returns: 0 on success, -1 on failure
+int runStream(Options* options,KernelChain* chain,Timing* timing,TimingHook hook){
+    int i,radius=0,stripRows,windowRows,windowStart=0,windowEnd,row,result=0;
+    int64_t start=timingNow(),t2;
+    size_t span;
+    RowReader reader;
+    RowWriter writer;
+    Image window,destWindow;
+    char* outPath;
+    if (options->border==BORDER_WRAP){
+        printf("Error: wrap borders need the whole image and cannot be streamed.\n");
+        return -1;
+    }
+    if (options->planar || options->scale>1 || options->roiWidth || options->luma){
+        printf("Error: streaming reads interleaved pixels and writes whole images, without --planar, --scale, --roi or --luma.\n");
+        return -1;
+    }
+    for (i=0;i<chain->count;i++) radius+=chain->kernels[i].size/2;
+    t2=timingNow();
+    if (openRowReader(options->fileName,options,&reader)){
+        printf("Error loading file %s.  Streaming needs a binary PPM/PGM file or --raw.\n",options->fileName);
+        return -1;
+    }
+    timing->decodeNs=timingNow()-t2;
+    timing->width=reader.width;
+    timing->height=reader.height;
+    timing->bpp=reader.bpp;
+    span=(size_t)reader.width*reader.bpp;
+    stripRows=STREAM_STRIP_BYTES/span;
+    if (stripRows<2*radius) stripRows=2*radius;
+    if (stripRows<16) stripRows=16;
+    if (stripRows>reader.height) stripRows=reader.height;
+    windowRows=stripRows+2*radius<reader.height?stripRows+2*radius:reader.height;
+    t2=timingNow();
+    // the windows stay packed so rows can be read straight into them
+    window.data=takeBuffer(windowRows*span);
+    destWindow.data=takeBuffer(windowRows*span);
+    window.stride=destWindow.stride=span;
+    timing->allocNs=timingNow()-t2;
+    outPath=GetOutputPath(options->fileName,options);
+    if (makeOutputDirectory(options->outDir)) result=-1;
+    else if (!window.data || !destWindow.data || !outPath){
+        printf("Error allocating memory for the stream.\n");
+        result=-1;
+    }
+    else if (openRowWriter(outPath,reader.width,reader.height,reader.bpp,&writer)){
+        printf("Error writing file %s.\n",outPath);
+        result=-1;
+    }
+    else{
+        windowEnd=stripRows+radius<reader.height?stripRows+radius:reader.height;
+        t2=timingNow();
+        result=readRows(&reader,window.data,windowEnd);
+        timing->decodeNs+=timingNow()-t2;
+        for (row=0;!result && row<reader.height;row+=stripRows){
+            int end=row+stripRows<reader.height?row+stripRows:reader.height,next,nextEnd;
+            window.width=destWindow.width=reader.width;
+            window.bpp=destWindow.bpp=reader.bpp;
+            window.height=destWindow.height=windowEnd-windowStart;
+            t2=timingNow();
+            convolutePlanes(&window,&destWindow,chain,options);
+            timing->convoluteNs+=timingNow()-t2;
+            t2=timingNow();
+            result=writeRows(&writer,destWindow.data+(row-windowStart)*span,span,end-row);
+            timing->encodeNs+=timingNow()-t2;
+            if (result || end==reader.height) break;
+            next=end-radius>0?end-radius:0;
+            nextEnd=end+stripRows+radius<reader.height?end+stripRows+radius:reader.height;
+            memmove(window.data,window.data+(next-windowStart)*span,(windowEnd-next)*span);
+            t2=timingNow();
+            result=readRows(&reader,window.data+(windowEnd-next)*span,nextEnd-windowEnd);
+            timing->decodeNs+=timingNow()-t2;
+            windowStart=next;
+            windowEnd=nextEnd;
+        }
+        if (result) printf("Error streaming file %s.\n",options->fileName);
+        t2=timingNow();
+        if (closeRowWriter(&writer) && !result){
+            printf("Error writing file %s.\n",outPath);
+            result=-1;
+        }
+        timing->encodeNs+=timingNow()-t2;
+    }
+    closeRowReader(&reader);
+    giveBuffer(window.data);
+    giveBuffer(destWindow.data);
+    free(outPath);
+    if (result) return -1;
+    countersReport(timing);
+    if (hook) hook(timing);
+    timing->totalNs=timingNow()-start;
+    timingPrint(timing);
+    return timingWriteReport(timing,options->reportFormat,options->reportFile);
+}
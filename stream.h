@@ -0,0 +1,41 @@
+#ifndef ___STREAM
+#define ___STREAM
+#include <stdio.h>
+#include <stdint.h>
+#include "image.h"
+#include "timing.h"
+#include "options.h"
+#include "batch.h"
+#include "png.h"
+#include "imageio.h"
+
+//Roughly how many bytes of source rows each strip of a streamed image reads at once
+#define STREAM_STRIP_BYTES (16*1024*1024)
+
+//Reads the rows of a binary PPM/PGM (P6/P5 with a maxval up to 255) or headerless raw image in order, one strip at a time
+typedef struct{
+    FILE* file;
+    int width;
+    int height;
+    int bpp;
+    int rowsRead;
+} RowReader;
+
+//Writes the rows of an image in order as they are produced: compressed into a PNG, or straight to the file for PPM/PGM
+//and raw outputs, whose rows sit at fixed offsets and need no encoding.  span is the bytes in one row.
+typedef struct{
+    enum ImageFormats format;
+    FILE* file;
+    size_t span;
+    PngWriter png;
+} RowWriter;
+
+int openRowReader(char* fileName,Options* options,RowReader* reader);
+int readRows(RowReader* reader,uint8_t* rows,int count);
+void closeRowReader(RowReader* reader);
+int openRowWriter(char* fileName,int width,int height,int bpp,RowWriter* writer);
+int writeRows(RowWriter* writer,uint8_t* rows,size_t stride,int count);
+int closeRowWriter(RowWriter* writer);
+int runStream(Options* options,KernelChain* chain,Timing* timing,TimingHook hook);
+
+#endif
@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "timing.h"
+#include "counters.h"
+
+//timingNow: Reads the monotonic clock
+//Returns: The current time in nanoseconds.  Only differences between two calls are meaningful.
+int64_t timingNow(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (int64_t)ts.tv_sec*1000000000LL+ts.tv_nsec;
+}
+
+//timingMegapixelsPerSecond: Computes the convolution throughput of a run
+//Parameters: timing: A populated Timing struct
+//Returns: Megapixels processed per second of convolute time, or 0 if nothing was timed
+double timingMegapixelsPerSecond(Timing* timing){
+    if (timing->convoluteNs<=0) return 0;
+    return (double)timing->width*timing->height/(timing->convoluteNs/1000.0);
+}
+
+//timingBytesPerPixel: Estimates the memory traffic of the convolution from its last level cache misses, a line each
+//Returns: Bytes moved between the cache and memory per output pixel, or 0 without counters
+double timingBytesPerPixel(Timing* timing){
+    if (!timing->counted || !timing->width || !timing->height) return 0;
+    return (double)timing->llcMisses*COUNTER_LINE_BYTES/((double)timing->width*timing->height);
+}
+
+//timingBandwidth: Returns the memory bandwidth the convolution achieved in bytes per second, from the same estimate,
+//or 0 without counters
+double timingBandwidth(Timing* timing){
+    if (!timing->counted || timing->convoluteNs<=0) return 0;
+    return (double)timing->llcMisses*COUNTER_LINE_BYTES/(timing->convoluteNs/1e9);
+}
+
+//timingPrint: Prints a human readable summary of a run to stdout
+//Parameters: timing: A populated Timing struct
+//Returns: Nothing
+void timingPrint(Timing* timing){
+    printf("Took %.6f seconds (decode %.6f, alloc %.6f, convolute %.6f, encode %.6f) with %d threads, %.2f MP/s\n",
+        timing->totalNs/1e9,timing->decodeNs/1e9,timing->allocNs/1e9,timing->convoluteNs/1e9,timing->encodeNs/1e9,
+        timing->threads,timingMegapixelsPerSecond(timing));
+    if (timing->transferNs || timing->kernelNs)
+        printf("Offload transfers %.6f, kernels %.6f seconds, summed over bands\n",timing->transferNs/1e9,timing->kernelNs/1e9);
+    if (timing->ranks>1) printf("Split across %d ranks, %.6f seconds exchanging rows\n",timing->ranks,timing->exchangeNs/1e9);
+    if (timing->counted){
+        double pixels=(double)timing->width*timing->height;
+        printf("Per pixel: %.2f cycles, %.2f instructions (IPC %.2f), %.4f L1 and %.4f LLC misses, %.2f bytes moved\n",
+            timing->cycles/pixels,timing->instructions/pixels,timing->cycles?(double)timing->instructions/timing->cycles:0,
+            timing->l1Misses/pixels,timing->llcMisses/pixels,timingBytesPerPixel(timing));
+        printf("Achieved %.2f GB/s of the %.2f GB/s STREAM triad\n",timingBandwidth(timing)/1e9,timing->streamBandwidth/1e9);
+    }
+}
+
+//writeJsonString: Writes a string as a quoted JSON value, escaping quotes and backslashes, or null for NULL
+static void writeJsonString(FILE* out,const char* value){
+    if (!value){
+        fputs("null",out);
+        return;
+    }
+    fputc('"',out);
+    for (;*value;value++){
+        if (*value=='"' || *value=='\\') fputc('\\',out);
+        if ((unsigned char)*value>=0x20) fputc(*value,out);
+    }
+    fputc('"',out);
+}
+
+//writeCsvString: Writes a string as a CSV field, quoting it when it holds a comma or quote (kernel chains like gauss,edge)
+static void writeCsvString(FILE* out,const char* value){
+    if (!value) return;
+    if (!strpbrk(value,",\"\n")){
+        fputs(value,out);
+        return;
+    }
+    fputc('"',out);
+    for (;*value;value++){
+        if (*value=='"') fputc('"',out);
+        fputc(*value,out);
+    }
+    fputc('"',out);
+}
+
+//timingWriteReport: Writes a single machine readable line describing a run
+//Parameters: timing: A populated Timing struct
+//            format: REPORT_JSON for a JSON object per line, REPORT_CSV for comma separated values
+//            path: File to append the line to, or NULL for stdout.  A CSV header is written when the file is new or empty.
+//Returns: 0 on success, -1 if the report file could not be opened
+int timingWriteReport(Timing* timing,enum ReportFormats format,const char* path){
+    int i;
+    FILE* out=stdout;
+    if (format==REPORT_NONE) return 0;
+    if (path){
+        out=fopen(path,"a");
+        if (!out){
+            printf("Error opening report file %s.\n",path);
+            return -1;
+        }
+        fseek(out,0,SEEK_END);
+    }
+    if (format==REPORT_JSON){
+        fprintf(out,"{\"backend\":");
+        writeJsonString(out,timing->backend);
+        fprintf(out,",\"file\":");
+        writeJsonString(out,timing->fileName);
+        fprintf(out,",\"kernel\":");
+        writeJsonString(out,timing->kernel);
+        fprintf(out,",\"simd\":");
+        writeJsonString(out,timing->simd);
+        fprintf(out,",\"width\":%d,\"height\":%d,\"bpp\":%d,\"threads\":%d,\"tile_width\":%d,\"tile_height\":%d,\"schedule\":",
+            timing->width,timing->height,timing->bpp,timing->threads,timing->tileWidth,timing->tileHeight);
+        writeJsonString(out,timing->schedule);
+        fprintf(out,",\"affinity\":");
+        writeJsonString(out,timing->affinity);
+        fprintf(out,","
+            "\"decode_ns\":%lld,\"alloc_ns\":%lld,\"convolute_ns\":%lld,\"encode_ns\":%lld,\"total_ns\":%lld,"
+            "\"mpix_per_s\":%.3f,\"ranks\":%d,\"exchange_ns\":%lld,\"transfer_ns\":%lld,\"kernel_ns\":%lld,\"workers\":[",
+            (long long)timing->decodeNs,(long long)timing->allocNs,(long long)timing->convoluteNs,
+            (long long)timing->encodeNs,(long long)timing->totalNs,timingMegapixelsPerSecond(timing),
+            timing->ranks,(long long)timing->exchangeNs,(long long)timing->transferNs,(long long)timing->kernelNs);
+        for (i=0;i<timing->workers;i++)
+            fprintf(out,"%s{\"busy_ns\":%lld,\"idle_ns\":%lld,\"steals\":%d,\"node\":%d}",i?",":"",
+                (long long)timing->busyNs[i],(long long)timing->idleNs[i],timing->steals[i],timing->nodes?timing->nodes[i]:0);
+        fprintf(out,"],\"pipeline\":");
+        if (timing->pipelined)
+            fprintf(out,"{\"decode_depth\":%d,\"encode_depth\":%d,\"decode_blocked_ns\":%lld,\"convolute_starved_ns\":%lld,"
+                "\"convolute_blocked_ns\":%lld,\"encode_starved_ns\":%lld}",timing->decodeDepth,timing->encodeDepth,
+                (long long)timing->decodeBlockedNs,(long long)timing->convoluteStarvedNs,
+                (long long)timing->convoluteBlockedNs,(long long)timing->encodeStarvedNs);
+        else fputs("null",out);
+        fprintf(out,",\"counters\":");
+        if (timing->counted)
+            fprintf(out,"{\"cycles\":%llu,\"instructions\":%llu,\"l1_misses\":%llu,\"llc_misses\":%llu,\"bytes_per_pixel\":%.3f,"
+                "\"bandwidth_gbs\":%.3f,\"stream_gbs\":%.3f}",(unsigned long long)timing->cycles,
+                (unsigned long long)timing->instructions,(unsigned long long)timing->l1Misses,
+                (unsigned long long)timing->llcMisses,timingBytesPerPixel(timing),timingBandwidth(timing)/1e9,
+                timing->streamBandwidth/1e9);
+        else fputs("null",out);
+        fprintf(out,"}\n");
+    }else{
+        if (!path || ftell(out)==0)
+            fprintf(out,"backend,file,kernel,simd,width,height,bpp,threads,decode_ns,alloc_ns,convolute_ns,encode_ns,total_ns,mpix_per_s,tile_width,tile_height,schedule,"
+                "busy_ns,idle_ns,steals,decode_depth,encode_depth,decode_blocked_ns,convolute_starved_ns,convolute_blocked_ns,encode_starved_ns,ranks,exchange_ns,transfer_ns,kernel_ns,affinity,nodes,"
+                "cycles,instructions,l1_misses,llc_misses,bytes_per_pixel,bandwidth_gbs,stream_gbs\n");
+        writeCsvString(out,timing->backend);
+        fputc(',',out);
+        writeCsvString(out,timing->fileName);
+        fputc(',',out);
+        writeCsvString(out,timing->kernel);
+        fputc(',',out);
+        writeCsvString(out,timing->simd);
+        fprintf(out,",%d,%d,%d,%d,%lld,%lld,%lld,%lld,%lld,%.3f",
+            timing->width,timing->height,timing->bpp,timing->threads,
+            (long long)timing->decodeNs,(long long)timing->allocNs,(long long)timing->convoluteNs,
+            (long long)timing->encodeNs,(long long)timing->totalNs,timingMegapixelsPerSecond(timing));
+        fprintf(out,",%d,%d,",timing->tileWidth,timing->tileHeight);
+        writeCsvString(out,timing->schedule);
+        // one value per worker in each of the last three fields, separated by semicolons
+        fputc(',',out);
+        for (i=0;i<timing->workers;i++) fprintf(out,"%s%lld",i?";":"",(long long)timing->busyNs[i]);
+        fputc(',',out);
+        for (i=0;i<timing->workers;i++) fprintf(out,"%s%lld",i?";":"",(long long)timing->idleNs[i]);
+        fputc(',',out);
+        for (i=0;i<timing->workers;i++) fprintf(out,"%s%d",i?";":"",timing->steals[i]);
+        if (timing->pipelined)
+            fprintf(out,",%d,%d,%lld,%lld,%lld,%lld",timing->decodeDepth,timing->encodeDepth,(long long)timing->decodeBlockedNs,
+                (long long)timing->convoluteStarvedNs,(long long)timing->convoluteBlockedNs,(long long)timing->encodeStarvedNs);
+        else fputs(",,,,,,",out);
+        fprintf(out,",%d,%lld,%lld,%lld,",timing->ranks,(long long)timing->exchangeNs,(long long)timing->transferNs,(long long)timing->kernelNs);
+        writeCsvString(out,timing->affinity);
+        fputc(',',out);
+        for (i=0;i<timing->workers && timing->nodes;i++) fprintf(out,"%s%d",i?";":"",timing->nodes[i]);
+        if (timing->counted)
+            fprintf(out,",%llu,%llu,%llu,%llu,%.3f,%.3f,%.3f\n",(unsigned long long)timing->cycles,
+                (unsigned long long)timing->instructions,(unsigned long long)timing->l1Misses,
+                (unsigned long long)timing->llcMisses,timingBytesPerPixel(timing),timingBandwidth(timing)/1e9,
+                timing->streamBandwidth/1e9);
+        else fputs(",,,,,,,\n",out);
+    }
+    if (path) fclose(out);
+    return 0;
+}
+
+//GetReportFormat: Converts the string name of a report format into a value from the ReportFormats enumeration
+//Parameters: name: "json" or "csv"
+//Returns: The matching ReportFormats entry, REPORT_NONE for anything else
+enum ReportFormats GetReportFormat(char* name){
+    if (!strcmp(name,"json")) return REPORT_JSON;
+    else if (!strcmp(name,"csv")) return REPORT_CSV;
+    else return REPORT_NONE;
+}
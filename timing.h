@@ -0,0 +1,71 @@
+#ifndef ___TIMING
+#define ___TIMING
+#include <stdio.h>
+#include <stdint.h>
+
+enum ReportFormats{REPORT_NONE=0,REPORT_JSON=1,REPORT_CSV=2};
+
+//Per-stage timings for one run of the program.  All times are in nanoseconds from a monotonic clock.
+//tileWidth, tileHeight and schedule describe how the OpenMP build split up the work, and are 0 or NULL for the other builds.
+//For the pthreads build busyNs, idleNs and steals hold one entry for each of its workers, and nodes the NUMA node each
+//worker runs on.  affinity is how the threads were pinned, from --affinity.
+//pipelined is set for images of a batch, where decode, convolute and encode run on their own threads.  decodeDepth and
+//encodeDepth are how many images were waiting in the convolute and encode queues once this one joined them, and the
+//Blocked and Starved times are how long a stage waited on this image for room in its output queue or for its input.
+//ranks is the number of MPI processes image-mpi split the image across, 1 for the other programs, and exchangeNs is the
+//time they spent scattering rows, swapping halos and gathering the result.
+//transferNs and kernelNs are the offload backend's time copying bands to and from the device and running its kernels,
+//each summed over the bands, which overlap, so together they can exceed convoluteNs.
+//counted is set when --counters read the hardware counters of the convolution: cycles, instructions, l1Misses and
+//llcMisses are summed over every thread, and streamBandwidth is the STREAM triad's bytes per second on as many threads.
+typedef struct{
+    const char* backend;
+    const char* fileName;
+    const char* kernel;
+    const char* simd;
+    int width;
+    int height;
+    int bpp;
+    int threads;
+    int ranks;
+    int tileWidth;
+    int tileHeight;
+    const char* schedule;
+    int workers;
+    const int64_t* busyNs;
+    const int64_t* idleNs;
+    const int* steals;
+    const int* nodes;
+    const char* affinity;
+    int64_t decodeNs;
+    int64_t allocNs;
+    int64_t convoluteNs;
+    int64_t encodeNs;
+    int64_t exchangeNs;
+    int64_t transferNs;
+    int64_t kernelNs;
+    int64_t totalNs;
+    int pipelined;
+    int decodeDepth;
+    int encodeDepth;
+    int64_t decodeBlockedNs;
+    int64_t convoluteStarvedNs;
+    int64_t convoluteBlockedNs;
+    int64_t encodeStarvedNs;
+    int counted;
+    uint64_t cycles;
+    uint64_t instructions;
+    uint64_t l1Misses;
+    uint64_t llcMisses;
+    double streamBandwidth;
+} Timing;
+
+int64_t timingNow();
+double timingMegapixelsPerSecond(Timing* timing);
+double timingBytesPerPixel(Timing* timing);
+double timingBandwidth(Timing* timing);
+void timingPrint(Timing* timing);
+int timingWriteReport(Timing* timing,enum ReportFormats format,const char* path);
+enum ReportFormats GetReportFormat(char* name);
+
+#endif
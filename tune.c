@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "image.h"
+#include "timing.h"
+#include "options.h"
+#include "imageio.h"
+#include "backend.h"
+#include "convolve.h"
+#include "chain.h"
+#include "tune.h"
+
+//The backends --tune compares.  offload is left out: without a device its regions run on the host, and with one the
+//transfers dominate images small enough for the host backends to be worth comparing.
+static const Backend* tuneBackends[]={&serialBackend,&openmpBackend,&pthreadsBackend};
+#define TUNE_BACKENDS (int)(sizeof(tuneBackends)/sizeof(tuneBackends[0]))
+
+//The number of tab separated fields on a line of the cache file: host, width, height, bpp, kernel, the TUNE_SETTINGS
+//settings, backend, threads, tile width and tile height.  Lines from older versions have fewer and are skipped.
+#define TUNE_FIELDS 14
+
+//The number of settings besides the shape and kernel that change which configuration is fastest, see tuneSettings
+#define TUNE_SETTINGS 5
+
+//hostName: Fills in the name of this machine, so one cache file can be shared between hosts
+static void hostName(char* name,int size){
+    if (gethostname(name,size)) snprintf(name,size,"unknown");
+    name[size-1]=0;
+}
+
+//tuneSettings: Names the settings that are part of the cache key besides the shape and kernel: the border mode, the
+//--method forced on every plan, whether chains are fused and rank one kernels run in two passes, and the channel layout
+//convolutePlanes works in.  A configuration tuned under --method fft says nothing about a direct run.
+//Parameters: options: The command line settings
+//            settings: Receives TUNE_SETTINGS names
+static void tuneSettings(Options* options,const char** settings){
+    settings[0]=getBorderName(options->border);
+    settings[1]=getForcedMethodName();
+    settings[2]=getChainFusion()?"fuse":"no-fuse";
+    settings[3]=getSeparable()?"separable":"no-separable";
+    settings[4]=options->planarLayout?"planar":options->skipAlpha?"skip-alpha":"interleaved";
+}
+
+//loadTuning: Looks up the configuration --tune picked for an image shape, kernel and settings on this host
+//The cache is appended to every time an image is tuned, so a later line replaces an earlier one with the same key.
+//Parameters: path: The cache file
+//            image: The image to be convoluted, whose width, height and bpp are part of the key
+//            options: The command line settings, whose kernel chain (type) and tuneSettings are the rest of the key
+//            choice: Receives the configuration
+//Returns: 0 if one was found, -1 if the file is missing or has none for this key
+int loadTuning(const char* path,Image* image,Options* options,TuneChoice* choice){
+    char line[1024],host[256];
+    const char* settings[TUNE_SETTINGS];
+    int i,found=-1;
+    FILE* file=fopen(path,"r");
+    if (!file) return -1;
+    hostName(host,sizeof(host));
+    tuneSettings(options,settings);
+    while (fgets(line,sizeof(line),file)){
+        char* fields[TUNE_FIELDS];
+        char* field=strtok(line,"\t\n");
+        int count=0;
+        const Backend* backend;
+        while (field && count<TUNE_FIELDS){
+            fields[count++]=field;
+            field=strtok(NULL,"\t\n");
+        }
+        if (count!=TUNE_FIELDS || strcmp(fields[0],host) || atoi(fields[1])!=image->width || atoi(fields[2])!=image->height ||
+            atoi(fields[3])!=image->bpp || strcmp(fields[4],options->type)) continue;
+        for (i=0;i<TUNE_SETTINGS && !strcmp(fields[5+i],settings[i]);i++);
+        if (i<TUNE_SETTINGS) continue;
+        backend=GetBackend(fields[10]);
+        if (!backend) continue;
+        choice->backend=backend;
+        choice->threads=atoi(fields[11]);
+        choice->tileWidth=atoi(fields[12]);
+        choice->tileHeight=atoi(fields[13]);
+        found=0;
+    }
+    fclose(file);
+    return found;
+}
+
+//saveTuning: Appends the configuration picked for an image shape, kernel and settings on this host to the cache
+//Parameters: path,image,options: As for loadTuning
+//            choice: The configuration to save
+//Returns: 0 on success, -1 if the file could not be written
+int saveTuning(const char* path,Image* image,Options* options,TuneChoice* choice){
+    char host[256];
+    const char* settings[TUNE_SETTINGS];
+    FILE* file=fopen(path,"a");
+    if (!file){
+        printf("Error writing tuning file %s.\n",path);
+        return -1;
+    }
+    hostName(host,sizeof(host));
+    tuneSettings(options,settings);
+    fprintf(file,"%s\t%d\t%d\t%d\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%d\t%d\t%d\n",host,image->width,image->height,image->bpp,
+        options->type,settings[0],settings[1],settings[2],settings[3],settings[4],choice->backend->name,choice->threads,
+        choice->tileWidth,choice->tileHeight);
+    return fclose(file)?-1:0;
+}
+
+//applyTuning: Switches to a tuned configuration, as if it had been given with --backend, --threads and --tile
+//Parameters: choice: The configuration
+//            options: The command line settings, updated to match
+//Returns: The backend now running
+const Backend* applyTuning(TuneChoice* choice,Options* options){
+    options->backend=(char*)choice->backend->name;
+    options->threads=choice->threads;
+    options->tileWidth=choice->tileWidth;
+    options->tileHeight=choice->tileHeight;
+    return switchBackend(choice->backend,options);
+}
+
+//nextThreads: Steps through the thread counts tried for a parallel backend: powers of two below the number of cores,
+//then the number of cores itself
+//Returns: The count after threads, or 0 once every count has been tried
+static int nextThreads(int threads,int cores){
+    if (threads*2<cores) return threads*2;
+    return threads<cores?cores:0;
+}
+
+//timeCandidate: Times the current backend on an image
+//The first run is not counted, so the pthreads pool and the OpenMP tile autotuner have settled before the timed ones.
+//Returns: The fastest of TUNE_REPEATS runs in nanoseconds
+static int64_t timeCandidate(Image* srcImage,Image* destImage,KernelChain* chain,Options* options){
+    int i;
+    int64_t best=-1;
+    convolutePlanes(srcImage,destImage,chain,options);
+    for (i=0;i<TUNE_REPEATS;i++){
+        int64_t start=timingNow(),elapsed;
+        convolutePlanes(srcImage,destImage,chain,options);
+        elapsed=timingNow()-start;
+        if (best<0 || elapsed<best) best=elapsed;
+    }
+    return best;
+}
+
+//tuneImage: Times every candidate configuration on an image and switches to the fastest
+//The serial backend is tried once, and openmp and pthreads at each count from nextThreads.  --backend and --threads
+//narrow the candidates down to the ones they name (--backend offload included), and --tile fixes the OpenMP tile size.
+//Parameters: srcImage,destImage: The images to convolute.  destImage holds the result of the last candidate.
+//            chain: The kernels
+//            options: The command line settings, updated to the fastest configuration
+//            best: Receives the fastest configuration
+//Returns: The backend now running
+const Backend* tuneImage(Image* srcImage,Image* destImage,KernelChain* chain,Options* options,TuneChoice* best){
+    int i,threads,cores=(int)sysconf(_SC_NPROCESSORS_ONLN);
+    int64_t bestNs=-1;
+    Options candidate=*options;
+    const Backend* only=options->backend?GetBackend(options->backend):NULL;
+    if (cores<1) cores=1;
+    memset(best,0,sizeof(TuneChoice));
+    printf("Tuning %dx%dx%d with %s:\n",destImage->width,destImage->height,destImage->bpp,options->type);
+    for (i=0;i<(only?1:TUNE_BACKENDS);i++){
+        const Backend* backend=only?only:tuneBackends[i];
+        int serial=backend==&serialBackend;
+        for (threads=options->threads?options->threads:1;threads;threads=serial || options->threads?0:nextThreads(threads,cores)){
+            Timing timing;
+            int64_t elapsed;
+            candidate.threads=serial?1:threads;
+            switchBackend(backend,&candidate);
+            elapsed=timeCandidate(srcImage,destImage,chain,&candidate);
+            memset(&timing,0,sizeof(Timing));
+            if (backend->report) backend->report(&timing);
+            printf("  %-8s %4d threads: %.6f seconds\n",backend->name,candidate.threads,elapsed/1e9);
+            if (bestNs<0 || elapsed<bestNs){
+                bestNs=elapsed;
+                best->backend=backend;
+                best->threads=candidate.threads;
+                best->tileWidth=timing.tileWidth;
+                best->tileHeight=timing.tileHeight;
+            }
+        }
+    }
+    printf("Picked %s with %d threads.\n",best->backend->name,best->threads);
+    return applyTuning(best,options);
+}
+
+//chooseTuning: Settles the configuration a single image runs with once its shape is known
+//With --tune the candidates are timed and the fastest is saved.  Otherwise, unless --backend, --threads or --tile
+//were given, a configuration saved for this shape, kernel and settings on this host replaces the defaults.
+//Parameters: srcImage,destImage: The images about to be convoluted
+//            chain: The kernels
+//            options: The command line settings, updated to the configuration used
+//            backend: The backend running now
+//Returns: The backend to convolute with
+const Backend* chooseTuning(Image* srcImage,Image* destImage,KernelChain* chain,Options* options,const Backend* backend){
+    TuneChoice choice;
+    const char* path=options->tuneFile?options->tuneFile:TUNE_FILE;
+    if (options->tune){
+        backend=tuneImage(srcImage,destImage,chain,options,&choice);
+        saveTuning(path,destImage,options,&choice);
+    }
+    else if (!options->backend && !options->threads && !options->tileWidth && !loadTuning(path,destImage,options,&choice)){
+        printf("Using tuned %s with %d threads from %s.\n",choice.backend->name,choice.threads,path);
+        backend=applyTuning(&choice,options);
+    }
+    return backend;
+}
@@ -0,0 +1,28 @@
+#ifndef ___TUNE
+#define ___TUNE
+#include "image.h"
+#include "options.h"
+#include "backend.h"
+
+//The cache file --tune writes and later runs read, unless --tune-file names another
+#define TUNE_FILE "image.tune"
+
+//How many timed runs each candidate gets after its warm up run.  The fastest of them is its time.
+#define TUNE_REPEATS 3
+
+//The configuration --tune picked for one image shape and kernel.  tileWidth and tileHeight are only set for the openmp
+//backend, and are the size its own tile autotuner settled on.
+typedef struct{
+    const Backend* backend;
+    int threads;
+    int tileWidth;
+    int tileHeight;
+} TuneChoice;
+
+int loadTuning(const char* path,Image* image,Options* options,TuneChoice* choice);
+int saveTuning(const char* path,Image* image,Options* options,TuneChoice* choice);
+const Backend* applyTuning(TuneChoice* choice,Options* options);
+const Backend* tuneImage(Image* srcImage,Image* destImage,KernelChain* chain,Options* options,TuneChoice* best);
+const Backend* chooseTuning(Image* srcImage,Image* destImage,KernelChain* chain,Options* options,const Backend* backend);
+
+#endif